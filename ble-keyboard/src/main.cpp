@@ -1,5 +1,19 @@
+#include "ble_conn_params.hpp"
+#include "ble_host_table.hpp"
+#include "ble_link_sequencer.hpp"
+#include "ble_reconnect.hpp"
+#include "boot_trace.h"
+#include "deferred_log.hpp"
+#include "demo_keymap.hpp"
+#include "event_trace.h"
 #include "iolib.h"
+#include "key_event_ring.hpp"
+#include "ram_budget.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/gatt.h>
 #include <zephyr/bluetooth/hci.h>
 #include <zephyr/bluetooth/services/bas.h>
 #include <zephyr/drivers/hwinfo.h>
@@ -8,8 +22,10 @@
 #include <zephyr/logging/log.h>
 #include <zephyr/settings/settings.h>
 #include <zephyr/shell/shell.h>
+#include <zephyr/shell/shell_uart.h>
 
-#include "simple_keyboard.hpp"
+#include "nkro_keyboard.hpp"
+#include <magic_enum.hpp>
 #include <port/zephyr/bluetooth/hid.hpp>
 #include <port/zephyr/bluetooth/le.hpp>
 #include <port/zephyr/message_queue.hpp>
@@ -31,12 +47,22 @@ static int advertise(void)
     static constexpr auto ad = to_adv_data<ad_struct_count(ad_data)>(ad_data);
     static constexpr auto sd_data = join(ad_struct(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME));
     static constexpr auto sd = to_adv_data<ad_struct_count(sd_data)>(sd_data);
-    const bt_le_adv_param* adv_param = BT_LE_ADV_PARAM(
-        BT_LE_ADV_OPT_CONN, BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, nullptr);
 
-    auto err = bt_le_adv_start(adv_param, ad.data(), ad.size(), sd.data(), sd.size());
+    int err;
+    if (IS_ENABLED(CONFIG_DEMO_BLE_RECONNECT))
+    {
+        reconnect().set_data(ad, sd);
+        err = reconnect().start();
+    }
+    else
+    {
+        const bt_le_adv_param* adv_param = BT_LE_ADV_PARAM(
+            BT_LE_ADV_OPT_CONN, BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, nullptr);
+        err = bt_le_adv_start(adv_param, ad.data(), ad.size(), sd.data(), sd.size());
+    }
     if (err == 0)
     {
+        boot_trace_done("advertising");
         iolib_set_led(adv_led, true);
         LOG_INF("Advertising successfully started\n");
     }
@@ -57,16 +83,83 @@ auto& pairing_msgq()
     return msgq;
 }
 
+/// @brief A connection event, captured in the Bluetooth host's callbacks.
+struct conn_event
+{
+    enum kind : uint8_t
+    {
+        CONNECTED,
+        DISCONNECTED,
+        SECURITY_CHANGED,
+    };
+    bt_addr_le_t addr;
+    kind type;
+    uint8_t err; // HCI error, disconnect reason, or bt_security_err
+    uint8_t level;
+
+    conn_event(kind t, bt_conn* conn, uint8_t e, uint8_t l = 0)
+        : addr(*bt_conn_get_dst(conn)), type(t), err(e), level(l)
+    {}
+};
+
+/// @brief Formats the connection events, outside of the Bluetooth host's context.
+static void log_conn_event(const conn_event& evt)
+{
+    char addr[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(&evt.addr, addr, sizeof(addr));
+    switch (evt.type)
+    {
+    case conn_event::CONNECTED:
+        if (evt.err)
+        {
+            LOG_WRN("Failed to connect to %s 0x%02x %s\n", addr, evt.err,
+                    bt_hci_err_to_str(evt.err));
+        }
+        else
+        {
+            LOG_INF("Connected %s\n", addr);
+        }
+        break;
+    case conn_event::DISCONNECTED:
+        LOG_INF("Disconnected from %s, reason 0x%02x %s\n", addr, evt.err,
+                bt_hci_err_to_str(evt.err));
+        break;
+    case conn_event::SECURITY_CHANGED:
+        if (!evt.err)
+        {
+            LOG_INF("Security changed: %s level %u\n", addr, evt.level);
+        }
+        else
+        {
+            LOG_WRN("Security failed: %s level %u err %d %s\n", addr, evt.level, evt.err,
+                    bt_security_err_to_str(static_cast<bt_security_err>(evt.err)));
+        }
+        break;
+    }
+}
+
 static void connected(bt_conn* conn, uint8_t err)
 {
-    bluetooth::zephyr::address_str addr{conn};
+    deferred_log::log<log_conn_event>(conn_event{conn_event::CONNECTED, conn, err});
 
+    if (IS_ENABLED(CONFIG_DEMO_BLE_RECONNECT))
+    {
+        // also moves on to the next phase when directed advertising times out
+        reconnect().connected(conn, err);
+    }
     if (err)
     {
-        LOG_WRN("Failed to connect to %s 0x%02x %s\n", addr.data(), err, bt_hci_err_to_str(err));
         return;
     }
-    LOG_INF("Connected %s\n", addr.data());
+    if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS) and !IS_ENABLED(CONFIG_DEMO_BLE_LINK_SEQUENCER))
+    {
+        // otherwise attached by the link sequencer, after its other procedures
+        conn_params().attach(conn);
+    }
+    if (IS_ENABLED(CONFIG_DEMO_BLE_MULTI_HOST))
+    {
+        hosts().connected(conn);
+    }
 
     if (!advertise())
     {
@@ -76,27 +169,35 @@ static void connected(bt_conn* conn, uint8_t err)
 
 static void disconnected(bt_conn* conn, uint8_t reason)
 {
-    bluetooth::zephyr::address_str addr{conn};
-
-    LOG_INF("Disconnected from %s, reason 0x%02x %s\n", addr.data(), reason,
-            bt_hci_err_to_str(reason));
+    deferred_log::log<log_conn_event>(conn_event{conn_event::DISCONNECTED, conn, reason});
+    if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+    {
+        conn_params().detach(conn);
+    }
+    if (IS_ENABLED(CONFIG_DEMO_BLE_MULTI_HOST))
+    {
+        hosts().disconnected(conn);
+    }
 
     advertise();
 }
 
+#if CONFIG_DEMO_BLE_MULTI_HOST
+static void host_ready(bt_conn* conn);
+#endif
+
 static void security_changed(bt_conn* conn, bt_security_t level, bt_security_err err)
 {
-    bluetooth::zephyr::address_str addr{conn};
-
+    deferred_log::log<log_conn_event>(
+        conn_event{conn_event::SECURITY_CHANGED, conn, static_cast<uint8_t>(err),
+                   static_cast<uint8_t>(level)});
+#if CONFIG_DEMO_BLE_MULTI_HOST
     if (!err)
     {
-        LOG_INF("Security changed: %s level %u\n", addr.data(), level);
-    }
-    else
-    {
-        LOG_WRN("Security failed: %s level %u err %d %s\n", addr.data(), level, err,
-                bt_security_err_to_str(err));
+        // the bonded host's subscriptions are restored with the encryption
+        host_ready(conn);
     }
+#endif
 }
 
 static void le_param_updated(bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout);
@@ -131,6 +232,14 @@ static void pairing_complete(bt_conn* conn, bool bonded)
 {
     bluetooth::zephyr::address_str addr{conn};
     LOG_INF("Pairing completed: %s, bonded: %d\n", addr.data(), bonded);
+    if (IS_ENABLED(CONFIG_DEMO_BLE_MULTI_HOST) and bonded)
+    {
+        hosts().bonded(conn);
+    }
+    if (IS_ENABLED(CONFIG_DEMO_BLE_RECONNECT) and bonded)
+    {
+        reconnect().set_peer(*bt_conn_get_dst(conn));
+    }
 }
 
 static void pairing_failed(bt_conn* conn, bt_security_err reason)
@@ -199,22 +308,225 @@ static int cmd_bt_battery(const shell* sh, size_t argc, char** argv)
     return 0;
 }
 
+static int cmd_bt_stats(const shell* sh, size_t argc, char** argv);
+static int cmd_bt_bench(const shell* sh, size_t argc, char** argv);
+#if CONFIG_DEMO_BLE_MULTI_HOST
+static int cmd_bt_host(const shell* sh, size_t argc, char** argv);
+#endif
+#if CONFIG_DEMO_BLE_RECONNECT
+static int cmd_bt_reconnect(const shell* sh, size_t argc, char** argv);
+#endif
+
 SHELL_STATIC_SUBCMD_SET_CREATE(
     sub_bt, SHELL_CMD_ARG(passkey, NULL, "Send BT pairing passkey", cmd_bt_passkey, 2, 0),
     SHELL_CMD_ARG(battery, NULL, "Update battery level to BT central", cmd_bt_battery, 2, 0),
+    SHELL_CMD(stats, NULL, "Print key latency and connection statistics", cmd_bt_stats),
+    SHELL_CMD_ARG(bench, NULL, "Measure the report rate and key latency [seconds]", cmd_bt_bench,
+                  1, 1),
+#if CONFIG_DEMO_BLE_MULTI_HOST
+    SHELL_CMD_ARG(host, NULL, "List the hosts, or select the active one [slot]", cmd_bt_host, 1,
+                  1),
+#endif
+#if CONFIG_DEMO_BLE_RECONNECT
+    SHELL_CMD(reconnect, NULL, "Print the reconnection time histograms", cmd_bt_reconnect),
+#endif
     SHELL_SUBCMD_SET_END);
 SHELL_CMD_REGISTER(bt, &sub_bt, "BT", NULL);
 
+static bt_conn* report_target();
+
+struct key_latency_stats
+{
+    uint32_t reports{};
+    uint32_t max_latency_cyc{};
+    uint64_t total_latency_cyc{};
+
+    void update(uint32_t latency)
+    {
+        reports++;
+        total_latency_cyc += latency;
+        max_latency_cyc = std::max(max_latency_cyc, latency);
+    }
+};
+
+using base_keyboard = nkro_keyboard<0, 0x67, CONFIG_DEMO_BLE_REPORT_QUEUE_DEPTH>;
+
+/// @brief Keyboard measuring the time from capturing a key event
+///        until the notification carrying it has been sent.
+class keyboard_type : public base_keyboard
+{
+  public:
+    using base_keyboard::base_keyboard;
+
+    /// @brief Sends the key state changed by the event captured at @p timestamp.
+    ///        Without a connected host the state is kept, and sent once one is served.
+    void send_keys(uint32_t timestamp)
+    {
+        // the report is tagged with its oldest key event's capture time
+        send(timestamp);
+    }
+
+#if CONFIG_DEMO_BLE_MULTI_HOST
+    /// @brief Switches the reports to the newly selected host: the previous host gets
+    ///        all keys released, the new one only the current key state, not the reports
+    ///        still queued for the previous one. The switch time lasts until the first report
+    ///        to the new host is sent.
+    void host_switched(bt_conn* previous)
+    {
+        if ((previous != nullptr) and (previous != report_target()))
+        {
+            const auto size = report_size();
+            static const kb_keys_report released{};
+            static const boot_keys_report boot_released{};
+            const auto* data = (size == sizeof(released))
+                                   ? released.data()
+                                   : reinterpret_cast<const uint8_t*>(&boot_released);
+            notify(previous, std::span<const uint8_t>(data, size), nullptr, nullptr);
+        }
+        switching_ = true;
+        resync();
+    }
+
+    /// @brief The time of the last host switch, until the first report was sent.
+    uint32_t last_switch_us() const { return last_switch_us_; }
+
+    /// @brief Resumes the reports to the active host, once it's connected and encrypted.
+    ///        The changes queued while it was away are dropped, it gets the current state.
+    void host_ready(bt_conn* conn)
+    {
+        if (conn == report_target())
+        {
+            resync();
+        }
+    }
+#endif
+
+  protected:
+#if CONFIG_DEMO_BLE_MULTI_HOST
+    /// @brief Notifies the report to the selected host's connection, instead of the HID
+    ///        service's single peer, so every bonded host stays connected, and switching
+    ///        the host doesn't need a reconnection.
+    hid::result transmit_report(const std::span<const uint8_t>& data) override
+    {
+        auto* conn = report_target();
+        if (conn == nullptr)
+        {
+            return hid::result::NO_CONNECTION;
+        }
+        // the queue slot stays valid until the completion
+        auto err = notify(conn, data, notify_complete, const_cast<uint8_t*>(data.data()));
+        if (err == -ENOTCONN)
+        {
+            return hid::result::NO_CONNECTION;
+        }
+        return (err == 0) ? hid::result::OK : hid::result::BUSY;
+    }
+#endif
+
+    key_latency_stats stats(bool reset = false)
+    {
+        auto key = k_spin_lock(&lock_);
+        auto stats = stats_;
+        if (reset)
+        {
+            stats_ = {};
+        }
+        k_spin_unlock(&lock_, key);
+        return stats;
+    }
+
+  protected:
+    void in_report_completed(uint32_t key_time) override
+    {
+        auto latency = k_cycle_get_32() - key_time;
+        event_trace(EVENT_TRACE_BLE_NOTIFY,
+                    std::min<uint32_t>(k_cyc_to_us_floor32(latency), UINT16_MAX));
+        auto key = k_spin_lock(&lock_);
+        stats_.update(latency);
+        k_spin_unlock(&lock_, key);
+    }
+
+  private:
+#if CONFIG_DEMO_BLE_MULTI_HOST
+    static void notify_complete(bt_conn* conn, void* user_data);
+
+    std::size_t report_size() const
+    {
+        return (get_protocol() == hid::protocol::REPORT) ? sizeof(kb_keys_report)
+                                                         : sizeof(boot_keys_report);
+    }
+
+    /// @brief The input report characteristic value of the HID service, by protocol mode.
+    ///        The keyboard's input report is the first report characteristic of the service.
+    static const bt_gatt_attr* input_report_attr(hid::protocol prot)
+    {
+        static std::array<const bt_gatt_attr*, 2> attrs{};
+        bool report = prot == hid::protocol::REPORT;
+        auto& attr = attrs[report];
+        if (attr == nullptr)
+        {
+            bt_gatt_foreach_attr_type(
+                BT_ATT_FIRST_ATTRIBUTE_HANDLE, BT_ATT_LAST_ATTRIBUTE_HANDLE,
+                report ? BT_UUID_HIDS_REPORT : BT_UUID_HIDS_BOOT_KB_IN_REPORT, nullptr, 1,
+                [](const bt_gatt_attr* a, uint16_t, void* user_data) -> uint8_t
+                {
+                    *static_cast<const bt_gatt_attr**>(user_data) = a;
+                    return BT_GATT_ITER_STOP;
+                },
+                &attr);
+        }
+        return attr;
+    }
+
+    int notify(bt_conn* conn, const std::span<const uint8_t>& data, bt_gatt_complete_func_t func,
+               void* user_data)
+    {
+        const auto* attr = input_report_attr(get_protocol());
+        if ((attr == nullptr) or !bt_gatt_is_subscribed(conn, attr, BT_GATT_CCC_NOTIFY))
+        {
+            return -ENOTCONN;
+        }
+        bt_gatt_notify_params params{};
+        params.attr = attr;
+        params.data = data.data();
+        params.len = data.size();
+        params.func = func;
+        params.user_data = user_data;
+        return bt_gatt_notify_cb(conn, &params);
+    }
+
+    void report_notified(bt_conn* conn, const uint8_t* data)
+    {
+        if (switching_ and (conn == report_target()))
+        {
+            switching_ = false;
+            last_switch_us_ = k_cyc_to_us_floor32(hosts().since_select());
+        }
+        in_report_sent(std::span<const uint8_t>(data, report_size()));
+    }
+
+    uint32_t last_switch_us_{};
+    std::atomic<bool> switching_{};
+#endif
+    key_latency_stats stats_{};
+    k_spinlock lock_{};
+};
+
 auto& keyboard_app()
 {
-    static simple_keyboard<> keyb{[](const simple_keyboard<>::kb_leds_report& report)
-                                  {
-                                      iolib_set_led(0,
-                                                    report.leds.test(hid::page::leds::CAPS_LOCK));
-                                  }};
+    static keyboard_type keyb{[](const nkro_keyboard<>::kb_leds_report& report)
+                              {
+                                  iolib_set_led(0, report.leds.test(hid::page::leds::CAPS_LOCK));
+                              }};
     return keyb;
 }
 
+auto& key_map()
+{
+    static auto km = demo::make_keymap();
+    return km;
+}
+
 static auto& hog_service()
 {
     using namespace magic_enum::bitwise_operators;
@@ -224,21 +536,95 @@ static auto& hog_service()
     static const auto security = security::ENCRYPT;
     static const auto features = flags::NORMALLY_CONNECTABLE | flags::REMOTE_WAKE;
 
-    static service_instance<hid::report_protocol_properties(simple_keyboard<>::report_desc()),
+    static service_instance<hid::report_protocol_properties(nkro_keyboard<>::report_desc()),
                             boot_protocol_mode::KEYBOARD>
         hog{keyboard_app(), security, features};
     return hog;
 }
 
+/// @brief The connection that receives the input reports: the selected host's,
+///        or the HID service's peer when there is no host selection.
+static bt_conn* report_target()
+{
+    if (IS_ENABLED(CONFIG_DEMO_BLE_MULTI_HOST))
+    {
+        return hosts().active_conn(hog_service().peer());
+    }
+    return hog_service().peer();
+}
+
+#if CONFIG_DEMO_BLE_MULTI_HOST
+void keyboard_type::notify_complete(bt_conn* conn, void* user_data)
+{
+    keyboard_app().report_notified(conn, static_cast<const uint8_t*>(user_data));
+}
+
+static void host_ready(bt_conn* conn)
+{
+    keyboard_app().host_ready(conn);
+}
+
+static int cmd_bt_host(const shell* sh, size_t argc, char** argv)
+{
+    if (argc == 1)
+    {
+        for (std::size_t i = 0; i < ble_host_table::SLOTS; i++)
+        {
+            auto host = hosts().get(i);
+            if (!host.used)
+            {
+                continue;
+            }
+            char addr[BT_ADDR_LE_STR_LEN];
+            bt_addr_le_to_str(&host.addr, addr, sizeof(addr));
+            shell_print(sh, "%c%u: %s%s", (i == hosts().active_slot()) ? '*' : ' ', i, addr,
+                        (host.conn != nullptr) ? " connected" : "");
+        }
+        shell_print(sh, "last switch: %u us", keyboard_app().last_switch_us());
+        return 0;
+    }
+    int err = 0;
+    auto slot = shell_strtoul(argv[1], 10, &err);
+    auto* previous = report_target();
+    if (err or (hosts().select(slot) == -EINVAL))
+    {
+        shell_error(sh, "Invalid host slot %s", argv[1]);
+        return -EINVAL;
+    }
+    if (IS_ENABLED(CONFIG_DEMO_BLE_RECONNECT))
+    {
+        // advertise directly to the selected host, if it needs to reconnect
+        reconnect().set_peer(hosts().get(slot).addr);
+    }
+    // all hosts stay connected, only the destination of the reports changes
+    keyboard_app().host_switched(previous);
+    if (report_target() == nullptr)
+    {
+        shell_print(sh, "Host %u isn't connected, the reports follow once it reconnects", slot);
+    }
+    return 0;
+}
+#endif
+
+// the reserved usage is part of the key bitmap, but hosts ignore it
+static constexpr auto bench_key = hid::page::keyboard_keypad(0);
+// the synthetic key events of "bt bench", outside of the keymap, they toggle the reserved usage
+static constexpr uint16_t bench_code = INPUT_BTN_TRIGGER_HAPPY;
+
 auto& kb_msgq()
 {
-    static os::zephyr::message_queue_instance<input_event, 2> msgq;
+    static key_event_queue<CONFIG_DEMO_KEY_EVENT_RING_SIZE> msgq;
     return msgq;
 }
 
 static void input_cb(input_event* evt, void*)
 {
-    kb_msgq().post(*evt);
+    if (evt->type != INPUT_EV_KEY)
+    {
+        return;
+    }
+    event_trace(EVENT_TRACE_INPUT_EDGE, evt->code | (evt->value ? 0x8000 : 0));
+    kb_msgq().post(evt->code, evt->value);
 }
 
 INPUT_CALLBACK_DEFINE(nullptr, input_cb, nullptr);
@@ -251,17 +637,165 @@ static_assert((10 * CONFIG_BT_PERIPHERAL_PREF_TIMEOUT) >
 #endif
 static void le_param_updated(bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout)
 {
-    if (conn != hog_service().peer())
+    if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+    {
+        conn_params().updated(conn, interval, latency, timeout);
+    }
+    LOG_INF("BLE HID conn %u params: interval=%u ms, latency=%u, timeout=%u ms%s\n",
+            bt_conn_index(conn), interval * 5 / 4, latency, timeout * 10,
+            (conn == report_target()) ? " (active host)" : "");
+}
+
+static int cmd_bt_stats(const shell* sh, size_t argc, char** argv)
+{
+    auto kb_stats = keyboard_app().stats();
+    if (kb_stats.reports > 0)
+    {
+        shell_print(sh, "key reports: %u, dropped: %u, latency avg: %uus max: %uus",
+                    kb_stats.reports, kb_msgq().drops(),
+                    k_cyc_to_us_floor32(kb_stats.total_latency_cyc / kb_stats.reports),
+                    k_cyc_to_us_floor32(kb_stats.max_latency_cyc));
+    }
+    auto queue_stats = keyboard_app().queue_stats();
+    shell_print(sh, "report queue: %u, merged: %u, max in flight: %u", queue_stats.queued,
+                queue_stats.merged, queue_stats.max_in_flight);
+#if CONFIG_DEMO_BLE_CONN_PARAMS
+    auto stats = conn_params().stats();
+    if (auto* target = report_target(); target != nullptr)
+    {
+        auto interval = conn_params().interval(target);
+        auto latency = conn_params().latency(target);
+        shell_print(sh, "conn params: %s, interval: %u.%02u ms, latency: %u",
+                    magic_enum::enum_name(conn_params().current_mode(target)).data(),
+                    interval * 125 / 100, interval * 125 % 100, latency);
+        if (interval > 0)
+        {
+            // the peripheral listens at every (latency + 1)th connection event when idle
+            shell_print(sh, "connection events: %u/s", 800 / (interval * (1 + latency)));
+        }
+    }
+    shell_print(sh, "active: %u ms, idle: %u ms, updates: %u, rejected: %u", stats.active_ms,
+                stats.idle_ms, stats.updates, stats.rejected);
+#endif
+#if CONFIG_DEMO_BLE_LINK_SEQUENCER
+    auto link_stats = link_sequencer().stats();
+    shell_print(sh,
+                "link procedures: completed: %u, retries: %u, skipped: %u, deferred: %u, "
+                "collisions: %u",
+                link_stats.completed, link_stats.retries, link_stats.skipped, link_stats.deferred,
+                link_stats.collisions);
+    if (auto* peer = report_target(); peer != nullptr)
+    {
+        bt_conn_info info;
+        if (bt_conn_get_info(peer, &info) == 0)
+        {
+            shell_print(sh, "link: step: %s, tx phy: %u, tx len: %u",
+                        magic_enum::enum_name(link_sequencer().current_step(peer)).data(),
+                        info.le.phy->tx_phy, info.le.data_len->tx_max_len);
+        }
+    }
+#endif
+    return 0;
+}
+
+#if CONFIG_DEMO_BLE_RECONNECT
+static int cmd_bt_reconnect(const shell* sh, size_t argc, char** argv)
+{
+    using phase = ble_reconnect::phase;
+    for (auto p : {phase::DIRECTED, phase::ACCEPT_LIST, phase::GENERAL})
+    {
+        auto hist = reconnect().stats(p);
+        shell_print(sh, "%s:", magic_enum::enum_name(p).data());
+        for (std::size_t i = 0; i < hist.size(); i++)
+        {
+            if (i < ble_reconnect::BUCKET_LIMITS_MS.size())
+            {
+                shell_print(sh, "  < %5u ms: %u", ble_reconnect::BUCKET_LIMITS_MS[i], hist[i]);
+            }
+            else
+            {
+                shell_print(sh, "  >= %4u ms: %u", ble_reconnect::BUCKET_LIMITS_MS.back(), hist[i]);
+            }
+        }
+    }
+    return 0;
+}
+#endif
+
+/// @brief Changes the key state every millisecond, faster than any connection interval,
+///        to measure the achieved report rate and the worst key to air latency.
+static struct
+{
+    int64_t start_time;
+    int64_t end_time;
+    uint32_t start_reports;
+    bool pressed;
+} bench;
+
+static void bench_fn(k_work* work)
+{
+    auto now = k_uptime_get();
+    if (now < bench.end_time)
     {
+        bench.pressed = !bench.pressed;
+        kb_msgq().post(bench_code, bench.pressed);
+        k_work_schedule(k_work_delayable_from_work(work), K_MSEC(1));
         return;
     }
-    LOG_INF("BLE HID conn params: interval=%u ms, latency=%u, timeout=%u ms\n", interval * 5 / 4,
-            latency, timeout * 10);
+    kb_msgq().post(bench_code, false);
+    auto reports = keyboard_app().reports_sent() - bench.start_reports;
+    auto stats = keyboard_app().stats(true);
+    auto queue_stats = keyboard_app().queue_stats();
+    LOG_INF("Bench: %u reports/s, latency avg: %uus max: %uus, merged: %u, max in flight: %u",
+            static_cast<uint32_t>(reports * 1000 / (now - bench.start_time)),
+            (stats.reports > 0) ? k_cyc_to_us_floor32(stats.total_latency_cyc / stats.reports) : 0,
+            k_cyc_to_us_floor32(stats.max_latency_cyc), queue_stats.merged,
+            queue_stats.max_in_flight);
+}
+
+K_WORK_DELAYABLE_DEFINE(bench_work, bench_fn);
+
+static int cmd_bt_bench(const shell* sh, size_t argc, char** argv)
+{
+    int err = 0;
+    uint32_t seconds = (argc > 1) ? shell_strtoul(argv[1], 10, &err) : 10;
+    if (err or (seconds == 0))
+    {
+        shell_error(sh, "Invalid duration %s", argv[1]);
+        return -EINVAL;
+    }
+    if (k_work_delayable_is_pending(&bench_work))
+    {
+        shell_error(sh, "Bench already running");
+        return -EBUSY;
+    }
+    if (report_target() == nullptr)
+    {
+        shell_error(sh, "No host connected");
+        return -ENOTCONN;
+    }
+    keyboard_app().stats(true);
+    bench.start_time = k_uptime_get();
+    bench.end_time = bench.start_time + seconds * 1000;
+    bench.start_reports = keyboard_app().reports_sent();
+    k_work_schedule(&bench_work, K_NO_WAIT);
+    shell_print(sh, "Running for %u s, the result is logged", seconds);
+    return 0;
 }
 
 char serial_number_str[33];
 
-int main(void)
+static K_SEM_DEFINE(bt_ready_sem, 0, 1);
+static int bt_ready_err;
+
+static void bt_ready(int err)
+{
+    // main checks the result once it's done with the settings
+    bt_ready_err = err;
+    k_sem_give(&bt_ready_sem);
+}
+
+static void set_serial_number()
 {
     // use HW info as serial number
     if (IS_ENABLED(CONFIG_HWINFO))
@@ -271,6 +805,22 @@ int main(void)
         c2usb::raw_to_hex_string(std::span<const uint8_t>(serial_number, n),
                                  std::span<char>(serial_number_str));
     }
+    boot_trace_mark("hwinfo");
+}
+
+int main(void)
+{
+    boot_trace_mark("kernel init");
+    if (IS_ENABLED(CONFIG_DEMO_RAM_PROFILE))
+    {
+        ram_budget_track_queue(
+            "DEMO_KEY_EVENT_RING_SIZE", kb_msgq().capacity(),
+            [](const void*) -> size_t { return kb_msgq().peak(); }, nullptr);
+    }
+    if (!IS_ENABLED(CONFIG_DEMO_FAST_STARTUP))
+    {
+        set_serial_number();
+    }
     if (auto err = bt_conn_auth_cb_register(&conn_auth_callbacks); err)
     {
         LOG_ERR("Failed to register authorization callbacks.\n");
@@ -286,27 +836,95 @@ int main(void)
         LOG_ERR("HID service initialization failed\n");
         return 0;
     }
-    if (auto err = bt_enable(nullptr); err)
+    boot_trace_mark("hog");
+    if (IS_ENABLED(CONFIG_DEMO_FAST_STARTUP))
     {
-        LOG_ERR("Bluetooth init failed (err %d)\n", err);
-        return 0;
+        // the controller initializes while the application settings are loaded
+        if (auto err = bt_enable(bt_ready); err)
+        {
+            LOG_ERR("Bluetooth init failed (err %d)\n", err);
+            return 0;
+        }
+        if (IS_ENABLED(CONFIG_SETTINGS))
+        {
+            settings_subsys_init();
+            settings_load_subtree("demo");
+        }
+        boot_trace_mark("app settings");
+        k_sem_take(&bt_ready_sem, K_FOREVER);
+        if (bt_ready_err)
+        {
+            LOG_ERR("Bluetooth init failed (err %d)\n", bt_ready_err);
+            return 0;
+        }
+        boot_trace_mark("bt_enable");
+        if (IS_ENABLED(CONFIG_SETTINGS))
+        {
+            settings_load_subtree("bt");
+        }
+        boot_trace_mark("bt settings");
+    }
+    else
+    {
+        if (auto err = bt_enable(nullptr); err)
+        {
+            LOG_ERR("Bluetooth init failed (err %d)\n", err);
+            return 0;
+        }
+        boot_trace_mark("bt_enable");
+        if (IS_ENABLED(CONFIG_SETTINGS))
+        {
+            settings_load();
+        }
+        boot_trace_mark("settings");
     }
-    if (IS_ENABLED(CONFIG_SETTINGS))
+    if (IS_ENABLED(CONFIG_DEMO_BLE_MULTI_HOST))
     {
-        settings_load();
+        hosts().prune();
     }
     advertise();
+    if (IS_ENABLED(CONFIG_DEMO_FAST_STARTUP))
+    {
+        // nothing below is needed to get connected
+        set_serial_number();
+        if (IS_ENABLED(CONFIG_SHELL_BACKEND_SERIAL) and !IS_ENABLED(CONFIG_SHELL_AUTOSTART))
+        {
+            shell_start(shell_backend_uart_get_ptr());
+        }
+    }
 
     while (true)
     {
-        auto msg = kb_msgq().get();
-        switch (msg.code)
+        // wake up for the keymap's timed changes (tap release, hold, macro steps)
+        std::optional<key_event> msg{};
+        if (auto deadline = key_map().deadline(); deadline)
+        {
+            msg = kb_msgq().get_until(*deadline);
+        }
+        else
+        {
+            msg = kb_msgq().get();
+        }
+        if (!msg)
+        {
+            auto now = k_cycle_get_32();
+            key_map().poll(now, keyboard_app());
+            keyboard_app().send_keys(now);
+            continue;
+        }
+        if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+        {
+            conn_params().activity();
+        }
+        key_map().poll(msg->timestamp, keyboard_app());
+        if (msg->code == bench_code)
+        {
+            keyboard_app().set_key(bench_key, msg->value);
+        }
+        else
         {
-        case INPUT_KEY_0:
-            keyboard_app().send_key(hid::page::keyboard_keypad::KEYBOARD_CAPS_LOCK, msg.value);
-            break;
-        default:
-            break;
+            key_map().process(msg->code, msg->value, msg->timestamp, keyboard_app());
         }
+        keyboard_app().send_keys(msg->timestamp);
     }
 }
@@ -0,0 +1,429 @@
+#include "ble_conn_params.hpp"
+#include "boot_trace.h"
+#include "deferred_log.hpp"
+#include "demo_keymap.hpp"
+#include "event_trace.h"
+#include "hid_router.hpp"
+#include "iolib.h"
+#include "key_event_ring.hpp"
+#include "ram_budget.h"
+#include "usb_speed_config.hpp"
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/input/input.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/shell/shell.h>
+
+#include "nkro_keyboard.hpp"
+#include <magic_enum.hpp>
+#include <port/zephyr/bluetooth/hid.hpp>
+#include <port/zephyr/bluetooth/le.hpp>
+#include <port/zephyr/message_queue.hpp>
+#include <port/zephyr/udc_mac.hpp>
+#include <raw_to_hex_string.hpp>
+#include <usb/df/class/hid.hpp>
+#include <usb/df/device.hpp>
+
+LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
+
+using namespace magic_enum::bitwise_operators;
+
+static const uint8_t adv_led = 1;
+
+/// @brief The router ports, in the order of preference.
+enum transport : std::size_t
+{
+    USB,
+    BLE,
+    NONE,
+};
+
+auto& kb_msgq()
+{
+    static key_event_queue<CONFIG_DEMO_KEY_EVENT_RING_SIZE> msgq;
+    return msgq;
+}
+
+class keyboard_type : public nkro_keyboard<0, 0x67, CONFIG_DEMO_BLE_REPORT_QUEUE_DEPTH>
+{
+  public:
+    using base = nkro_keyboard<0, 0x67, CONFIG_DEMO_BLE_REPORT_QUEUE_DEPTH>;
+    using base::base;
+
+    void in_report_sent(const std::span<const uint8_t>& data) override
+    {
+        base::in_report_sent(data);
+        // a queue slot is free for the key changes collected meanwhile
+        kb_msgq().notify();
+    }
+};
+
+auto& keyboard_app()
+{
+    // the LED reports of both hosts are merged by the router
+    static keyboard_type keyb{[](const keyboard_type::kb_leds_report& report)
+                              {
+                                  iolib_set_led(0, report.leds.test(hid::page::leds::CAPS_LOCK));
+                              }};
+    return keyb;
+}
+
+auto& key_map()
+{
+    static auto km = demo::make_keymap();
+    return km;
+}
+
+auto& router()
+{
+    static hid_router<2> router{keyboard_app(), keyboard_type::report_prot()};
+    return router;
+}
+
+static auto& hog_service()
+{
+    using namespace bluetooth::zephyr::hid;
+
+    static const auto security = security::ENCRYPT;
+    static const auto features = flags::NORMALLY_CONNECTABLE | flags::REMOTE_WAKE;
+
+    static service_instance<hid::report_protocol_properties(keyboard_type::report_desc()),
+                            boot_protocol_mode::KEYBOARD>
+        hog{router()[BLE], security, features};
+    return hog;
+}
+
+static int advertise(void)
+{
+    using namespace bluetooth::zephyr;
+
+    static constexpr auto ad_data =
+        join(ad_struct<std::uint16_t>(BT_DATA_GAP_APPEARANCE, CONFIG_BT_DEVICE_APPEARANCE),
+             ad_struct<std::uint8_t>(BT_DATA_FLAGS, BT_LE_AD_GENERAL | BT_LE_AD_NO_BREDR),
+             ad_struct<std::uint16_t>(BT_DATA_UUID16_ALL, {BT_UUID_HIDS_VAL}));
+    static constexpr auto ad = to_adv_data<ad_struct_count(ad_data)>(ad_data);
+    static constexpr auto sd_data = join(ad_struct(BT_DATA_NAME_COMPLETE, CONFIG_BT_DEVICE_NAME));
+    static constexpr auto sd = to_adv_data<ad_struct_count(sd_data)>(sd_data);
+    const bt_le_adv_param* adv_param = BT_LE_ADV_PARAM(
+        BT_LE_ADV_OPT_CONN, BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, nullptr);
+
+    auto err = bt_le_adv_start(adv_param, ad.data(), ad.size(), sd.data(), sd.size());
+    if (err == 0)
+    {
+        boot_trace_done("advertising");
+        iolib_set_led(adv_led, true);
+        LOG_INF("Advertising successfully started\n");
+    }
+    else if (err != -EALREADY)
+    {
+        LOG_WRN("Advertising failed to start (err %d)\n", err);
+    }
+    return err;
+}
+
+auto& pairing_msgq()
+{
+    static os::zephyr::message_queue_instance<::bt_conn*, CONFIG_BT_MAX_CONN> msgq;
+    return msgq;
+}
+
+/// @brief A connection event, captured in the Bluetooth host's callbacks.
+struct conn_event
+{
+    bt_addr_le_t addr;
+    bool connected;
+    uint8_t err; // HCI error, or disconnect reason
+
+    conn_event(bool c, bt_conn* conn, uint8_t e)
+        : addr(*bt_conn_get_dst(conn)), connected(c), err(e)
+    {}
+};
+
+/// @brief Formats the connection events, outside of the Bluetooth host's context.
+static void log_conn_event(const conn_event& evt)
+{
+    char addr[BT_ADDR_LE_STR_LEN];
+    bt_addr_le_to_str(&evt.addr, addr, sizeof(addr));
+    if (!evt.connected)
+    {
+        LOG_INF("Disconnected from %s, reason 0x%02x %s\n", addr, evt.err,
+                bt_hci_err_to_str(evt.err));
+    }
+    else if (evt.err)
+    {
+        LOG_WRN("Failed to connect to %s 0x%02x %s\n", addr, evt.err, bt_hci_err_to_str(evt.err));
+    }
+    else
+    {
+        LOG_INF("Connected %s\n", addr);
+    }
+}
+
+static void connected(bt_conn* conn, uint8_t err)
+{
+    deferred_log::log<log_conn_event>(conn_event{true, conn, err});
+    if (err)
+    {
+        return;
+    }
+    iolib_set_led(adv_led, false);
+    if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+    {
+        conn_params().attach(conn);
+    }
+}
+
+static void disconnected(bt_conn* conn, uint8_t reason)
+{
+    deferred_log::log<log_conn_event>(conn_event{false, conn, reason});
+    if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+    {
+        conn_params().detach(conn);
+    }
+    advertise();
+}
+
+static void le_param_updated(bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout)
+{
+    if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+    {
+        conn_params().updated(conn, interval, latency, timeout);
+    }
+}
+
+BT_CONN_CB_DEFINE(conn_callbacks) = {
+    .connected = connected,
+    .disconnected = disconnected,
+    .le_param_updated = le_param_updated,
+};
+
+static void auth_passkey_entry(bt_conn* conn)
+{
+    bluetooth::zephyr::address_str addr{conn};
+    LOG_INF("Passkey requested for %s, type `bt passkey XXXXXX` to complete\n", addr.data());
+    if (!pairing_msgq().try_post(bt_conn_ref(conn)))
+    {
+        LOG_WRN("Pairing queue full\n");
+    }
+}
+
+static void auth_cancel(bt_conn* conn)
+{
+    bluetooth::zephyr::address_str addr{conn};
+    LOG_INF("Pairing cancelled: %s\n", addr.data());
+}
+
+static const bt_conn_auth_cb conn_auth_callbacks = {.passkey_entry = auth_passkey_entry,
+                                                    .cancel = auth_cancel};
+
+static int cmd_bt_passkey(const shell* sh, size_t argc, char** argv)
+{
+    int err = 0;
+    int passkey = shell_strtol(argv[1], 10, &err);
+    if (err)
+    {
+        shell_error(sh, "Invalid passkey %d", err);
+        return 0;
+    }
+    auto pairing = pairing_msgq().try_get();
+    if (!pairing)
+    {
+        return 0;
+    }
+    if (passkey < 0)
+    {
+        bt_conn_auth_cancel(pairing.value());
+    }
+    else
+    {
+        bt_conn_auth_passkey_entry(pairing.value(), passkey);
+    }
+    bt_conn_unref(pairing.value());
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_bt,
+                               SHELL_CMD_ARG(passkey, NULL, "Send BT pairing passkey",
+                                             cmd_bt_passkey, 2, 0),
+                               SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(bt, &sub_bt, "BT", NULL);
+
+static int cmd_router(const shell* sh, size_t argc, char** argv)
+{
+    auto stats = router().stats();
+    shell_print(sh, "active: %s, switches: %u, failover last: %uus max: %uus",
+                magic_enum::enum_name(static_cast<transport>(router().active_index())).data(),
+                stats.switches, stats.last_failover_us, stats.max_failover_us);
+    return 0;
+}
+
+SHELL_CMD_REGISTER(router, NULL, "Print the active transport and the failover times",
+                   cmd_router);
+
+static void input_cb(input_event* evt, void*)
+{
+    if (evt->type != INPUT_EV_KEY)
+    {
+        return;
+    }
+    event_trace(EVENT_TRACE_INPUT_EDGE, evt->code | (evt->value ? 0x8000 : 0));
+    kb_msgq().post(evt->code, evt->value);
+}
+
+INPUT_CALLBACK_DEFINE(nullptr, input_cb, nullptr);
+
+static uint8_t serial_number[16]{};
+char serial_number_str[33];
+constexpr usb::product_info product_info{CONFIG_DEMO_MANUFACTURER_ID, CONFIG_DEMO_MANUFACTURER,
+                                         CONFIG_DEMO_PRODUCT_ID,      CONFIG_DEMO_PRODUCT,
+                                         usb::version("1.0"),         serial_number};
+
+auto& mac()
+{
+    static usb::zephyr::udc_mac mac{DEVICE_DT_GET(DT_NODELABEL(zephyr_udc0))};
+    return mac;
+}
+
+auto& device()
+{
+    static usb::df::device_instance<demo::usb_max_speed> device{mac(), product_info};
+    return device;
+}
+
+/// @brief Formats the USB state changes, outside of the USB stack's context.
+static void log_usb_state(const deferred_log::usb_state& s)
+{
+    auto power_state = static_cast<usb::power::state>(s.power_state);
+    bool usb_up = s.configured and (power_state != usb::power::state::L3_OFF);
+    LOG_INF("USB %s, power state: %s", usb_up ? "up" : "down",
+            magic_enum::enum_name(power_state).data());
+}
+
+int main(void)
+{
+    boot_trace_mark("kernel init");
+    if (IS_ENABLED(CONFIG_DEMO_RAM_PROFILE))
+    {
+        ram_budget_track_queue(
+            "DEMO_KEY_EVENT_RING_SIZE", kb_msgq().capacity(),
+            [](const void*) -> size_t { return kb_msgq().peak(); }, nullptr);
+    }
+    // route to USB while the cable is plugged in and the host configured the device,
+    // to BLE otherwise
+    device().set_power_event_delegate(
+        [](usb::df::device& dev, usb::df::device::event ev)
+        {
+            // the failover is measured from here
+            auto event_time = k_cycle_get_32();
+            bool usb_up = dev.configured() and (dev.power_state() != usb::power::state::L3_OFF);
+            event_trace(EVENT_TRACE_POWER_STATE, static_cast<uint16_t>(dev.power_state()));
+            router().enable(USB, usb_up, event_time);
+            if (usb_up)
+            {
+                boot_trace_done("usb configured");
+            }
+            deferred_log::log<log_usb_state>(deferred_log::usb_state::capture(dev, ev));
+        });
+
+    // use HW info as serial number
+    if (IS_ENABLED(CONFIG_HWINFO))
+    {
+        auto n = hwinfo_get_device_id(serial_number, sizeof(serial_number));
+        c2usb::raw_to_hex_string(std::span<const uint8_t>(serial_number, n),
+                                 std::span<char>(serial_number_str));
+    }
+    boot_trace_mark("hwinfo");
+    if (auto err = bt_conn_auth_cb_register(&conn_auth_callbacks); err)
+    {
+        LOG_ERR("Failed to register authorization callbacks.\n");
+        return 0;
+    }
+    if (!hog_service().start())
+    {
+        LOG_ERR("HID service initialization failed\n");
+        return 0;
+    }
+    boot_trace_mark("hog");
+    if (auto err = bt_enable(nullptr); err)
+    {
+        LOG_ERR("Bluetooth init failed (err %d)\n", err);
+        return 0;
+    }
+    boot_trace_mark("bt_enable");
+    if (IS_ENABLED(CONFIG_SETTINGS))
+    {
+        settings_load();
+    }
+    boot_trace_mark("settings");
+    advertise();
+
+    {
+        static constexpr auto config_header =
+            usb::df::config::header(usb::df::config::power::bus(500, true), "base config");
+
+        static usb::df::hid::function usb_kb{router()[USB], "keyboard",
+                                             usb::hid::boot_protocol_mode::KEYBOARD};
+
+        demo::set_speed_configs(device(),
+                                [](usb::speed speed)
+                                {
+                                    return usb::df::config::make_config(
+                                        config_header,
+                                        usb::df::hid::config(usb_kb, speed,
+                                                             usb::endpoint::address(0x81),
+                                                             demo::hid_in_interval(speed)));
+                                });
+        boot_trace_mark("set_config");
+        device().open();
+        boot_trace_mark("open");
+    }
+
+    key_batch<CONFIG_DEMO_KEY_EVENT_RING_SIZE> batch;
+    std::optional<key_event> next{};
+    while (true)
+    {
+        if (!next)
+        {
+            // wake up for the keymap's timed changes (tap release, hold, macro steps)
+            if (auto deadline = key_map().deadline(); deadline)
+            {
+                next = kb_msgq().get_until(*deadline);
+            }
+            else
+            {
+                next = kb_msgq().get();
+            }
+        }
+        if (!next)
+        {
+            key_map().poll(k_cycle_get_32(), keyboard_app());
+            keyboard_app().send();
+            continue;
+        }
+        auto first = *next;
+        if (first.value and (router().active_index() == USB) and
+            (device().power_state() == usb::power::state::L2_SUSPEND))
+        {
+            if (auto result = device().remote_wakeup(); result != decltype(result){})
+            {
+                LOG_WRN("Remote wakeup failed: %d", static_cast<int>(result));
+            }
+        }
+        if (IS_ENABLED(CONFIG_DEMO_BLE_CONN_PARAMS))
+        {
+            conn_params().activity();
+        }
+        next = kb_msgq().collect(first, k_us_to_cyc_ceil32(CONFIG_DEMO_KEY_COALESCE_US), batch,
+                                 [] { return keyboard_app().busy(); });
+        for (auto& evt : batch)
+        {
+            key_map().poll(evt.timestamp, keyboard_app());
+            key_map().process(evt.code, evt.value, evt.timestamp, keyboard_app());
+        }
+        // the whole batch is transmitted in a single report, on the active transport
+        keyboard_app().send();
+    }
+}
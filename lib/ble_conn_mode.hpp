@@ -0,0 +1,170 @@
+#ifndef __BLE_CONN_MODE_HPP__
+#define __BLE_CONN_MODE_HPP__
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+/// @brief The idle / active transitions of @ref ble_conn_params for one link,
+///        without the Bluetooth calls, driven by the uptime in ms.
+///        The owner requests the mode returned by @ref process from the central,
+///        and calls @ref process again at the returned time, or when the user is active.
+///        The methods aren't thread-safe, the owner locks.
+class ble_conn_mode
+{
+  public:
+    enum class mode : uint8_t
+    {
+        NONE,
+        ACTIVE,
+        IDLE,
+    };
+
+    /// @brief Summed over all the links.
+    struct statistics
+    {
+        uint32_t active_ms;
+        uint32_t idle_ms;
+        uint32_t updates;  // the parameter changes applied by the central
+        uint32_t rejected; // the requests that the central ignored or rejected
+    };
+
+    struct config
+    {
+        uint16_t active_max_interval; // the longest interval that counts as active
+        uint32_t idle_delay_ms;       // the inactivity before switching to idle
+    };
+
+    // the time the central has to apply the requested parameters
+    static constexpr int64_t response_timeout_ms = 2000;
+    static constexpr uint32_t max_backoff_ms = 60000;
+    static constexpr int64_t never = std::numeric_limits<int64_t>::max();
+
+    /// @brief Starts managing a new connection, with its current parameters.
+    /// @param settle_ms the delay before the first request
+    void attach(int64_t now, uint16_t interval, uint16_t latency, uint32_t settle_ms,
+                const config& c)
+    {
+        config_ = c;
+        last_account_ = now;
+        set_params(interval, latency);
+        requested_ = mode::NONE;
+        backoff_ms_ = 0;
+        // the central runs its own procedures (feature exchange, discovery) right after connecting
+        start_time_ = now + settle_ms;
+    }
+
+    void detach(int64_t now, statistics& stats)
+    {
+        account(now, stats);
+        *this = {};
+    }
+
+    /// @brief Takes the parameters the central applied, the answer to a request or its own.
+    void updated(int64_t now, uint16_t interval, uint16_t latency, statistics& stats)
+    {
+        account(now, stats);
+        set_params(interval, latency);
+        stats.updates++;
+        if (requested_ == mode::NONE)
+        {
+            return;
+        }
+        if (current_ == requested_)
+        {
+            backoff_ms_ = 0;
+        }
+        else
+        {
+            // the central chose other parameters, don't insist right away
+            back_off(now, stats);
+        }
+        requested_ = mode::NONE;
+    }
+
+    /// @brief Decides whether the link needs other parameters.
+    /// @param last_activity the time of the last user input
+    /// @param to_request set to the mode to request now, NONE if none
+    /// @return the time to process again, never if nothing is due
+    int64_t process(int64_t now, int64_t last_activity, mode& to_request, statistics& stats)
+    {
+        account(now, stats);
+        auto desired =
+            ((now - last_activity) >= config_.idle_delay_ms) ? mode::IDLE : mode::ACTIVE;
+        to_request = mode::NONE;
+        if (requested_ != mode::NONE)
+        {
+            if (now < request_deadline_)
+            {
+                // a procedure is still in flight, never start another one
+                return request_deadline_;
+            }
+            requested_ = mode::NONE;
+            back_off(now, stats);
+            return start_time_;
+        }
+        if (now < start_time_)
+        {
+            return start_time_;
+        }
+        if (desired != current_)
+        {
+            to_request = desired;
+            requested_ = desired;
+            request_deadline_ = now + response_timeout_ms;
+            return request_deadline_;
+        }
+        if (desired == mode::ACTIVE)
+        {
+            return last_activity + config_.idle_delay_ms;
+        }
+        return never;
+    }
+
+    /// @brief Adds the time since the last call to the time spent in the current mode.
+    void account(int64_t now, statistics& stats)
+    {
+        auto elapsed = static_cast<uint32_t>(now - last_account_);
+        last_account_ = now;
+        if (current_ == mode::ACTIVE)
+        {
+            stats.active_ms += elapsed;
+        }
+        else if (current_ == mode::IDLE)
+        {
+            stats.idle_ms += elapsed;
+        }
+    }
+
+    mode current() const { return current_; }
+    mode requested() const { return requested_; }
+    uint16_t interval() const { return interval_; }
+    uint16_t latency() const { return latency_; }
+
+  private:
+    void set_params(uint16_t interval, uint16_t latency)
+    {
+        interval_ = interval;
+        latency_ = latency;
+        current_ = ((interval <= config_.active_max_interval) and (latency == 0)) ? mode::ACTIVE
+                                                                                  : mode::IDLE;
+    }
+
+    void back_off(int64_t now, statistics& stats)
+    {
+        stats.rejected++;
+        backoff_ms_ = std::clamp<uint32_t>(backoff_ms_ * 2, response_timeout_ms, max_backoff_ms);
+        start_time_ = now + backoff_ms_;
+    }
+
+    config config_{};
+    int64_t start_time_{};
+    int64_t request_deadline_{};
+    int64_t last_account_{};
+    uint32_t backoff_ms_{};
+    uint16_t interval_{};
+    uint16_t latency_{};
+    mode current_{mode::NONE};
+    mode requested_{mode::NONE};
+};
+
+#endif // __BLE_CONN_MODE_HPP__
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <ble_conn_params.hpp>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ble_conn_params, LOG_LEVEL_INF);
+
+/// @brief The supervision timeout must outlast the peripheral latency with some margin,
+///        see Core Spec Vol 6, Part B, 4.5.2.
+static constexpr bool valid_params(unsigned max_interval, unsigned latency, unsigned timeout)
+{
+    return (10 * timeout) > ((1 + latency) * 2 * (max_interval * 5 / 4));
+}
+
+static_assert(CONFIG_DEMO_BLE_ACTIVE_MIN_INT <= CONFIG_DEMO_BLE_ACTIVE_MAX_INT);
+static_assert(CONFIG_DEMO_BLE_IDLE_MIN_INT <= CONFIG_DEMO_BLE_IDLE_MAX_INT);
+static_assert(CONFIG_DEMO_BLE_ACTIVE_MAX_INT < CONFIG_DEMO_BLE_IDLE_MIN_INT,
+              "the idle interval must be longer than the active one");
+static_assert(valid_params(CONFIG_DEMO_BLE_ACTIVE_MAX_INT, 0, CONFIG_DEMO_BLE_ACTIVE_TIMEOUT),
+              "The active connection parameters are not valid");
+static_assert(valid_params(CONFIG_DEMO_BLE_IDLE_MAX_INT, CONFIG_DEMO_BLE_IDLE_LATENCY,
+                           CONFIG_DEMO_BLE_IDLE_TIMEOUT),
+              "The idle connection parameters are not valid");
+
+static constexpr ble_conn_mode::config config{CONFIG_DEMO_BLE_ACTIVE_MAX_INT,
+                                              CONFIG_DEMO_BLE_IDLE_DELAY_MS};
+
+ble_conn_params& conn_params()
+{
+    static ble_conn_params params;
+    return params;
+}
+
+void ble_conn_params::work_handler(k_work* work)
+{
+    auto* self = CONTAINER_OF(k_work_delayable_from_work(work), ble_conn_params, work_);
+    self->process();
+}
+
+void ble_conn_params::attach(bt_conn* conn, uint32_t settle_ms)
+{
+    bt_conn_info info;
+    if (bt_conn_get_info(conn, &info) != 0)
+    {
+        return;
+    }
+    auto key = k_spin_lock(&lock_);
+    auto& l = link_of(conn);
+    if (l.conn != nullptr)
+    {
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    auto now = k_uptime_get();
+    l.conn = bt_conn_ref(conn);
+    l.params.attach(now, info.le.interval, info.le.latency, settle_ms, config);
+    last_activity_ = now;
+    k_spin_unlock(&lock_, key);
+    k_work_reschedule(&work_, K_NO_WAIT);
+}
+
+void ble_conn_params::detach(bt_conn* conn)
+{
+    auto key = k_spin_lock(&lock_);
+    auto& l = link_of(conn);
+    if (conn != l.conn)
+    {
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    l.params.detach(k_uptime_get(), stats_);
+    l.conn = nullptr;
+    k_spin_unlock(&lock_, key);
+    bt_conn_unref(conn);
+}
+
+void ble_conn_params::activity()
+{
+    auto key = k_spin_lock(&lock_);
+    last_activity_ = k_uptime_get();
+    bool snap_back = false;
+    for (auto& l : links_)
+    {
+        snap_back = snap_back or (l.params.current() == mode::IDLE) or
+                    (l.params.requested() == mode::IDLE);
+    }
+    k_spin_unlock(&lock_, key);
+    if (snap_back)
+    {
+        k_work_reschedule(&work_, K_NO_WAIT);
+    }
+}
+
+void ble_conn_params::updated(bt_conn* conn, uint16_t interval, uint16_t latency,
+                              uint16_t timeout)
+{
+    auto key = k_spin_lock(&lock_);
+    auto& l = link_of(conn);
+    if (conn != l.conn)
+    {
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    l.params.updated(k_uptime_get(), interval, latency, stats_);
+    k_spin_unlock(&lock_, key);
+    k_work_reschedule(&work_, K_NO_WAIT);
+}
+
+void ble_conn_params::process()
+{
+    std::array<bt_conn*, CONFIG_BT_MAX_CONN> conns{};
+    std::array<mode, CONFIG_BT_MAX_CONN> to_request{};
+    auto next = ble_conn_mode::never;
+
+    auto key = k_spin_lock(&lock_);
+    auto now = k_uptime_get();
+    for (std::size_t i = 0; i < links_.size(); i++)
+    {
+        auto& l = links_[i];
+        if (l.conn == nullptr)
+        {
+            continue;
+        }
+        next = std::min(next, l.params.process(now, last_activity_, to_request[i], stats_));
+        if (to_request[i] != mode::NONE)
+        {
+            conns[i] = bt_conn_ref(l.conn);
+        }
+    }
+    k_spin_unlock(&lock_, key);
+
+    for (std::size_t i = 0; i < conns.size(); i++)
+    {
+        if (conns[i] != nullptr)
+        {
+            request(conns[i], to_request[i]);
+            bt_conn_unref(conns[i]);
+        }
+    }
+    if (next != ble_conn_mode::never)
+    {
+        k_work_reschedule(&work_, K_TIMEOUT_ABS_MS(next));
+    }
+}
+
+void ble_conn_params::request(bt_conn* conn, mode m)
+{
+    static const bt_le_conn_param active = BT_LE_CONN_PARAM_INIT(
+        CONFIG_DEMO_BLE_ACTIVE_MIN_INT, CONFIG_DEMO_BLE_ACTIVE_MAX_INT, 0,
+        CONFIG_DEMO_BLE_ACTIVE_TIMEOUT);
+    static const bt_le_conn_param idle = BT_LE_CONN_PARAM_INIT(
+        CONFIG_DEMO_BLE_IDLE_MIN_INT, CONFIG_DEMO_BLE_IDLE_MAX_INT, CONFIG_DEMO_BLE_IDLE_LATENCY,
+        CONFIG_DEMO_BLE_IDLE_TIMEOUT);
+
+    auto err = bt_conn_le_param_update(conn, (m == mode::ACTIVE) ? &active : &idle);
+    if (err)
+    {
+        LOG_WRN("Conn param update request failed (err %d)", err);
+        // let the deadline expire, which backs off
+    }
+}
+
+ble_conn_params::statistics ble_conn_params::stats()
+{
+    auto key = k_spin_lock(&lock_);
+    auto now = k_uptime_get();
+    for (auto& l : links_)
+    {
+        l.params.account(now, stats_);
+    }
+    auto stats = stats_;
+    k_spin_unlock(&lock_, key);
+    return stats;
+}
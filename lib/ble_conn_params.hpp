@@ -0,0 +1,65 @@
+#ifndef __BLE_CONN_PARAMS_HPP__
+#define __BLE_CONN_PARAMS_HPP__
+#include <array>
+#include <ble_conn_mode.hpp>
+#include <cstdint>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+
+/// @brief Negotiates the connection parameters of an input device's links with its centrals:
+///        the shortest interval without peripheral latency while the user is active,
+///        and a long interval with peripheral latency once idle, to save power.
+///        Each connection is managed on its own, indexed by bt_conn_index().
+///        Only one parameter update procedure is in flight at a time on a link,
+///        and each is only started after the link has settled,
+///        to avoid link layer procedure collisions.
+///        The transitions of each link are @ref ble_conn_mode.
+class ble_conn_params
+{
+  public:
+    ble_conn_params() { k_work_init_delayable(&work_, work_handler); }
+
+    using mode = ble_conn_mode::mode;
+    using statistics = ble_conn_mode::statistics;
+    /// @brief Starts managing the connection, after the link settles.
+    /// @param settle_ms the delay before the first request, 0 if the caller already waited
+    void attach(bt_conn* conn, uint32_t settle_ms = CONFIG_DEMO_BLE_CONN_PARAMS_SETTLE_MS);
+
+    /// @brief Stops managing the connection, when it's disconnected.
+    void detach(bt_conn* conn);
+
+    /// @brief Signals user activity, switching every link to the active parameters when idle,
+    ///        so a switch to another host is just as fast.
+    void activity();
+
+    /// @brief Called from the le_param_updated connection callback.
+    void updated(bt_conn* conn, uint16_t interval, uint16_t latency, uint16_t timeout);
+
+    mode current_mode(bt_conn* conn) const { return link_of(conn).params.current(); }
+    uint16_t interval(bt_conn* conn) const { return link_of(conn).params.interval(); }
+    uint16_t latency(bt_conn* conn) const { return link_of(conn).params.latency(); }
+    statistics stats();
+
+  private:
+    struct link
+    {
+        bt_conn* conn;
+        ble_conn_mode params;
+    };
+
+    static void work_handler(k_work* work);
+    void process();
+    static void request(bt_conn* conn, mode m);
+    const link& link_of(bt_conn* conn) const { return links_[bt_conn_index(conn)]; }
+    link& link_of(bt_conn* conn) { return links_[bt_conn_index(conn)]; }
+
+    k_work_delayable work_{};
+    k_spinlock lock_{};
+    std::array<link, CONFIG_BT_MAX_CONN> links_{};
+    int64_t last_activity_{};
+    statistics stats_{};
+};
+
+ble_conn_params& conn_params();
+
+#endif // __BLE_CONN_PARAMS_HPP__
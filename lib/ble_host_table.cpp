@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <ble_host_table.hpp>
+#include <cstring>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ble_host_table, LOG_LEVEL_INF);
+
+ble_host_table& hosts()
+{
+    static ble_host_table table;
+    return table;
+}
+
+static int hosts_set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    return hosts().set(key, len, read_cb, cb_arg);
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(demo_hosts, "demo/hosts", nullptr, hosts_set, nullptr, nullptr);
+
+int ble_host_table::find(const bt_addr_le_t* addr) const
+{
+    for (std::size_t i = 0; i < SLOTS; i++)
+    {
+        if (hosts_[i].used and bt_addr_le_eq(&hosts_[i].addr, addr))
+        {
+            return i;
+        }
+    }
+    return -ENOENT;
+}
+
+void ble_host_table::connected(bt_conn* conn)
+{
+    auto key = k_spin_lock(&lock_);
+    if (auto slot = find(bt_conn_get_dst(conn)); slot >= 0)
+    {
+        hosts_[slot].conn = conn;
+    }
+    k_spin_unlock(&lock_, key);
+}
+
+void ble_host_table::disconnected(bt_conn* conn)
+{
+    auto key = k_spin_lock(&lock_);
+    for (auto& host : hosts_)
+    {
+        if (host.conn == conn)
+        {
+            host.conn = nullptr;
+        }
+    }
+    k_spin_unlock(&lock_, key);
+}
+
+void ble_host_table::bonded(bt_conn* conn)
+{
+    auto* addr = bt_conn_get_dst(conn);
+    auto key = k_spin_lock(&lock_);
+    auto slot = find(addr);
+    if (slot < 0)
+    {
+        // take a free slot, or the one following the active host
+        slot = (active_ + 1) % SLOTS;
+        for (std::size_t i = 0; i < SLOTS; i++)
+        {
+            if (!hosts_[i].used)
+            {
+                slot = i;
+                break;
+            }
+        }
+        if (hosts_[slot].used and (static_cast<std::size_t>(slot) == active_))
+        {
+            k_spin_unlock(&lock_, key);
+            LOG_WRN("No free host slot, the new host isn't stored");
+            return;
+        }
+        hosts_[slot] = {*addr, conn, true};
+    }
+    hosts_[slot].conn = conn;
+    k_spin_unlock(&lock_, key);
+    LOG_INF("Host %d bonded", slot);
+    save();
+}
+
+void ble_host_table::prune()
+{
+    std::array<bool, SLOTS> bonded{};
+    struct context
+    {
+        ble_host_table* self;
+        std::array<bool, SLOTS>* bonded;
+    } ctx{this, &bonded};
+    bt_foreach_bond(
+        BT_ID_DEFAULT,
+        [](const bt_bond_info* info, void* user_data)
+        {
+            auto* ctx = static_cast<context*>(user_data);
+            if (auto slot = ctx->self->find(&info->addr); slot >= 0)
+            {
+                (*ctx->bonded)[slot] = true;
+            }
+        },
+        &ctx);
+    auto key = k_spin_lock(&lock_);
+    for (std::size_t i = 0; i < SLOTS; i++)
+    {
+        hosts_[i].used = hosts_[i].used and bonded[i];
+    }
+    k_spin_unlock(&lock_, key);
+}
+
+int ble_host_table::select(std::size_t slot)
+{
+    if (slot >= SLOTS)
+    {
+        return -EINVAL;
+    }
+    auto key = k_spin_lock(&lock_);
+    if (!hosts_[slot].used)
+    {
+        k_spin_unlock(&lock_, key);
+        return -EINVAL;
+    }
+    active_ = slot;
+    select_time_ = k_cycle_get_32();
+    bool connected = hosts_[slot].conn != nullptr;
+    k_spin_unlock(&lock_, key);
+    save();
+    return connected ? 0 : -ENOTCONN;
+}
+
+bool ble_host_table::is_active(const bt_conn* conn) const
+{
+    auto key = k_spin_lock(&lock_);
+    // without a selected host, any host is served
+    bool active = !hosts_[active_].used or ((conn != nullptr) and (hosts_[active_].conn == conn));
+    k_spin_unlock(&lock_, key);
+    return active;
+}
+
+bt_conn* ble_host_table::active_conn(bt_conn* fallback) const
+{
+    auto key = k_spin_lock(&lock_);
+    auto* conn = hosts_[active_].used ? hosts_[active_].conn : fallback;
+    k_spin_unlock(&lock_, key);
+    return conn;
+}
+
+ble_host_table::host ble_host_table::get(std::size_t slot) const
+{
+    auto key = k_spin_lock(&lock_);
+    auto host = hosts_[slot];
+    k_spin_unlock(&lock_, key);
+    return host;
+}
+
+void ble_host_table::save()
+{
+    if (!IS_ENABLED(CONFIG_SETTINGS))
+    {
+        return;
+    }
+    std::array<bt_addr_le_t, SLOTS> addrs{};
+    auto key = k_spin_lock(&lock_);
+    for (std::size_t i = 0; i < SLOTS; i++)
+    {
+        addrs[i] = hosts_[i].used ? hosts_[i].addr : *BT_ADDR_LE_ANY;
+    }
+    uint8_t active = active_;
+    k_spin_unlock(&lock_, key);
+    settings_save_one("demo/hosts/addr", addrs.data(), sizeof(addrs));
+    settings_save_one("demo/hosts/active", &active, sizeof(active));
+}
+
+int ble_host_table::set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    if (std::strcmp(key, "addr") == 0)
+    {
+        std::array<bt_addr_le_t, SLOTS> addrs{};
+        auto size = read_cb(cb_arg, addrs.data(), std::min(len, sizeof(addrs)));
+        if (size < 0)
+        {
+            return size;
+        }
+        for (std::size_t i = 0; i < SLOTS; i++)
+        {
+            hosts_[i].addr = addrs[i];
+            hosts_[i].used = (i < (size / sizeof(bt_addr_le_t))) and
+                             !bt_addr_le_eq(&addrs[i], BT_ADDR_LE_ANY);
+        }
+        return 0;
+    }
+    if (std::strcmp(key, "active") == 0)
+    {
+        uint8_t active{};
+        auto size = read_cb(cb_arg, &active, sizeof(active));
+        if (size < 0)
+        {
+            return size;
+        }
+        active_ = std::min<std::size_t>(active, SLOTS - 1);
+        return 0;
+    }
+    return -ENOENT;
+}
@@ -0,0 +1,69 @@
+#ifndef __BLE_HOST_TABLE_HPP__
+#define __BLE_HOST_TABLE_HPP__
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <zephyr/bluetooth/addr.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+
+/// @brief Slots of the bonded hosts a peripheral switches between,
+///        with the selected (active) host that receives the input reports.
+///        The slot assignment and the selection are persisted in the settings.
+///        All hosts stay connected, selecting a host only changes the connection
+///        that the application sends the input reports to.
+class ble_host_table
+{
+  public:
+    static constexpr std::size_t SLOTS = CONFIG_DEMO_BLE_HOST_SLOTS;
+
+    struct host
+    {
+        bt_addr_le_t addr;
+        bt_conn* conn;
+        bool used;
+    };
+
+    /// @brief Links the connection to the host's slot, if it's known.
+    void connected(bt_conn* conn);
+    void disconnected(bt_conn* conn);
+
+    /// @brief Assigns a slot to a newly bonded host, overwriting an inactive host when all are used.
+    ///        The active host is never overwritten, with a single slot the new host isn't stored.
+    void bonded(bt_conn* conn);
+
+    /// @brief Drops the hosts whose bond was removed since the slots were saved.
+    void prune();
+
+    /// @brief Selects the host receiving the input reports.
+    /// @return -EINVAL if the slot is empty, -ENOTCONN if the host isn't connected (yet)
+    int select(std::size_t slot);
+
+    std::size_t active_slot() const { return active_; }
+    bool is_active(const bt_conn* conn) const;
+
+    /// @brief The connection of the selected host, nullptr while it isn't connected.
+    /// @param fallback the connection to use when no host is selected
+    bt_conn* active_conn(bt_conn* fallback) const;
+    host get(std::size_t slot) const;
+
+    /// @brief The time elapsed since the last selection, in cycles.
+    uint32_t since_select() const { return k_cycle_get_32() - select_time_; }
+
+    /// @brief Restores a saved setting, called by the settings handler.
+    int set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg);
+
+  private:
+    int find(const bt_addr_le_t* addr) const;
+    void save();
+
+    std::array<host, SLOTS> hosts_{};
+    mutable k_spinlock lock_{};
+    std::size_t active_{};
+    uint32_t select_time_{};
+};
+
+ble_host_table& hosts();
+
+#endif // __BLE_HOST_TABLE_HPP__
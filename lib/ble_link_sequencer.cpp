@@ -0,0 +1,289 @@
+#include <ble_link_sequencer.hpp>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/logging/log.h>
+#if CONFIG_DEMO_BLE_CONN_PARAMS
+#include <ble_conn_params.hpp>
+#endif
+
+LOG_MODULE_REGISTER(ble_link_sequencer, LOG_LEVEL_INF);
+
+// the SMP timeout, pairing may need user input
+static constexpr int security_timeout_ms = 30000;
+static constexpr ble_link_steps::timing timing{CONFIG_DEMO_BLE_LINK_SETTLE_MS,
+                                               CONFIG_DEMO_BLE_LINK_PROC_TIMEOUT_MS,
+                                               security_timeout_ms};
+
+ble_link_sequencer& link_sequencer()
+{
+    static ble_link_sequencer seq;
+    return seq;
+}
+
+ble_link_sequencer::ble_link_sequencer()
+{
+    for (auto& l : links_)
+    {
+        k_work_init_delayable(&l.work, work_handler);
+    }
+}
+
+void ble_link_sequencer::work_handler(k_work* work)
+{
+    auto* l = CONTAINER_OF(k_work_delayable_from_work(work), link, work);
+    link_sequencer().process(*l);
+}
+
+void ble_link_sequencer::schedule(link& l, int64_t wake, int64_t now)
+{
+    if (wake == ble_link_steps::never)
+    {
+        return;
+    }
+    if (wake <= now)
+    {
+        k_work_reschedule(&l.work, K_NO_WAIT);
+        return;
+    }
+    // doesn't override a completion that has already arrived
+    k_work_schedule(&l.work, K_TIMEOUT_ABS_MS(wake));
+}
+
+void ble_link_sequencer::log_skipped(step s, uint32_t skipped) const
+{
+    if (stats_.skipped != skipped)
+    {
+        LOG_WRN("Link step %u skipped", static_cast<unsigned>(s));
+    }
+}
+
+void ble_link_sequencer::connected(bt_conn* conn)
+{
+    bt_conn_info info;
+    if ((bt_conn_get_info(conn, &info) != 0) or (info.role != BT_CONN_ROLE_PERIPHERAL))
+    {
+        return;
+    }
+    auto& l = links_[bt_conn_index(conn)];
+    auto key = k_spin_lock(&lock_);
+    l.conn = bt_conn_ref(conn);
+    l.steps.connected(k_uptime_get(), timing);
+    k_spin_unlock(&lock_, key);
+    k_work_reschedule(&l.work, K_MSEC(CONFIG_DEMO_BLE_LINK_SETTLE_MS));
+}
+
+void ble_link_sequencer::disconnected(bt_conn* conn, uint8_t reason)
+{
+    auto& l = links_[bt_conn_index(conn)];
+    auto key = k_spin_lock(&lock_);
+    if ((reason == BT_HCI_ERR_LL_PROC_COLLISION) or (reason == BT_HCI_ERR_DIFF_TRANS_COLLISION))
+    {
+        stats_.collisions++;
+    }
+    if (l.conn != conn)
+    {
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    l.conn = nullptr;
+    l.steps.disconnected();
+    k_spin_unlock(&lock_, key);
+    k_work_cancel_delayable(&l.work);
+    bt_conn_unref(conn);
+}
+
+/// @brief Whether the remote supports the link layer procedure of the step, as far as
+///        its exchanged features tell. The feature exchange usually completes before
+///        the PHY step, without it the procedure is attempted.
+uint8_t ble_link_sequencer::remote_support(bt_conn* conn, step s)
+{
+#if CONFIG_BT_REMOTE_INFO
+    bt_conn_remote_info info;
+    if ((bt_conn_get_remote_info(conn, &info) != 0) or (info.le.features == nullptr))
+    {
+        return BT_HCI_ERR_SUCCESS;
+    }
+    if (((s == step::PHY) and !BT_FEAT_LE_PHY_2M(info.le.features)) or
+        ((s == step::DATA_LEN) and !BT_FEAT_LE_DLE(info.le.features)))
+    {
+        return BT_HCI_ERR_UNSUPP_REMOTE_FEATURE;
+    }
+#endif
+    return BT_HCI_ERR_SUCCESS;
+}
+
+void ble_link_sequencer::procedure_done(bt_conn* conn, step s, uint8_t err)
+{
+    auto& l = links_[bt_conn_index(conn)];
+    auto key = k_spin_lock(&lock_);
+    if (l.conn != conn)
+    {
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    auto skipped = stats_.skipped;
+    l.steps.procedure_done(s, err == BT_HCI_ERR_UNSUPP_REMOTE_FEATURE, k_uptime_get(), stats_);
+    log_skipped(s, skipped);
+    k_spin_unlock(&lock_, key);
+    k_work_reschedule(&l.work, K_NO_WAIT);
+}
+
+void ble_link_sequencer::process(link& l)
+{
+    auto key = k_spin_lock(&lock_);
+    if (l.conn == nullptr)
+    {
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    auto now = k_uptime_get();
+    auto current = l.steps.current();
+    auto skipped = stats_.skipped;
+    auto action = l.steps.process(now, stats_,
+                                  [&l](step s)
+                                  {
+                                      return remote_support(l.conn, s) ==
+                                             BT_HCI_ERR_UNSUPP_REMOTE_FEATURE;
+                                  });
+    log_skipped(current, skipped);
+    if (action.start == step::NONE)
+    {
+        schedule(l, action.wake, now);
+        k_spin_unlock(&lock_, key);
+        return;
+    }
+    auto* conn = bt_conn_ref(l.conn);
+    k_spin_unlock(&lock_, key);
+
+    auto result = start(conn, action.start);
+
+    key = k_spin_lock(&lock_);
+    if (l.conn == conn)
+    {
+        skipped = stats_.skipped;
+        schedule(l, l.steps.started(action.start, now, result, stats_), now);
+        log_skipped(action.start, skipped);
+    }
+    k_spin_unlock(&lock_, key);
+    bt_conn_unref(conn);
+}
+
+ble_link_steps::start_result ble_link_sequencer::start(bt_conn* conn, step s)
+{
+    using result = ble_link_steps::start_result;
+    auto started = [](int err) { return (err == 0) ? result::STARTED : result::REFUSED; };
+
+    bt_conn_info info;
+    if (bt_conn_get_info(conn, &info) != 0)
+    {
+        return result::REFUSED;
+    }
+    switch (s)
+    {
+    case step::SECURITY:
+        if (bt_conn_get_security(conn) >= BT_SECURITY_L2)
+        {
+            return result::NOT_NEEDED;
+        }
+        return started(bt_conn_set_security(conn, BT_SECURITY_L2));
+
+    case step::PHY:
+        if ((info.le.phy->tx_phy == BT_GAP_LE_PHY_2M) and
+            (info.le.phy->rx_phy == BT_GAP_LE_PHY_2M))
+        {
+            return result::NOT_NEEDED;
+        }
+        if (remote_support(conn, s) != BT_HCI_ERR_SUCCESS)
+        {
+            return result::UNSUPPORTED;
+        }
+        return started(bt_conn_le_phy_update(conn, BT_CONN_LE_PHY_PARAM_2M));
+
+    case step::DATA_LEN:
+        if (info.le.data_len->tx_max_len >= BT_GAP_DATA_LEN_MAX)
+        {
+            return result::NOT_NEEDED;
+        }
+        if (remote_support(conn, s) != BT_HCI_ERR_SUCCESS)
+        {
+            return result::UNSUPPORTED;
+        }
+        return started(bt_conn_le_data_len_update(conn, BT_LE_DATA_LEN_PARAM_MAX));
+
+    case step::CONN_PARAMS:
+#if CONFIG_DEMO_BLE_CONN_PARAMS
+        // the link has already settled
+        conn_params().attach(conn, 0);
+#endif
+        return result::NOT_NEEDED;
+
+    default:
+        return result::NOT_NEEDED;
+    }
+}
+
+ble_link_sequencer::step ble_link_sequencer::current_step(const bt_conn* conn) const
+{
+    auto& l = links_[bt_conn_index(conn)];
+    auto key = k_spin_lock(&lock_);
+    auto s = (l.conn == conn) ? l.steps.current() : step::NONE;
+    k_spin_unlock(&lock_, key);
+    return s;
+}
+
+ble_link_sequencer::statistics ble_link_sequencer::stats() const
+{
+    auto key = k_spin_lock(&lock_);
+    auto stats = stats_;
+    k_spin_unlock(&lock_, key);
+    return stats;
+}
+
+static void seq_connected(bt_conn* conn, uint8_t err)
+{
+    if (!err)
+    {
+        link_sequencer().connected(conn);
+    }
+}
+
+static void seq_disconnected(bt_conn* conn, uint8_t reason)
+{
+    link_sequencer().disconnected(conn, reason);
+}
+
+static void seq_security_changed(bt_conn* conn, bt_security_t level, bt_security_err err)
+{
+    // a failed pairing isn't retried, the user has to start it again
+    link_sequencer().procedure_done(conn, ble_link_sequencer::step::SECURITY);
+}
+
+static void seq_le_param_updated(bt_conn* conn, uint16_t interval, uint16_t latency,
+                                 uint16_t timeout)
+{
+    link_sequencer().procedure_done(conn, ble_link_sequencer::step::CONN_PARAMS);
+}
+
+static void seq_le_phy_updated(bt_conn* conn, bt_conn_le_phy_info* param)
+{
+    // the stack reports a failed update with the unchanged PHY, without its status
+    uint8_t err = BT_HCI_ERR_SUCCESS;
+    if ((param->tx_phy != BT_GAP_LE_PHY_2M) and (param->rx_phy != BT_GAP_LE_PHY_2M))
+    {
+        err = BT_HCI_ERR_UNSUPP_REMOTE_FEATURE;
+    }
+    link_sequencer().procedure_done(conn, ble_link_sequencer::step::PHY, err);
+}
+
+static void seq_le_data_len_updated(bt_conn* conn, bt_conn_le_data_len_info* info)
+{
+    link_sequencer().procedure_done(conn, ble_link_sequencer::step::DATA_LEN);
+}
+
+BT_CONN_CB_DEFINE(link_sequencer_callbacks) = {
+    .connected = seq_connected,
+    .disconnected = seq_disconnected,
+    .le_param_updated = seq_le_param_updated,
+    .security_changed = seq_security_changed,
+    .le_phy_updated = seq_le_phy_updated,
+    .le_data_len_updated = seq_le_data_len_updated,
+};
@@ -0,0 +1,63 @@
+#ifndef __BLE_LINK_SEQUENCER_HPP__
+#define __BLE_LINK_SEQUENCER_HPP__
+#include <array>
+#include <ble_link_steps.hpp>
+#include <cstdint>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+
+/// @brief Runs the link layer procedures a peripheral wants after connecting strictly
+///        one after the other: security, 2M PHY update, data length extension,
+///        then hands the link over to the connection parameter negotiation.
+///        A procedure is only started once the link has been quiet for the settle time,
+///        a procedure started by the central postpones the next step by the same time.
+///        Unanswered or refused procedures are retried with back-off, then skipped.
+///        A remote that doesn't support the PHY or data length update gets neither,
+///        the link goes straight to the connection parameter negotiation.
+///        This replaces the stack's automatic procedures, which may collide with the
+///        central's and lead to disconnection (0x23, 0x2A) on some controllers.
+///        The connection callbacks are registered by the module itself,
+///        the state machine of each link is @ref ble_link_steps.
+class ble_link_sequencer
+{
+  public:
+    using step = ble_link_steps::step;
+    using statistics = ble_link_steps::statistics;
+
+    ble_link_sequencer();
+
+    void connected(bt_conn* conn);
+    void disconnected(bt_conn* conn, uint8_t reason);
+
+    /// @brief Signals the completion of a procedure, or one initiated by the central.
+    /// @param err the HCI status of the procedure, BT_HCI_ERR_UNSUPP_REMOTE_FEATURE is final
+    void procedure_done(bt_conn* conn, step s, uint8_t err = 0);
+
+    step current_step(const bt_conn* conn) const;
+    statistics stats() const;
+
+  private:
+    struct link
+    {
+        k_work_delayable work;
+        bt_conn* conn;
+        ble_link_steps steps;
+    };
+
+    static void work_handler(k_work* work);
+    void process(link& l);
+    static ble_link_steps::start_result start(bt_conn* conn, step s);
+    static uint8_t remote_support(bt_conn* conn, step s);
+    /// @brief Schedules the processing of the link, must be called locked.
+    static void schedule(link& l, int64_t wake, int64_t now);
+    /// @brief Logs the steps given up by the last state machine call, must be called locked.
+    void log_skipped(step s, uint32_t skipped) const;
+
+    std::array<link, CONFIG_BT_MAX_CONN> links_{};
+    mutable k_spinlock lock_{};
+    statistics stats_{};
+};
+
+ble_link_sequencer& link_sequencer();
+
+#endif // __BLE_LINK_SEQUENCER_HPP__
@@ -0,0 +1,232 @@
+#ifndef __BLE_LINK_STEPS_HPP__
+#define __BLE_LINK_STEPS_HPP__
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+/// @brief The retry and fallback state machine of @ref ble_link_sequencer for one link,
+///        without the Bluetooth calls, driven by the uptime in ms.
+///        The owner starts the step returned by @ref process, passes the result of it to
+///        @ref started, and calls @ref process again at the returned wake time.
+///        The methods aren't thread-safe, the owner locks.
+class ble_link_steps
+{
+  public:
+    enum class step : uint8_t
+    {
+        NONE,
+        SECURITY,
+        PHY,
+        DATA_LEN,
+        CONN_PARAMS,
+        DONE,
+    };
+
+    struct statistics
+    {
+        uint32_t completed;  // the links that went through all steps
+        uint32_t retries;    // the procedures that timed out or were refused
+        uint32_t skipped;    // the steps given up after retrying
+        uint32_t deferred;   // the steps postponed by a central initiated procedure
+        uint32_t collisions; // the disconnections due to procedure collision
+    };
+
+    struct timing
+    {
+        uint32_t settle_ms;           // the quiet time before each procedure
+        uint32_t proc_timeout_ms;     // the time the central has to answer a procedure
+        uint32_t security_timeout_ms; // the same for pairing, which may need user input
+    };
+
+    static constexpr uint8_t max_attempts = 3;
+    static constexpr uint32_t min_backoff_ms = 200;
+    static constexpr uint32_t max_backoff_ms = 5000;
+    static constexpr int64_t never = std::numeric_limits<int64_t>::max();
+
+    /// @brief The result of starting a step's procedure.
+    enum class start_result : uint8_t
+    {
+        NOT_NEEDED, // e.g. the link already has the PHY
+        STARTED,    // in flight, until @ref procedure_done
+        UNSUPPORTED,
+        REFUSED, // e.g. another procedure is in progress
+    };
+
+    /// @brief The result of @ref process.
+    struct action
+    {
+        step start;   // the step to start now, NONE if none
+        int64_t wake; // the time to process again, never if the sequence is done
+    };
+
+    /// @brief Starts the sequence on a new connection, after the settle time.
+    /// @return the time to process
+    int64_t connected(int64_t now, const timing& t)
+    {
+        timing_ = t;
+        deadline_ = 0;
+        quiet_until_ = now + timing_.settle_ms;
+        backoff_ms_ = 0;
+        attempts_ = 0;
+        current_ = step::SECURITY;
+        done_ = step::NONE;
+        return quiet_until_;
+    }
+
+    void disconnected() { current_ = step::NONE; }
+
+    /// @brief Advances the sequence: moves on from a finished step, retries a procedure that
+    ///        wasn't answered in time, or gives it up.
+    /// @param unsupported tells whether the remote is known not to support a step's procedure
+    template <typename TUnsupported>
+    action process(int64_t now, statistics& stats, TUnsupported&& unsupported)
+    {
+        if (deadline_ != 0)
+        {
+            if (done_ == current_)
+            {
+                next(current_);
+            }
+            else if (now < deadline_)
+            {
+                // a procedure is still in flight, never start another one
+                return {step::NONE, deadline_};
+            }
+            else if (link_procedure(current_) and unsupported(current_))
+            {
+                // e.g. the data length update is never answered by a remote without it
+                skip_link_procedures(stats);
+            }
+            else
+            {
+                deadline_ = 0;
+                stats.retries++;
+                if (++attempts_ < max_attempts)
+                {
+                    backoff_ms_ = std::clamp<uint32_t>(backoff_ms_ * 2, min_backoff_ms,
+                                                       max_backoff_ms);
+                    quiet_until_ = std::max(quiet_until_, now + backoff_ms_);
+                }
+                else
+                {
+                    stats.skipped++;
+                    next(current_);
+                }
+            }
+        }
+        if (now < quiet_until_)
+        {
+            return {step::NONE, quiet_until_};
+        }
+        if ((current_ == step::DONE) or (current_ == step::NONE))
+        {
+            return {step::NONE, never};
+        }
+        // set before starting, the completion may arrive before the start returns
+        deadline_ = now + ((current_ == step::SECURITY) ? timing_.security_timeout_ms
+                                                        : timing_.proc_timeout_ms);
+        done_ = step::NONE;
+        return {current_, deadline_};
+    }
+
+    /// @brief Takes the result of starting the step returned by @ref process.
+    /// @return the time to process again, never if the link moved on meanwhile
+    int64_t started(step s, int64_t now, start_result result, statistics& stats)
+    {
+        if (current_ != s)
+        {
+            return never;
+        }
+        int64_t wake = now;
+        if (result == start_result::NOT_NEEDED)
+        {
+            done_ = s;
+        }
+        else if ((result == start_result::UNSUPPORTED) and link_procedure(s))
+        {
+            skip_link_procedures(stats);
+        }
+        else if (result == start_result::UNSUPPORTED)
+        {
+            deadline_ = 0;
+            current_ = following(s);
+        }
+        else if (result == start_result::REFUSED)
+        {
+            // retry after back-off
+            deadline_ = now;
+        }
+        else
+        {
+            wake = deadline_;
+        }
+        if ((current_ == step::CONN_PARAMS) and (done_ == step::CONN_PARAMS))
+        {
+            stats.completed++;
+        }
+        return wake;
+    }
+
+    /// @brief Signals the completion of a procedure, or one initiated by the central.
+    /// @param unsupported the remote rejected the procedure as unsupported, which is final
+    void procedure_done(step s, bool unsupported, int64_t now, statistics& stats)
+    {
+        if ((current_ == step::DONE) or (current_ == step::NONE))
+        {
+            return;
+        }
+        if (unsupported and (deadline_ != 0) and (current_ == s) and link_procedure(s))
+        {
+            skip_link_procedures(stats);
+        }
+        else if ((deadline_ != 0) and (current_ == s))
+        {
+            done_ = s;
+        }
+        else
+        {
+            // initiated by the central, let it finish its own sequence first
+            quiet_until_ = std::max(quiet_until_, now + timing_.settle_ms);
+            stats.deferred++;
+        }
+    }
+
+    step current() const { return current_; }
+
+  private:
+    static constexpr step following(step s)
+    {
+        return (s == step::DONE) ? step::DONE : static_cast<step>(static_cast<uint8_t>(s) + 1);
+    }
+
+    static constexpr bool link_procedure(step s)
+    {
+        return (s == step::PHY) or (s == step::DATA_LEN);
+    }
+
+    void next(step s)
+    {
+        deadline_ = 0;
+        attempts_ = 0;
+        backoff_ms_ = 0;
+        current_ = following(s);
+    }
+
+    /// @brief Gives up the PHY and data length steps, which the remote doesn't support,
+    ///        retrying them would only delay the connection parameters.
+    void skip_link_procedures(statistics& stats)
+    {
+        stats.skipped++;
+        next(step::DATA_LEN);
+    }
+
+    timing timing_{};
+    int64_t deadline_{};    // of the procedure in flight, 0 if none
+    int64_t quiet_until_{}; // the next procedure isn't started before
+    uint32_t backoff_ms_{};
+    uint8_t attempts_{};
+    step current_{};
+    step done_{};
+};
+
+#endif // __BLE_LINK_STEPS_HPP__
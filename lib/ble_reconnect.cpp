@@ -0,0 +1,195 @@
+#include <ble_reconnect.hpp>
+#include <cstring>
+#include <zephyr/bluetooth/hci.h>
+#include <zephyr/logging/log.h>
+
+LOG_MODULE_REGISTER(ble_reconnect, LOG_LEVEL_INF);
+
+ble_reconnect& reconnect()
+{
+    static ble_reconnect r;
+    return r;
+}
+
+static int reconnect_set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    return reconnect().set(key, len, read_cb, cb_arg);
+}
+
+SETTINGS_STATIC_HANDLER_DEFINE(demo_reconnect, "demo/reconnect", nullptr, reconnect_set, nullptr,
+                               nullptr);
+
+static void count_bond(const bt_bond_info*, void* user_data)
+{
+    (*static_cast<unsigned*>(user_data))++;
+}
+
+/// @brief The accept list holds the identity address, a host connecting from a
+///        resolvable private address is matched after the controller resolves it.
+static void accept_bond(const bt_bond_info* info, void*)
+{
+    bt_le_filter_accept_list_add(&info->addr);
+}
+
+void ble_reconnect::work_handler(k_work* work)
+{
+    auto* self = CONTAINER_OF(k_work_delayable_from_work(work), ble_reconnect, work_);
+    if (self->phase_ == phase::ACCEPT_LIST)
+    {
+        LOG_INF("No bonded host reconnected, advertising for new hosts");
+        self->advertise(phase::GENERAL);
+    }
+}
+
+void ble_reconnect::set_peer(const bt_addr_le_t& peer)
+{
+    peer_ = peer;
+    if (IS_ENABLED(CONFIG_SETTINGS))
+    {
+        settings_save_one("demo/reconnect/peer", &peer_, sizeof(peer_));
+    }
+}
+
+bool ble_reconnect::peer_available() const
+{
+    if (bt_addr_le_eq(&peer_, BT_ADDR_LE_ANY) or !bt_le_bond_exists(BT_ID_DEFAULT, &peer_))
+    {
+        return false;
+    }
+    // the peer is already connected, e.g. advertising for an additional host
+    if (auto* conn = bt_conn_lookup_addr_le(BT_ID_DEFAULT, &peer_); conn != nullptr)
+    {
+        bt_conn_unref(conn);
+        return false;
+    }
+    return true;
+}
+
+int ble_reconnect::start()
+{
+    if (phase_ != phase::IDLE)
+    {
+        return -EALREADY;
+    }
+    start_time_ = k_cycle_get_32();
+    if (peer_available())
+    {
+        return advertise(phase::DIRECTED);
+    }
+    return advertise(phase::ACCEPT_LIST);
+}
+
+int ble_reconnect::advertise(phase p)
+{
+    bt_le_adv_stop();
+    k_work_cancel_delayable(&work_);
+
+    int err = 0;
+    switch (p)
+    {
+    case phase::DIRECTED:
+        // high duty cycle, the controller stops it after 1.28 s
+        err = bt_le_adv_start(BT_LE_ADV_CONN_DIR(&peer_), nullptr, 0, nullptr, 0);
+        break;
+
+    case phase::ACCEPT_LIST:
+    {
+        unsigned bonds = 0;
+        bt_foreach_bond(BT_ID_DEFAULT, count_bond, &bonds);
+        if (bonds == 0)
+        {
+            return advertise(phase::GENERAL);
+        }
+        bt_le_filter_accept_list_clear();
+        bt_foreach_bond(BT_ID_DEFAULT, accept_bond, nullptr);
+        const bt_le_adv_param* param =
+            BT_LE_ADV_PARAM(BT_LE_ADV_OPT_CONN | BT_LE_ADV_OPT_FILTER_CONN,
+                            BT_GAP_ADV_FAST_INT_MIN_1, BT_GAP_ADV_FAST_INT_MAX_1, nullptr);
+        err = bt_le_adv_start(param, ad_.data(), ad_.size(), sd_.data(), sd_.size());
+        if (err == 0)
+        {
+            k_work_schedule(&work_, K_MSEC(CONFIG_DEMO_BLE_RECONNECT_ACCEPT_LIST_MS));
+        }
+        break;
+    }
+
+    default:
+    {
+        const bt_le_adv_param* param = BT_LE_ADV_PARAM(
+            BT_LE_ADV_OPT_CONN, BT_GAP_ADV_FAST_INT_MIN_2, BT_GAP_ADV_FAST_INT_MAX_2, nullptr);
+        err = bt_le_adv_start(param, ad_.data(), ad_.size(), sd_.data(), sd_.size());
+        break;
+    }
+    }
+
+    if (err == 0)
+    {
+        phase_ = p;
+        LOG_INF("Advertising phase %u started", static_cast<unsigned>(p));
+    }
+    else if (p != phase::GENERAL)
+    {
+        LOG_WRN("Advertising phase %u failed (err %d)", static_cast<unsigned>(p), err);
+        return advertise(static_cast<phase>(static_cast<uint8_t>(p) + 1));
+    }
+    else
+    {
+        phase_ = phase::IDLE;
+    }
+    return err;
+}
+
+void ble_reconnect::connected(bt_conn* conn, uint8_t err)
+{
+    if (err == BT_HCI_ERR_ADV_TIMEOUT)
+    {
+        if (phase_ == phase::DIRECTED)
+        {
+            advertise(phase::ACCEPT_LIST);
+        }
+        return;
+    }
+    if (err)
+    {
+        return;
+    }
+    // legacy advertising stops at connection
+    k_work_cancel_delayable(&work_);
+    if (phase_ != phase::IDLE)
+    {
+        record(phase_);
+        phase_ = phase::IDLE;
+    }
+    auto* dst = bt_conn_get_dst(conn);
+    if (bt_le_bond_exists(BT_ID_DEFAULT, dst) and !bt_addr_le_eq(dst, &peer_))
+    {
+        set_peer(*dst);
+    }
+}
+
+void ble_reconnect::record(phase p)
+{
+    auto elapsed_ms = k_cyc_to_ms_floor32(k_cycle_get_32() - start_time_);
+    std::size_t bucket = 0;
+    while ((bucket < BUCKET_LIMITS_MS.size()) and (elapsed_ms >= BUCKET_LIMITS_MS[bucket]))
+    {
+        bucket++;
+    }
+    histograms_[static_cast<uint8_t>(p) - 1][bucket]++;
+    LOG_INF("Reconnected in %u ms, phase %u", elapsed_ms, static_cast<unsigned>(p));
+}
+
+ble_reconnect::histogram ble_reconnect::stats(phase p) const
+{
+    return histograms_[static_cast<uint8_t>(p) - 1];
+}
+
+int ble_reconnect::set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg)
+{
+    if (std::strcmp(key, "peer") == 0)
+    {
+        auto size = read_cb(cb_arg, &peer_, sizeof(peer_));
+        return (size < 0) ? size : 0;
+    }
+    return -ENOENT;
+}
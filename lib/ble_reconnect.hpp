@@ -0,0 +1,72 @@
+#ifndef __BLE_RECONNECT_HPP__
+#define __BLE_RECONNECT_HPP__
+#include <array>
+#include <cstdint>
+#include <span>
+#include <zephyr/bluetooth/bluetooth.h>
+#include <zephyr/bluetooth/conn.h>
+#include <zephyr/kernel.h>
+#include <zephyr/settings/settings.h>
+
+/// @brief Advertising strategy for the fastest reconnection to a bonded host:
+///        1. high duty cycle directed advertising to the last peer (1.28 s by spec)
+///        2. undirected advertising accepting only bonded hosts
+///        3. general discoverable advertising, for pairing new hosts
+///        The time from starting until a host connects is collected in a histogram,
+///        for each phase.
+class ble_reconnect
+{
+  public:
+    enum class phase : uint8_t
+    {
+        IDLE,
+        DIRECTED,
+        ACCEPT_LIST,
+        GENERAL,
+    };
+
+    static constexpr std::array<uint16_t, 7> BUCKET_LIMITS_MS{50, 100, 200, 500, 1000, 2000, 5000};
+    using histogram = std::array<uint32_t, BUCKET_LIMITS_MS.size() + 1>;
+
+    ble_reconnect() { k_work_init_delayable(&work_, work_handler); }
+
+    /// @brief Sets the advertising and scan response data of the undirected phases.
+    void set_data(std::span<const bt_data> ad, std::span<const bt_data> sd)
+    {
+        ad_ = ad;
+        sd_ = sd;
+    }
+
+    /// @brief Sets the peer of the directed phase, e.g. when the user selects a host.
+    void set_peer(const bt_addr_le_t& peer);
+
+    /// @brief Starts (or continues) advertising, from the first phase that applies.
+    int start();
+
+    /// @brief Called from the connected callback, also on directed advertising timeout.
+    void connected(bt_conn* conn, uint8_t err);
+
+    phase current_phase() const { return phase_; }
+    histogram stats(phase p) const;
+
+    /// @brief Restores a saved setting, called by the settings handler.
+    int set(const char* key, size_t len, settings_read_cb read_cb, void* cb_arg);
+
+  private:
+    static void work_handler(k_work* work);
+    int advertise(phase p);
+    bool peer_available() const;
+    void record(phase p);
+
+    std::span<const bt_data> ad_{};
+    std::span<const bt_data> sd_{};
+    std::array<histogram, 3> histograms_{};
+    k_work_delayable work_{};
+    bt_addr_le_t peer_{};
+    uint32_t start_time_{};
+    phase phase_{phase::IDLE};
+};
+
+ble_reconnect& reconnect();
+
+#endif // __BLE_RECONNECT_HPP__
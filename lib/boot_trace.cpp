@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <atomic>
+#include <boot_trace.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+LOG_MODULE_REGISTER(boot_trace, LOG_LEVEL_INF);
+
+extern "C"
+{
+    struct boot_phase
+    {
+        const char* name;
+        uint32_t end_cyc;
+    };
+
+    static boot_phase phases[CONFIG_DEMO_BOOT_TRACE_MAX_PHASES];
+    static std::atomic<unsigned> phase_count{};
+    static std::atomic<bool> done{};
+
+#if CONFIG_SHELL
+#define BOOT_TRACE_PRINT(sh, ...)                                                                  \
+    do                                                                                             \
+    {                                                                                              \
+        if ((sh) != nullptr)                                                                       \
+        {                                                                                          \
+            shell_print((sh), __VA_ARGS__);                                                        \
+        }                                                                                          \
+        else                                                                                       \
+        {                                                                                          \
+            LOG_INF(__VA_ARGS__);                                                                  \
+        }                                                                                          \
+    } while (0)
+#else
+#define BOOT_TRACE_PRINT(sh, ...) LOG_INF(__VA_ARGS__)
+#endif
+
+    void boot_trace_mark(const char* phase)
+    {
+        auto end_cyc = k_cycle_get_32();
+        auto index = phase_count.fetch_add(1);
+        if (index >= ARRAY_SIZE(phases))
+        {
+            return;
+        }
+        phases[index] = {phase, end_cyc};
+    }
+
+    static void report(const struct shell* sh)
+    {
+        auto count = std::min<unsigned>(phase_count.load(), ARRAY_SIZE(phases));
+        uint32_t start_cyc = 0;
+        for (unsigned i = 0; i < count; i++)
+        {
+            BOOT_TRACE_PRINT(sh, "%-20s %6u us (at %6u us)", phases[i].name,
+                             k_cyc_to_us_floor32(phases[i].end_cyc - start_cyc),
+                             k_cyc_to_us_floor32(phases[i].end_cyc));
+            start_cyc = phases[i].end_cyc;
+        }
+    }
+
+    void boot_trace_done(const char* phase)
+    {
+        if (done.exchange(true))
+        {
+            return;
+        }
+        boot_trace_mark(phase);
+        report(nullptr);
+    }
+
+#if CONFIG_SHELL
+    static int cmd_boot_phases(const shell* sh, size_t argc, char** argv)
+    {
+        report(sh);
+        return 0;
+    }
+
+    SHELL_STATIC_SUBCMD_SET_CREATE(sub_boot,
+                                   SHELL_CMD(phases, NULL, "Print the boot phase durations",
+                                             cmd_boot_phases),
+                                   SHELL_SUBCMD_SET_END);
+    SHELL_CMD_REGISTER(boot, &sub_boot, "Boot trace", NULL);
+#endif // CONFIG_SHELL
+}
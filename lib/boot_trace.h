@@ -0,0 +1,32 @@
+#ifndef __BOOT_TRACE_H__
+#define __BOOT_TRACE_H__
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+#if CONFIG_DEMO_BOOT_TRACE
+    /**
+     * @brief Records the end of a boot phase. The phase lasted since the previous mark,
+     *        the first one since the system timer started.
+     *        Phases running in parallel threads are told apart by their names.
+     * @param phase statically allocated name of the phase
+     */
+    void boot_trace_mark(const char* phase);
+
+    /**
+     * @brief Records the end of the last phase, when the device became reachable
+     *        (advertising, USB configured), and logs all phases once.
+     */
+    void boot_trace_done(const char* phase);
+#else
+    static inline void boot_trace_mark(const char* phase) {}
+    static inline void boot_trace_done(const char* phase) {}
+#endif
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif // __BOOT_TRACE_H__
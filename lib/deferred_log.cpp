@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <atomic>
+#include <deferred_log.hpp>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#if CONFIG_TIMING_FUNCTIONS
+#include <zephyr/timing/timing.h>
+#endif
+
+LOG_MODULE_REGISTER(deferred_log, LOG_LEVEL_INF);
+
+namespace deferred_log
+{
+K_MSGQ_DEFINE(log_msgq, sizeof(record), CONFIG_DEMO_DEFERRED_LOG_DEPTH, 4);
+
+struct statistics
+{
+    uint32_t posted;
+    uint32_t dropped;
+    uint32_t max_post_ns;
+    uint64_t total_post_ns;
+    uint32_t max_delay_us; // from the capture until the formatting
+};
+
+static statistics stats{};
+static k_spinlock stats_lock{};
+// formats the messages in the caller's context, as a baseline of the callback cost
+static std::atomic<bool> inline_mode{};
+
+#if CONFIG_TIMING_FUNCTIONS
+// the CPU cycle counter, the system timer may be too coarse
+static uint32_t post_ns(const timing_t& start)
+{
+    auto end = timing_counter_get();
+    return timing_cycles_to_ns(timing_cycles_get(&start, &end));
+}
+#define POST_START() timing_counter_get()
+#else
+static uint32_t post_ns(uint32_t start)
+{
+    return k_cyc_to_ns_floor32(k_cycle_get_32() - start);
+}
+#define POST_START() k_cycle_get_32()
+#endif
+
+bool post(const record& r)
+{
+    auto start = POST_START();
+    bool queued = true;
+    if (inline_mode.load())
+    {
+        r.format(r.args);
+    }
+    else
+    {
+        queued = k_msgq_put(&log_msgq, &r, K_NO_WAIT) == 0;
+    }
+    auto ns = post_ns(start);
+
+    auto key = k_spin_lock(&stats_lock);
+    if (queued)
+    {
+        stats.posted++;
+        stats.total_post_ns += ns;
+        stats.max_post_ns = std::max(stats.max_post_ns, ns);
+    }
+    else
+    {
+        stats.dropped++;
+    }
+    k_spin_unlock(&stats_lock, key);
+    return queued;
+}
+
+static void log_thread(void*, void*, void*)
+{
+#if CONFIG_TIMING_FUNCTIONS
+    timing_init();
+    timing_start();
+#endif
+    record r;
+    while (true)
+    {
+        k_msgq_get(&log_msgq, &r, K_FOREVER);
+        auto delay_us = k_cyc_to_us_floor32(k_cycle_get_32() - r.timestamp);
+        auto key = k_spin_lock(&stats_lock);
+        stats.max_delay_us = std::max(stats.max_delay_us, delay_us);
+        k_spin_unlock(&stats_lock, key);
+        r.format(r.args);
+    }
+}
+
+K_THREAD_DEFINE(deferred_log_thread, CONFIG_DEMO_DEFERRED_LOG_STACK_SIZE, log_thread, nullptr,
+                nullptr, nullptr, K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+#if CONFIG_SHELL
+static int cmd_dlog_stats(const shell* sh, size_t argc, char** argv)
+{
+    auto key = k_spin_lock(&stats_lock);
+    auto s = stats;
+    k_spin_unlock(&stats_lock, key);
+    shell_print(sh, "%s mode: %u messages, %u dropped, caller cost avg: %uns max: %uns",
+                inline_mode.load() ? "inline" : "deferred", s.posted, s.dropped,
+                (s.posted > 0) ? static_cast<uint32_t>(s.total_post_ns / s.posted) : 0,
+                s.max_post_ns);
+    shell_print(sh, "max formatting delay: %uus", s.max_delay_us);
+    return 0;
+}
+
+static int cmd_dlog_mode(const shell* sh, size_t argc, char** argv)
+{
+    if (strcmp(argv[1], "inline") == 0)
+    {
+        inline_mode.store(true);
+    }
+    else if (strcmp(argv[1], "deferred") == 0)
+    {
+        inline_mode.store(false);
+    }
+    else
+    {
+        shell_error(sh, "Unknown mode %s", argv[1]);
+        return -EINVAL;
+    }
+    auto key = k_spin_lock(&stats_lock);
+    stats = {};
+    k_spin_unlock(&stats_lock, key);
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(sub_dlog,
+                               SHELL_CMD(stats, NULL, "Print the deferred log statistics",
+                                         cmd_dlog_stats),
+                               SHELL_CMD_ARG(mode, NULL,
+                                             "Format the callback messages <inline|deferred>, "
+                                             "and reset the statistics",
+                                             cmd_dlog_mode, 2, 0),
+                               SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(dlog, &sub_dlog, "Deferred log", NULL);
+#endif // CONFIG_SHELL
+
+} // namespace deferred_log
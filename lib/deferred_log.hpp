@@ -0,0 +1,76 @@
+#ifndef __DEFERRED_LOG_HPP__
+#define __DEFERRED_LOG_HPP__
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <zephyr/kernel.h>
+
+/// @brief Logging facade for callback contexts (USB stack, BT host, ISRs).
+///        The callback only captures the raw arguments of the message (enum values, addresses,
+///        error codes) into a preallocated queue, the formatting function is called later
+///        by a low priority thread. Without CONFIG_DEMO_DEFERRED_LOG the message is formatted
+///        in place, as with a plain LOG_INF.
+///        The formatting function is defined next to the caller, so it logs to its module.
+namespace deferred_log
+{
+static constexpr std::size_t args_size = 16;
+
+struct record
+{
+    void (*format)(const void* args);
+    uint32_t timestamp; // k_cycle_get_32()
+    alignas(4) uint8_t args[args_size];
+};
+
+#if CONFIG_DEMO_DEFERRED_LOG
+/// @brief Queues a record, or formats it in place in inline mode.
+/// @return false if the queue is full, and the message is dropped
+bool post(const record& r);
+#endif
+
+template <typename T, auto FORMAT>
+void invoke(const void* args)
+{
+    // T may have no default constructor, the copy starts its lifetime
+    alignas(T) uint8_t copy[sizeof(T)];
+    std::memcpy(copy, args, sizeof(T));
+    FORMAT(*std::launder(reinterpret_cast<const T*>(copy)));
+}
+
+/// @brief Logs a message, formatted by FORMAT from @p args, outside of the caller's context.
+/// @tparam FORMAT function taking const T&, which calls the LOG_ macros
+template <auto FORMAT, typename T>
+inline void log(const T& args)
+{
+    static_assert(std::is_trivially_copyable_v<T> and (sizeof(T) <= args_size),
+                  "the arguments must be raw values");
+#if CONFIG_DEMO_DEFERRED_LOG
+    record r{&invoke<T, FORMAT>, k_cycle_get_32(), {}};
+    std::memcpy(r.args, &args, sizeof(T));
+    post(r);
+#else
+    FORMAT(args);
+#endif
+}
+
+/// @brief The USB device state of a power event, for the USB applications' delegates.
+struct usb_state
+{
+    uint32_t granted_uA;
+    uint8_t power_state;
+    bool configuration_change;
+    bool configured;
+
+    template <typename DEVICE, typename EVENT>
+    static usb_state capture(DEVICE& dev, EVENT ev)
+    {
+        return {dev.granted_bus_current_uA(), static_cast<uint8_t>(dev.power_state()),
+                ev == EVENT::CONFIGURATION_CHANGE, dev.configured()};
+    }
+};
+
+} // namespace deferred_log
+
+#endif // __DEFERRED_LOG_HPP__
@@ -0,0 +1,47 @@
+#ifndef __DEMO_KEYMAP_HPP__
+#define __DEMO_KEYMAP_HPP__
+#include <array>
+#include <keymap.hpp>
+#include <span>
+#include <zephyr/dt-bindings/input/input-event-codes.h>
+#include <zephyr/kernel.h>
+
+namespace demo
+{
+using usage = hid::page::keyboard_keypad;
+
+// the board buttons, or the emulated key matrix on native_sim
+inline constexpr std::array<uint16_t, 4> keymap_codes{INPUT_KEY_0, INPUT_KEY_1, INPUT_KEY_2,
+                                                      INPUT_KEY_3};
+
+// clang-format off
+inline constexpr std::array<std::array<keymap::action, 4>, 2> keymap_layers{{
+    // base layer: caps lock, enter when tapped / layer 1 while held, macro, layer 1 toggle
+    {keymap::key(usage::KEYBOARD_CAPS_LOCK), keymap::layer_tap(usage::KEYBOARD_ENTER, 1),
+     keymap::macro(0),                       keymap::toggle(1)},
+    // layer 1: F1 on the caps lock key
+    {keymap::key(usage::KEYBOARD_F1),        keymap::transparent(),
+     keymap::transparent(),                  keymap::transparent()},
+}};
+// clang-format on
+
+inline constexpr auto keymap_table = keymap::make_table(keymap_codes, keymap_layers);
+static_assert(keymap_table.valid);
+
+inline constexpr std::array macro_f1_enter{keymap::tap(usage::KEYBOARD_F1), keymap::delay_ms(100),
+                                           keymap::tap(usage::KEYBOARD_ENTER)};
+inline constexpr std::array<std::span<const keymap::step>, 1> keymap_macros{macro_f1_enter};
+
+using keymap_type = keymap::engine<decltype(keymap_table)>;
+
+/// @brief The demo keymap engine, timed in k_cycle_get_32() ticks.
+inline keymap_type make_keymap()
+{
+    return keymap_type{keymap_table, keymap_macros, k_ms_to_cyc_ceil32(1),
+                       CONFIG_DEMO_KEYMAP_TAPPING_TERM_MS,
+                       k_us_to_cyc_ceil32(CONFIG_DEMO_KEYMAP_REPORT_GAP_US)};
+}
+
+} // namespace demo
+
+#endif // __DEMO_KEYMAP_HPP__
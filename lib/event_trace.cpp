@@ -0,0 +1,83 @@
+#include <event_trace.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+#if CONFIG_TIMING_FUNCTIONS
+#include <zephyr/timing/timing.h>
+#endif
+
+extern "C"
+{
+    static_assert((CONFIG_DEMO_EVENT_TRACE_SIZE & (CONFIG_DEMO_EVENT_TRACE_SIZE - 1)) == 0,
+                  "CONFIG_DEMO_EVENT_TRACE_SIZE must be a power of 2");
+
+    struct event_trace_ring event_trace_buffer;
+
+#if CONFIG_SHELL
+    /// @brief Prints the ring from the oldest record, in the format that
+    ///        scripts/event_trace.py converts to a Perfetto trace.
+    static int cmd_trace_dump(const shell* sh, size_t argc, char** argv)
+    {
+        auto head = static_cast<uint32_t>(atomic_get(&event_trace_buffer.head));
+        auto count = MIN(head, static_cast<uint32_t>(CONFIG_DEMO_EVENT_TRACE_SIZE));
+        shell_print(sh, "trace begin: %u Hz, %u records, %u lost", sys_clock_hw_cycles_per_sec(),
+                    count, head - count);
+        for (auto i = head - count; i != head; i++)
+        {
+            const auto& r = event_trace_buffer.records[i & (CONFIG_DEMO_EVENT_TRACE_SIZE - 1)];
+            shell_print(sh, "trace %08x %u %04x", r.timestamp, r.id, r.arg);
+        }
+        shell_print(sh, "trace end");
+        return 0;
+    }
+
+    static int cmd_trace_clear(const shell* sh, size_t argc, char** argv)
+    {
+        atomic_set(&event_trace_buffer.head, 0);
+        return 0;
+    }
+
+    /// @brief Measures the cost of a probe, the ring is cleared afterwards.
+    static int cmd_trace_probe(const shell* sh, size_t argc, char** argv)
+    {
+        static constexpr uint32_t probes = 1000;
+#if CONFIG_TIMING_FUNCTIONS
+        // the CPU cycle counter, the system timer may be too coarse,
+        // left running afterwards, as the deferred log measures with it as well
+        timing_init();
+        timing_start();
+        auto key = irq_lock();
+        auto start = timing_counter_get();
+        for (uint32_t i = 0; i < probes; i++)
+        {
+            event_trace(EVENT_TRACE_INPUT_EDGE, i);
+        }
+        auto end = timing_counter_get();
+        irq_unlock(key);
+        auto cycles = timing_cycles_get(&start, &end);
+        auto ns = timing_cycles_to_ns(cycles);
+#else
+        auto key = irq_lock();
+        auto start = k_cycle_get_32();
+        for (uint32_t i = 0; i < probes; i++)
+        {
+            event_trace(EVENT_TRACE_INPUT_EDGE, i);
+        }
+        uint64_t cycles = k_cycle_get_32() - start;
+        irq_unlock(key);
+        auto ns = k_cyc_to_ns_floor64(cycles);
+#endif
+        atomic_set(&event_trace_buffer.head, 0);
+        shell_print(sh, "probe: %u.%03u cycles, %u ns", static_cast<uint32_t>(cycles / probes),
+                    static_cast<uint32_t>(cycles % probes), static_cast<uint32_t>(ns / probes));
+        return 0;
+    }
+
+    SHELL_STATIC_SUBCMD_SET_CREATE(sub_trace,
+                                   SHELL_CMD(dump, NULL, "Print the trace records", cmd_trace_dump),
+                                   SHELL_CMD(clear, NULL, "Drop the trace records", cmd_trace_clear),
+                                   SHELL_CMD(probe, NULL, "Measure the cost of a trace probe",
+                                             cmd_trace_probe),
+                                   SHELL_SUBCMD_SET_END);
+    SHELL_CMD_REGISTER(trace, &sub_trace, "Event trace", NULL);
+#endif // CONFIG_SHELL
+}
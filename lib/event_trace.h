@@ -0,0 +1,63 @@
+#ifndef __EVENT_TRACE_H__
+#define __EVENT_TRACE_H__
+#include <stdint.h>
+#if CONFIG_DEMO_EVENT_TRACE
+#include <zephyr/kernel.h>
+#include <zephyr/sys/atomic.h>
+#endif
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+    /** @brief The traced event types, the meaning of the argument is given for each. */
+    enum event_trace_id
+    {
+        EVENT_TRACE_INPUT_EDGE = 1,  /**< input code, bit 15 set on press */
+        EVENT_TRACE_QUEUE_POST = 2,  /**< input code */
+        EVENT_TRACE_QUEUE_GET = 3,   /**< input code */
+        EVENT_TRACE_REPORT_SEND = 4, /**< report size */
+        EVENT_TRACE_REPORT_SENT = 5, /**< report size, at endpoint or notification completion */
+        EVENT_TRACE_POWER_STATE = 6, /**< the new USB power state */
+        EVENT_TRACE_BLE_NOTIFY = 7,  /**< key to notification completion latency [us] */
+    };
+
+#if CONFIG_DEMO_EVENT_TRACE
+    struct event_trace_record
+    {
+        uint32_t timestamp; /**< k_cycle_get_32() */
+        uint16_t id;
+        uint16_t arg;
+    };
+
+    struct event_trace_ring
+    {
+        atomic_t head;
+        struct event_trace_record records[CONFIG_DEMO_EVENT_TRACE_SIZE];
+    };
+
+    extern struct event_trace_ring event_trace_buffer;
+
+    /**
+     * @brief Records an event, overwriting the oldest one when the ring is full.
+     *        Lock-free and safe to call from any context, including ISRs.
+     */
+    static inline void event_trace(enum event_trace_id id, uint16_t arg)
+    {
+        uint32_t index = (uint32_t)atomic_inc(&event_trace_buffer.head);
+        struct event_trace_record* record =
+            &event_trace_buffer.records[index & (CONFIG_DEMO_EVENT_TRACE_SIZE - 1)];
+        record->timestamp = k_cycle_get_32();
+        record->id = (uint16_t)id;
+        record->arg = arg;
+    }
+#else
+    static inline void event_trace(enum event_trace_id id, uint16_t arg) {}
+#endif
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif // __EVENT_TRACE_H__
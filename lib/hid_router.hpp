@@ -0,0 +1,299 @@
+#ifndef __HID_ROUTER_HPP__
+#define __HID_ROUTER_HPP__
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <zephyr/kernel.h>
+
+#include <hid/application.hpp>
+
+/// @brief Serves a single HID application over multiple transports (e.g. USB and BLE).
+///        Each transport serves one of the router's ports, while the application is
+///        served by the router. The input reports are passed without copying to the
+///        active port: the lowest indexed one that is both started by its transport
+///        and enabled by the user (e.g. on VBUS and configuration events).
+///        When the active port changes, the application is restarted on the new one,
+///        which is expected to keep its input state, and send it on the new port right away.
+///        The output reports of all started ports are merged with a bitwise OR,
+///        which suits LED bitmaps, each port receives them into its own buffer.
+/// @tparam PORTS the number of transports
+/// @tparam OUT_SIZE the size of the largest output report
+template <std::size_t PORTS = 2, std::size_t OUT_SIZE = 8>
+class hid_router : public hid::transport
+{
+  public:
+    /// @brief The application that a transport serves.
+    class port : public hid::application
+    {
+      public:
+        port(hid_router& router, const hid::report_protocol& rp)
+            : hid::application(rp), router_(router)
+        {}
+
+        void start(hid::protocol prot) override { router_.port_started(*this, prot); }
+        void stop() override { router_.port_stopped(*this); }
+        void set_report(hid::report::type type, const std::span<const uint8_t>& data) override
+        {
+            router_.port_set_report(*this, type, data);
+        }
+        void get_report(hid::report::selector select, const std::span<uint8_t>& buffer) override
+        {
+            router_.port_get_report(*this, select, buffer);
+        }
+        void in_report_sent(const std::span<const uint8_t>& data) override
+        {
+            router_.port_report_sent(*this, data);
+        }
+        hid::protocol get_protocol() const override { return prot_; }
+
+      private:
+        friend class hid_router;
+
+        hid_router& router_;
+        alignas(4) std::array<uint8_t, OUT_SIZE> out_buffer_{};
+        std::array<uint8_t, OUT_SIZE> out_report_{};
+        hid::protocol prot_{};
+        bool started_{};
+        bool enabled_{true};
+        bool armed_{};
+    };
+
+    struct statistics
+    {
+        uint32_t switches;
+        uint32_t last_failover_us; // from the event until the state is re-sent on the new port
+        uint32_t max_failover_us;
+    };
+
+    hid_router(hid::application& app, const hid::report_protocol& rp)
+        : ports_(make_ports(*this, rp, std::make_index_sequence<PORTS>())), app_(app)
+    {
+        k_mutex_init(&mutex_);
+    }
+
+    port& operator[](std::size_t index) { return ports_[index]; }
+
+    /// @brief Allows or forbids routing to a port, e.g. when the USB cable is pulled,
+    ///        before its transport stops.
+    /// @param event_time the cycle count of the (power) event, the failover is measured from
+    void enable(std::size_t index, bool enabled, uint32_t event_time = k_cycle_get_32())
+    {
+        k_mutex_lock(&mutex_, K_FOREVER);
+        ports_[index].enabled_ = enabled;
+        update(nullptr, event_time);
+        k_mutex_unlock(&mutex_);
+    }
+
+    /// @return the index of the active port, or PORTS if none is active
+    std::size_t active_index() const
+    {
+        auto* active = active_.load();
+        return (active != nullptr) ? (active - ports_.data()) : PORTS;
+    }
+
+    statistics stats()
+    {
+        k_mutex_lock(&mutex_, K_FOREVER);
+        auto stats = stats_;
+        k_mutex_unlock(&mutex_);
+        return stats;
+    }
+
+    hid::result send_report(const std::span<const uint8_t>& data, hid::report::type type) override
+    {
+        // GET_REPORT is answered on the requesting port, even if it's inactive
+        auto* p = (k_current_get() == reply_thread_) ? reply_port_ : active_.load();
+        if (p == nullptr)
+        {
+            return hid::result::NO_CONNECTION;
+        }
+        return p->send_report(data, type);
+    }
+
+    hid::result receive_report(const std::span<uint8_t>& data, hid::report::type type) override
+    {
+        if (type != hid::report::type::OUTPUT)
+        {
+            auto* p = active_.load();
+            return (p != nullptr) ? p->receive_report(data, type) : hid::result::NO_CONNECTION;
+        }
+        k_mutex_lock(&mutex_, K_FOREVER);
+        out_size_ = std::min(data.size(), OUT_SIZE);
+        for (auto& p : ports_)
+        {
+            arm(p);
+        }
+        k_mutex_unlock(&mutex_);
+        return hid::result::OK;
+    }
+
+  private:
+    template <std::size_t... I>
+    static std::array<port, PORTS> make_ports(hid_router& router, const hid::report_protocol& rp,
+                                              std::index_sequence<I...>)
+    {
+        return {{((void)I, port{router, rp})...}};
+    }
+
+    /// @brief Lets the port receive output reports, must be called locked.
+    void arm(port& p)
+    {
+        if (!p.started_ or p.armed_ or (out_size_ == 0))
+        {
+            return;
+        }
+        p.armed_ = p.receive_report(std::span<uint8_t>(p.out_buffer_.data(), out_size_)) ==
+                   hid::result::OK;
+    }
+
+    /// @brief Merges the output reports of the started ports, must be called locked.
+    std::array<uint8_t, OUT_SIZE> merged_out_report() const
+    {
+        std::array<uint8_t, OUT_SIZE> merged{};
+        for (auto& p : ports_)
+        {
+            if (!p.started_)
+            {
+                continue;
+            }
+            for (std::size_t i = 0; i < OUT_SIZE; i++)
+            {
+                merged[i] |= p.out_report_[i];
+            }
+        }
+        return merged;
+    }
+
+    /// @brief Selects the active port, and moves the application to it, must be called locked.
+    /// @param restart the port whose protocol changed, the application restarts if it's active
+    /// @param event_time the cycle count of the event that caused the update
+    void update(port* restart, uint32_t event_time = k_cycle_get_32())
+    {
+        port* next = nullptr;
+        for (auto& p : ports_)
+        {
+            if (p.started_ and p.enabled_)
+            {
+                next = &p;
+                break;
+            }
+        }
+        auto* prev = active_.load();
+        if ((next == prev) and ((restart == nullptr) or (restart != prev)))
+        {
+            return;
+        }
+        if (prev != nullptr)
+        {
+            app_.teardown(this);
+        }
+        active_.store(next);
+        if (next == nullptr)
+        {
+            return;
+        }
+        if (next != prev)
+        {
+            stats_.switches++;
+            switch_time_ = event_time;
+            // the first completion on the new port is the state the application re-sends
+            awaiting_report_ = (prev != nullptr);
+        }
+        app_.setup(this, next->prot_);
+    }
+
+    void port_started(port& p, hid::protocol prot)
+    {
+        k_mutex_lock(&mutex_, K_FOREVER);
+        bool restart = p.started_;
+        p.prot_ = prot;
+        p.started_ = true;
+        p.armed_ = false;
+        arm(p);
+        update(restart ? &p : nullptr);
+        k_mutex_unlock(&mutex_);
+    }
+
+    void port_stopped(port& p)
+    {
+        k_mutex_lock(&mutex_, K_FOREVER);
+        p.started_ = false;
+        p.armed_ = false;
+        p.out_report_ = {};
+        auto merged = merged_out_report();
+        auto size = out_size_;
+        update(nullptr);
+        k_mutex_unlock(&mutex_);
+        if (size > 0)
+        {
+            // the LEDs only show the state of the remaining hosts
+            app_.set_report(hid::report::type::OUTPUT,
+                            std::span<const uint8_t>(merged.data(), size));
+        }
+    }
+
+    void port_set_report(port& p, hid::report::type type, const std::span<const uint8_t>& data)
+    {
+        if (type != hid::report::type::OUTPUT)
+        {
+            if (&p == active_.load())
+            {
+                app_.set_report(type, data);
+            }
+            return;
+        }
+        k_mutex_lock(&mutex_, K_FOREVER);
+        p.armed_ = false;
+        auto size = std::min(data.size(), OUT_SIZE);
+        std::memcpy(p.out_report_.data(), data.data(), size);
+        auto merged = merged_out_report();
+        k_mutex_unlock(&mutex_);
+        // the application re-arms the reception
+        app_.set_report(type, std::span<const uint8_t>(merged.data(), size));
+    }
+
+    void port_get_report(port& p, hid::report::selector select, const std::span<uint8_t>& buffer)
+    {
+        k_mutex_lock(&mutex_, K_FOREVER);
+        reply_port_ = &p;
+        reply_thread_ = k_current_get();
+        app_.get_report(select, buffer);
+        reply_thread_ = nullptr;
+        k_mutex_unlock(&mutex_);
+    }
+
+    void port_report_sent(port& p, const std::span<const uint8_t>& data)
+    {
+        if (&p != active_.load())
+        {
+            // completed after switching away from the port
+            return;
+        }
+        if (awaiting_report_)
+        {
+            awaiting_report_ = false;
+            auto failover_us = k_cyc_to_us_floor32(k_cycle_get_32() - switch_time_);
+            k_mutex_lock(&mutex_, K_FOREVER);
+            stats_.last_failover_us = failover_us;
+            stats_.max_failover_us = std::max(stats_.max_failover_us, failover_us);
+            k_mutex_unlock(&mutex_);
+        }
+        app_.in_report_sent(data);
+    }
+
+    std::array<port, PORTS> ports_;
+    hid::application& app_;
+    std::atomic<port*> active_{};
+    port* reply_port_{};
+    k_tid_t reply_thread_{};
+    k_mutex mutex_{};
+    statistics stats_{};
+    std::size_t out_size_{};
+    uint32_t switch_time_{};
+    std::atomic<bool> awaiting_report_{};
+};
+
+#endif // __HID_ROUTER_HPP__
@@ -0,0 +1,253 @@
+#ifndef __KEY_EVENT_RING_HPP__
+#define __KEY_EVENT_RING_HPP__
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <event_trace.h>
+#include <optional>
+#include <zephyr/kernel.h>
+
+/// @brief Key state change, timestamped when captured in the input callback.
+struct key_event
+{
+    uint32_t timestamp; // k_cycle_get_32()
+    uint16_t code;
+    int32_t value;
+};
+
+/// @brief Lock-free single-producer / single-consumer ring buffer.
+///        Pushing never blocks, a full ring drops the new item and counts it.
+///        The peak occupancy is tracked, to size the ring.
+template <typename T, std::size_t SIZE>
+class spsc_ring
+{
+    static_assert((SIZE > 0) and ((SIZE & (SIZE - 1)) == 0), "SIZE must be a power of 2");
+
+  public:
+    constexpr spsc_ring() = default;
+
+    bool try_push(const T& item)
+    {
+        auto head = head_.load(std::memory_order_relaxed);
+        auto used = head - tail_.load(std::memory_order_acquire);
+        if (used == SIZE)
+        {
+            drops_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        items_[head % SIZE] = item;
+        head_.store(head + 1, std::memory_order_release);
+        // only the producer writes it
+        if (used >= peak_.load(std::memory_order_relaxed))
+        {
+            peak_.store(used + 1, std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    const T* peek() const
+    {
+        auto tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+        {
+            return nullptr;
+        }
+        return &items_[tail % SIZE];
+    }
+
+    std::optional<T> try_pop()
+    {
+        auto* item = peek();
+        if (item == nullptr)
+        {
+            return std::nullopt;
+        }
+        T copy = *item;
+        tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        return copy;
+    }
+
+    std::size_t size() const
+    {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    static constexpr std::size_t capacity() { return SIZE; }
+    uint32_t drops() const { return drops_.load(std::memory_order_relaxed); }
+    uint32_t peak() const { return peak_.load(std::memory_order_relaxed); }
+
+  private:
+    std::array<T, SIZE> items_{};
+    std::atomic<uint32_t> head_{};
+    std::atomic<uint32_t> tail_{};
+    std::atomic<uint32_t> drops_{};
+    std::atomic<uint32_t> peak_{};
+};
+
+/// @brief Set of key changes that are sent to the host in a single report.
+///        Each key code can only change once in a batch, otherwise a press and release
+///        would cancel each other out, and the host would miss the keystroke.
+template <std::size_t SIZE>
+class key_batch
+{
+  public:
+    /// @return false if the key has already changed in this batch, flush it first
+    bool add(const key_event& evt)
+    {
+        if (full() or contains(evt.code))
+        {
+            return false;
+        }
+        events_[count_++] = evt;
+        return true;
+    }
+    bool contains(uint16_t code) const
+    {
+        for (auto& evt : *this)
+        {
+            if (evt.code == code)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    void clear() { count_ = 0; }
+    bool empty() const { return count_ == 0; }
+    bool full() const { return count_ == SIZE; }
+    std::size_t size() const { return count_; }
+    const key_event* begin() const { return events_.data(); }
+    const key_event* end() const { return events_.data() + count_; }
+    /// @brief The capture time of the earliest event, which defines the batch latency.
+    uint32_t oldest_timestamp() const { return events_[0].timestamp; }
+
+  private:
+    std::array<key_event, SIZE> events_{};
+    std::size_t count_{};
+};
+
+/// @brief Timestamped key event queue, between the input subsystem and an application thread.
+///        The ring has a single consumer, the posting contexts (e.g. the input thread and
+///        a work item) are serialized by a spinlock, so posting is safe from any context,
+///        including interrupts, and never blocks.
+template <std::size_t SIZE>
+class key_event_queue
+{
+  public:
+    key_event_queue() { k_sem_init(&sem_, 0, 1); }
+
+    bool post(uint16_t code, int32_t value) { return post(code, value, k_cycle_get_32()); }
+
+    bool post(uint16_t code, int32_t value, uint32_t timestamp)
+    {
+        auto key_lock = k_spin_lock(&post_lock_);
+        bool pushed = ring_.try_push(key_event{timestamp, code, value});
+        k_spin_unlock(&post_lock_, key_lock);
+        if (!pushed)
+        {
+            return false;
+        }
+        event_trace(EVENT_TRACE_QUEUE_POST, code);
+        k_sem_give(&sem_);
+        return true;
+    }
+
+    /// @brief Blocks until an event is available.
+    key_event get()
+    {
+        while (true)
+        {
+            if (auto evt = ring_.try_pop(); evt)
+            {
+                event_trace(EVENT_TRACE_QUEUE_GET, evt->code);
+                return *evt;
+            }
+            k_sem_take(&sem_, K_FOREVER);
+        }
+    }
+
+    /// @brief Blocks until an event is available, or the deadline passes.
+    /// @param deadline in k_cycle_get_32() ticks
+    std::optional<key_event> get_until(uint32_t deadline)
+    {
+        while (true)
+        {
+            if (auto evt = ring_.try_pop(); evt)
+            {
+                event_trace(EVENT_TRACE_QUEUE_GET, evt->code);
+                return evt;
+            }
+            auto remaining = static_cast<int32_t>(deadline - k_cycle_get_32());
+            if ((remaining <= 0) or (k_sem_take(&sem_, K_CYC(remaining)) != 0))
+            {
+                return std::nullopt;
+            }
+        }
+    }
+
+    /// @brief Dequeues the next event only if it was captured before the deadline.
+    std::optional<key_event> try_get_before(uint32_t deadline)
+    {
+        auto* evt = ring_.peek();
+        if ((evt == nullptr) or (static_cast<int32_t>(evt->timestamp - deadline) >= 0))
+        {
+            return std::nullopt;
+        }
+        event_trace(EVENT_TRACE_QUEUE_GET, evt->code);
+        return ring_.try_pop();
+    }
+
+    /// @brief Collects the events that are already queued after @ref first. While the
+    ///        transport is busy, the report couldn't be sent anyway, so it keeps collecting
+    ///        until a transfer completes or the coalescing window that starts at @ref first
+    ///        elapses. An idle transport gets the first edge without delay.
+    /// @param busy returns true while a new report would wait for a transfer in flight,
+    ///        the transfer completion must call @ref notify
+    /// @return the event that didn't fit in the batch, it starts the next one
+    template <std::size_t BATCH_SIZE, typename TBusy>
+    std::optional<key_event> collect(const key_event& first, uint32_t window_cycles,
+                                     key_batch<BATCH_SIZE>& batch, TBusy&& busy)
+    {
+        const uint32_t window_end = first.timestamp + window_cycles;
+        batch.clear();
+        batch.add(first);
+
+        while (true)
+        {
+            while (auto evt = try_get_before(window_end))
+            {
+                if (!batch.add(*evt))
+                {
+                    return evt;
+                }
+                coalesced_++;
+            }
+            auto remaining = static_cast<int32_t>(window_end - k_cycle_get_32());
+            if (!busy() or (remaining <= 0))
+            {
+                return std::nullopt;
+            }
+            // woken by a new event, or by the transfer completion
+            k_sem_take(&sem_, K_CYC(remaining));
+        }
+    }
+
+    /// @brief Wakes up @ref collect, when the transport completed a transfer.
+    void notify() { k_sem_give(&sem_); }
+
+    bool empty() const { return ring_.empty(); }
+    uint32_t drops() const { return ring_.drops(); }
+    uint32_t coalesced() const { return coalesced_; }
+    /// @brief The highest number of events waiting in the queue.
+    uint32_t peak() const { return ring_.peak(); }
+    static constexpr std::size_t capacity() { return SIZE; }
+
+  private:
+    spsc_ring<key_event, SIZE> ring_{};
+    k_spinlock post_lock_{};
+    k_sem sem_;
+    uint32_t coalesced_{};
+};
+
+#endif // __KEY_EVENT_RING_HPP__
@@ -0,0 +1,320 @@
+#include <key_matrix.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/input/input.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#if CONFIG_DEMO_KEY_MATRIX_EMUL
+#include <zephyr/drivers/gpio/gpio_emul.h>
+#include <zephyr/shell/shell.h>
+#endif
+
+LOG_MODULE_REGISTER(key_matrix, LOG_LEVEL_INF);
+
+#define DT_DRV_COMPAT c2usb_key_matrix
+
+extern "C"
+{
+    // debounce time measured in scans, stored as a 4-bit counter per key
+    static constexpr uint8_t DEBOUNCE_SCANS = DIV_ROUND_UP(CONFIG_DEMO_KEY_MATRIX_DEBOUNCE_US,
+                                                           CONFIG_DEMO_KEY_MATRIX_SCAN_PERIOD_US);
+    BUILD_ASSERT(DEBOUNCE_SCANS <= 0xf, "Debounce time is too long for the scan period");
+
+    struct key_matrix_config
+    {
+        const struct gpio_dt_spec* rows;
+        const struct gpio_dt_spec* cols;
+        const uint16_t* codes;
+        uint8_t row_count;
+        uint8_t col_count;
+        uint16_t settle_time_us;
+        k_thread_stack_t* stack;
+        size_t stack_size;
+    };
+
+    struct key_matrix_data
+    {
+        struct k_thread thread;
+        // the debounced key states, one word per row
+        uint32_t* stable;
+        // the keys with a running debounce counter, one word per row
+        uint32_t* debouncing;
+        // the debounce counters, packed in nibbles, in row-major key order
+        uint8_t* counters;
+#if CONFIG_DEMO_KEY_MATRIX_EMUL
+        uint32_t* emul_pressed;
+#endif
+        uint32_t edge_timestamp;
+    };
+
+    static uint8_t get_counter(const uint8_t* counters, size_t key)
+    {
+        return (counters[key / 2] >> ((key % 2) * 4)) & 0xf;
+    }
+
+    static void set_counter(uint8_t* counters, size_t key, uint8_t value)
+    {
+        auto shift = (key % 2) * 4;
+        counters[key / 2] = (counters[key / 2] & ~(0xf << shift)) | (value << shift);
+    }
+
+    static void report_edge(const struct device* dev, size_t key, bool pressed, uint32_t timestamp)
+    {
+        auto* cfg = static_cast<const key_matrix_config*>(dev->config);
+        auto* data = static_cast<key_matrix_data*>(dev->data);
+
+        data->edge_timestamp = timestamp;
+        input_report_key(dev, cfg->codes[key], pressed, true, K_FOREVER);
+    }
+
+    /// @brief Runs the per-key debounce state machines of a row.
+    ///        Eager mode reports the first edge immediately, then ignores changes
+    ///        for the debounce time. Deferred mode reports an edge once the new state
+    ///        has been stable for the debounce time.
+    static void debounce_row(const struct device* dev, uint8_t row, uint32_t sample,
+                             uint32_t timestamp)
+    {
+        auto* cfg = static_cast<const key_matrix_config*>(dev->config);
+        auto* data = static_cast<key_matrix_data*>(dev->data);
+        uint32_t changed = sample ^ data->stable[row];
+
+        if ((changed | data->debouncing[row]) == 0)
+        {
+            return;
+        }
+        for (uint8_t col = 0; col < cfg->col_count; col++)
+        {
+            const uint32_t mask = BIT(col);
+            if (((changed | data->debouncing[row]) & mask) == 0)
+            {
+                continue;
+            }
+            const size_t key = row * cfg->col_count + col;
+            uint8_t counter = get_counter(data->counters, key);
+
+            if (IS_ENABLED(CONFIG_DEMO_KEY_MATRIX_DEBOUNCE_EAGER))
+            {
+                if (counter > 0)
+                {
+                    counter--;
+                }
+                else if (changed & mask)
+                {
+                    data->stable[row] ^= mask;
+                    report_edge(dev, key, sample & mask, timestamp);
+                    counter = DEBOUNCE_SCANS;
+                }
+            }
+            else
+            {
+                if ((changed & mask) == 0)
+                {
+                    counter = 0;
+                }
+                else if (++counter >= DEBOUNCE_SCANS)
+                {
+                    data->stable[row] ^= mask;
+                    report_edge(dev, key, sample & mask, timestamp);
+                    counter = 0;
+                }
+            }
+            set_counter(data->counters, key, counter);
+            WRITE_BIT(data->debouncing[row], col, counter > 0);
+        }
+    }
+
+    static void scan(const struct device* dev)
+    {
+        auto* cfg = static_cast<const key_matrix_config*>(dev->config);
+
+        for (uint8_t row = 0; row < cfg->row_count; row++)
+        {
+            gpio_pin_set_dt(&cfg->rows[row], true);
+#if CONFIG_DEMO_KEY_MATRIX_EMUL
+            key_matrix_emul_select_row(dev, row);
+#endif
+            if (cfg->settle_time_us > 0)
+            {
+                k_busy_wait(cfg->settle_time_us);
+            }
+            const uint32_t timestamp = k_cycle_get_32();
+            uint32_t sample = 0;
+            for (uint8_t col = 0; col < cfg->col_count; col++)
+            {
+                if (gpio_pin_get_dt(&cfg->cols[col]) > 0)
+                {
+                    sample |= BIT(col);
+                }
+            }
+            gpio_pin_set_dt(&cfg->rows[row], false);
+
+            debounce_row(dev, row, sample, timestamp);
+        }
+    }
+
+    static void key_matrix_thread(void* p1, void*, void*)
+    {
+        auto* dev = static_cast<const struct device*>(p1);
+        const k_ticks_t period = k_us_to_ticks_ceil64(CONFIG_DEMO_KEY_MATRIX_SCAN_PERIOD_US);
+        k_ticks_t next = k_uptime_ticks();
+
+        while (true)
+        {
+            scan(dev);
+            // absolute deadlines keep the scan rate free of drift
+            next += period;
+            k_sleep(K_TIMEOUT_ABS_TICKS(next));
+        }
+    }
+
+    static int key_matrix_init(const struct device* dev)
+    {
+        auto* cfg = static_cast<const key_matrix_config*>(dev->config);
+        auto* data = static_cast<key_matrix_data*>(dev->data);
+        int err;
+
+        for (uint8_t i = 0; i < cfg->row_count; i++)
+        {
+            err = gpio_pin_configure_dt(&cfg->rows[i], GPIO_OUTPUT_INACTIVE);
+            if (err)
+            {
+                LOG_ERR("Cannot configure row %u gpio (err %d)", i, err);
+                return err;
+            }
+        }
+        for (uint8_t i = 0; i < cfg->col_count; i++)
+        {
+            err = gpio_pin_configure_dt(&cfg->cols[i], GPIO_INPUT);
+            if (err)
+            {
+                LOG_ERR("Cannot configure column %u gpio (err %d)", i, err);
+                return err;
+            }
+        }
+
+        k_thread_create(&data->thread, cfg->stack, cfg->stack_size, key_matrix_thread,
+                        const_cast<struct device*>(dev), nullptr, nullptr,
+                        CONFIG_DEMO_KEY_MATRIX_THREAD_PRIORITY, 0, K_NO_WAIT);
+        k_thread_name_set(&data->thread, dev->name);
+        return 0;
+    }
+
+#define KEY_MATRIX_DEVICE_AND_COMMA(n) DEVICE_DT_INST_GET(n),
+
+    static const struct device* const matrices[] = {
+        DT_INST_FOREACH_STATUS_OKAY(KEY_MATRIX_DEVICE_AND_COMMA)};
+
+    bool key_matrix_edge_timestamp(const struct device* dev, uint32_t* timestamp)
+    {
+        for (auto* matrix : matrices)
+        {
+            if (matrix == dev)
+            {
+                *timestamp = static_cast<key_matrix_data*>(dev->data)->edge_timestamp;
+                return true;
+            }
+        }
+        return false;
+    }
+
+#if CONFIG_DEMO_KEY_MATRIX_EMUL
+    int key_matrix_emul_set_key(const struct device* dev, uint8_t row, uint8_t col, bool pressed)
+    {
+        auto* cfg = static_cast<const key_matrix_config*>(dev->config);
+        auto* data = static_cast<key_matrix_data*>(dev->data);
+
+        if ((row >= cfg->row_count) or (col >= cfg->col_count))
+        {
+            return -EINVAL;
+        }
+        WRITE_BIT(data->emul_pressed[row], col, pressed);
+        return 0;
+    }
+
+    void key_matrix_emul_select_row(const struct device* dev, uint8_t row)
+    {
+        auto* cfg = static_cast<const key_matrix_config*>(dev->config);
+        auto* data = static_cast<key_matrix_data*>(dev->data);
+
+        for (uint8_t col = 0; col < cfg->col_count; col++)
+        {
+            const bool active = data->emul_pressed[row] & BIT(col);
+            const bool active_low = cfg->cols[col].dt_flags & GPIO_ACTIVE_LOW;
+            gpio_emul_input_set(cfg->cols[col].port, cfg->cols[col].pin, active != active_low);
+        }
+    }
+
+#if CONFIG_SHELL
+    static int cmd_matrix_key(const shell* sh, size_t argc, char** argv)
+    {
+        int err = 0;
+        auto row = shell_strtoul(argv[1], 10, &err);
+        auto col = shell_strtoul(argv[2], 10, &err);
+        auto pressed = shell_strtobool(argv[3], 10, &err);
+        if (err or (ARRAY_SIZE(matrices) == 0))
+        {
+            shell_error(sh, "Invalid arguments %d", err);
+            return -EINVAL;
+        }
+        err = key_matrix_emul_set_key(matrices[0], row, col, pressed);
+        if (err)
+        {
+            shell_error(sh, "Invalid key %lu:%lu", row, col);
+        }
+        return err;
+    }
+
+    SHELL_STATIC_SUBCMD_SET_CREATE(sub_matrix,
+                                   SHELL_CMD_ARG(key, NULL, "Set emulated key <row> <col> <on|off>",
+                                                 cmd_matrix_key, 4, 0),
+                                   SHELL_SUBCMD_SET_END);
+    SHELL_CMD_REGISTER(matrix, &sub_matrix, "Emulated key matrix", NULL);
+#endif // CONFIG_SHELL
+#endif // CONFIG_DEMO_KEY_MATRIX_EMUL
+
+#define GPIO_SPEC_AND_COMMA(node_id, prop, idx) GPIO_DT_SPEC_GET_BY_IDX(node_id, prop, idx),
+
+#if CONFIG_DEMO_KEY_MATRIX_EMUL
+#define KEY_MATRIX_EMUL_DATA(n) static uint32_t key_matrix_emul_pressed_##n[ROW_COUNT(n)];
+#define KEY_MATRIX_EMUL_INIT(n) .emul_pressed = key_matrix_emul_pressed_##n,
+#else
+#define KEY_MATRIX_EMUL_DATA(n)
+#define KEY_MATRIX_EMUL_INIT(n)
+#endif
+
+#define ROW_COUNT(n) DT_INST_PROP_LEN(n, row_gpios)
+#define COL_COUNT(n) DT_INST_PROP_LEN(n, col_gpios)
+
+#define KEY_MATRIX_DEFINE(n)                                                                       \
+    BUILD_ASSERT(COL_COUNT(n) <= 32, "Up to 32 columns are supported");                           \
+    BUILD_ASSERT(DT_INST_PROP_LEN(n, input_codes) == (ROW_COUNT(n) * COL_COUNT(n)),                \
+                 "Each matrix key needs an input code");                                           \
+    static const struct gpio_dt_spec key_matrix_rows_##n[] = {                                     \
+        DT_INST_FOREACH_PROP_ELEM(n, row_gpios, GPIO_SPEC_AND_COMMA)};                             \
+    static const struct gpio_dt_spec key_matrix_cols_##n[] = {                                     \
+        DT_INST_FOREACH_PROP_ELEM(n, col_gpios, GPIO_SPEC_AND_COMMA)};                             \
+    static const uint16_t key_matrix_codes_##n[] = DT_INST_PROP(n, input_codes);                   \
+    static uint32_t key_matrix_stable_##n[ROW_COUNT(n)];                                           \
+    static uint32_t key_matrix_debouncing_##n[ROW_COUNT(n)];                                       \
+    static uint8_t key_matrix_counters_##n[DIV_ROUND_UP(ROW_COUNT(n) * COL_COUNT(n), 2)];          \
+    KEY_MATRIX_EMUL_DATA(n)                                                                        \
+    static K_KERNEL_STACK_DEFINE(key_matrix_stack_##n, CONFIG_DEMO_KEY_MATRIX_THREAD_STACK_SIZE);  \
+    static const struct key_matrix_config key_matrix_config_##n = {                                \
+        .rows = key_matrix_rows_##n,                                                               \
+        .cols = key_matrix_cols_##n,                                                               \
+        .codes = key_matrix_codes_##n,                                                             \
+        .row_count = ROW_COUNT(n),                                                                 \
+        .col_count = COL_COUNT(n),                                                                 \
+        .settle_time_us = DT_INST_PROP(n, settle_time_us),                                         \
+        .stack = key_matrix_stack_##n,                                                             \
+        .stack_size = K_KERNEL_STACK_SIZEOF(key_matrix_stack_##n),                                 \
+    };                                                                                             \
+    static struct key_matrix_data key_matrix_data_##n = {                                          \
+        .stable = key_matrix_stable_##n,                                                           \
+        .debouncing = key_matrix_debouncing_##n,                                                   \
+        .counters = key_matrix_counters_##n,                                                       \
+        KEY_MATRIX_EMUL_INIT(n)};                                                                  \
+    DEVICE_DT_INST_DEFINE(n, key_matrix_init, NULL, &key_matrix_data_##n,                          \
+                          &key_matrix_config_##n, POST_KERNEL, CONFIG_INPUT_INIT_PRIORITY, NULL);
+
+    DT_INST_FOREACH_STATUS_OKAY(KEY_MATRIX_DEFINE)
+}
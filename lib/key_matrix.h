@@ -0,0 +1,38 @@
+#ifndef __KEY_MATRIX_H__
+#define __KEY_MATRIX_H__
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/device.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Provides the time of the scan that detected the key edge being reported.
+     *        Only valid within the input callback (synchronous input mode).
+     * @param dev the input device that reported the event
+     * @param timestamp the k_cycle_get_32() time of the scan
+     * @return false if the device isn't a key matrix
+     */
+    bool key_matrix_edge_timestamp(const struct device* dev, uint32_t* timestamp);
+
+#if CONFIG_DEMO_KEY_MATRIX_EMUL
+    /**
+     * @brief Sets the physical state of an emulated matrix key.
+     */
+    int key_matrix_emul_set_key(const struct device* dev, uint8_t row, uint8_t col, bool pressed);
+
+    /**
+     * @brief Drives the emulated column inputs according to the selected row,
+     *        called by the scanner after driving the row.
+     */
+    void key_matrix_emul_select_row(const struct device* dev, uint8_t row);
+#endif
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif // __KEY_MATRIX_H__
@@ -0,0 +1,146 @@
+#ifndef __KEY_STATE_HPP__
+#define __KEY_STATE_HPP__
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Key state bitmap, between the key changes and the report snapshots of a
+///        @ref report_queue. A change of a key that already has an unqueued change
+///        (e.g. the release of a tap while every report slot is in flight) is held back,
+///        with every change after it, until the first change is queued, so a press and its
+///        release are always reported separately. Likewise a snapshot only replaces (merges)
+///        the last pending one if it doesn't revert any key that changed in that one.
+///        The methods aren't thread-safe, the owner locks.
+/// @tparam BYTES the size of the bitmap
+/// @tparam HELD the number of changes that can be held back, a change beyond that is applied
+///         right away, and may cancel out an earlier one
+template <std::size_t BYTES, std::size_t HELD = 16>
+class key_state
+{
+  public:
+    using bits_type = std::array<uint8_t, BYTES>;
+
+    /// @brief Applies a key change to the live state, or holds it back until it can be.
+    void change(std::size_t index, bool value)
+    {
+        if (((held_count_ > 0) or conflicts(index, value)) and (held_count_ < HELD))
+        {
+            held_[held_count_++] = {static_cast<uint16_t>(index), value};
+            return;
+        }
+        set_bit(live_, index, value);
+    }
+
+    /// @return the live state, with all the changes that aren't held back
+    const bits_type& live() const { return live_; }
+
+    /// @return whether the live state differs from the last snapshot
+    bool changed() const { return live_ != queued_; }
+
+    /// @return the number of changes held back
+    std::size_t held() const { return held_count_; }
+
+    /// @brief Snapshots the live state into the queue, if a slot is free,
+    ///        or the last pending snapshot can be replaced without losing a change of it.
+    /// @param commit fills the buffer with the given state, and commits it to the queue
+    /// @return true if the snapshot was taken, the held back changes are applied then
+    template <typename TQueue, typename TCommit>
+    bool snapshot(TQueue& queue, TCommit&& commit)
+    {
+        auto buffer = queue.prepare();
+        if (buffer.empty())
+        {
+            return false;
+        }
+        bool merging = queue.merging();
+        if (merging and reverts_pending())
+        {
+            return false;
+        }
+        commit(buffer, live_);
+        if (!merging)
+        {
+            pending_base_ = queued_;
+        }
+        queued_ = live_;
+        release_held();
+        return true;
+    }
+
+    /// @brief Forgets the snapshots, e.g. when the queue is cleared for a new transport,
+    ///        the live state is kept.
+    void restart()
+    {
+        queued_ = {};
+        pending_base_ = {};
+    }
+
+    static bool test_bit(const bits_type& bits, std::size_t index)
+    {
+        return bits[index / 8] & (1 << (index % 8));
+    }
+
+  private:
+    struct held_change
+    {
+        uint16_t index;
+        bool value;
+    };
+
+    static void set_bit(bits_type& bits, std::size_t index, bool value)
+    {
+        if (value)
+        {
+            bits[index / 8] |= 1 << (index % 8);
+        }
+        else
+        {
+            bits[index / 8] &= ~(1 << (index % 8));
+        }
+    }
+
+    /// @return whether the change reverts an unqueued change of the same key
+    bool conflicts(std::size_t index, bool value) const
+    {
+        bool live = test_bit(live_, index);
+        return (live != value) and (live != test_bit(queued_, index));
+    }
+
+    /// @return whether the live state reverts a change of the last pending snapshot
+    bool reverts_pending() const
+    {
+        for (std::size_t i = 0; i < BYTES; i++)
+        {
+            if ((queued_[i] ^ pending_base_[i]) & (live_[i] ^ queued_[i]))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// @brief Applies the held back changes in order, until one conflicts again.
+    void release_held()
+    {
+        std::size_t released = 0;
+        while ((released < held_count_) and
+               !conflicts(held_[released].index, held_[released].value))
+        {
+            set_bit(live_, held_[released].index, held_[released].value);
+            released++;
+        }
+        for (std::size_t i = released; i < held_count_; i++)
+        {
+            held_[i - released] = held_[i];
+        }
+        held_count_ -= released;
+    }
+
+    bits_type live_{};
+    bits_type queued_{};       // the last snapshot
+    bits_type pending_base_{}; // the snapshot before the last one
+    std::array<held_change, HELD> held_{};
+    std::size_t held_count_{};
+};
+
+#endif // __KEY_STATE_HPP__
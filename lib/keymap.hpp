@@ -0,0 +1,393 @@
+#ifndef __KEYMAP_HPP__
+#define __KEYMAP_HPP__
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+
+#include <hid/page/keyboard_keypad.hpp>
+
+/// @brief Layered keymap with tap/hold keys and macros, defined by constexpr tables.
+///        The input codes are translated to key indexes, and the layers are flattened
+///        (transparent keys resolved) at compile time, so a key lookup is two table reads.
+///        The engine has no dynamic memory, and doesn't depend on the OS: the time is given
+///        by the caller in ticks of any resolution, so it can be exercised on the host as well.
+namespace keymap
+{
+enum class kind : uint8_t
+{
+    NONE,        // does nothing
+    TRANSPARENT, // the key of the next lower layer
+    KEY,         // a keyboard usage
+    MOMENTARY,   // activates a layer while held
+    TOGGLE,      // toggles a layer on each press
+    LAYER_TAP,   // a keyboard usage when tapped, activates a layer while held
+    MACRO,       // plays a macro on press
+};
+
+struct action
+{
+    kind type{};
+    uint8_t usage{}; // KEY, LAYER_TAP
+    uint8_t arg{};   // the layer or macro index
+};
+
+constexpr action none()
+{
+    return {kind::NONE};
+}
+constexpr action transparent()
+{
+    return {kind::TRANSPARENT};
+}
+constexpr action key(hid::page::keyboard_keypad usage)
+{
+    return {kind::KEY, static_cast<uint8_t>(usage)};
+}
+constexpr action momentary(uint8_t layer)
+{
+    return {kind::MOMENTARY, 0, layer};
+}
+constexpr action toggle(uint8_t layer)
+{
+    return {kind::TOGGLE, 0, layer};
+}
+constexpr action layer_tap(hid::page::keyboard_keypad usage, uint8_t layer)
+{
+    return {kind::LAYER_TAP, static_cast<uint8_t>(usage), layer};
+}
+constexpr action macro(uint8_t index)
+{
+    return {kind::MACRO, 0, index};
+}
+
+/// @brief A macro step, each key change is followed by the report gap.
+struct step
+{
+    enum class op : uint8_t
+    {
+        PRESS,
+        RELEASE,
+        TAP,
+        DELAY,
+    };
+    op code;
+    uint8_t value; // the usage, or the delay in ms
+};
+
+constexpr step press(hid::page::keyboard_keypad usage)
+{
+    return {step::op::PRESS, static_cast<uint8_t>(usage)};
+}
+constexpr step release(hid::page::keyboard_keypad usage)
+{
+    return {step::op::RELEASE, static_cast<uint8_t>(usage)};
+}
+constexpr step tap(hid::page::keyboard_keypad usage)
+{
+    return {step::op::TAP, static_cast<uint8_t>(usage)};
+}
+constexpr step delay_ms(uint8_t ms)
+{
+    return {step::op::DELAY, ms};
+}
+
+/// @brief The compile time lookup tables, made by @ref make_table.
+template <std::size_t LAYERS, std::size_t KEYS, uint16_t MAX_CODE>
+struct table
+{
+    static_assert((LAYERS > 0) and (LAYERS <= 32), "the active layers are a 32-bit mask");
+    static_assert(KEYS < UINT8_MAX, "the key indexes are 8-bit");
+
+    static constexpr std::size_t layer_count = LAYERS;
+    static constexpr std::size_t key_count = KEYS;
+    static constexpr uint16_t max_code = MAX_CODE;
+
+    std::array<uint8_t, MAX_CODE + 1> index;               // input code -> key, KEYS if unmapped
+    std::array<std::array<action, KEYS>, LAYERS> resolved; // no transparent keys left
+    bool valid; // all codes are in range, and all layer references exist
+};
+
+/// @brief Builds the lookup tables of a keymap.
+///        A transparent key takes the action of the same key on the next lower layer,
+///        regardless of the state of that layer.
+/// @tparam MAX_CODE the highest input code, the size of the code index table
+/// @param codes the input code of each key
+/// @param layers the action of each key, per layer, layer 0 is the base layer
+template <uint16_t MAX_CODE = 0xff, std::size_t LAYERS, std::size_t KEYS>
+constexpr table<LAYERS, KEYS, MAX_CODE>
+make_table(const std::array<uint16_t, KEYS>& codes,
+           const std::array<std::array<action, KEYS>, LAYERS>& layers)
+{
+    table<LAYERS, KEYS, MAX_CODE> t{};
+    t.valid = true;
+    t.index.fill(KEYS);
+    for (std::size_t k = 0; k < KEYS; k++)
+    {
+        if (codes[k] > MAX_CODE)
+        {
+            t.valid = false;
+            continue;
+        }
+        t.index[codes[k]] = k;
+    }
+    for (std::size_t l = 0; l < LAYERS; l++)
+    {
+        for (std::size_t k = 0; k < KEYS; k++)
+        {
+            auto lower = l;
+            auto a = layers[lower][k];
+            while ((a.type == kind::TRANSPARENT) and (lower > 0))
+            {
+                a = layers[--lower][k];
+            }
+            if (a.type == kind::TRANSPARENT)
+            {
+                a = none();
+            }
+            if (((a.type == kind::MOMENTARY) or (a.type == kind::TOGGLE) or
+                 (a.type == kind::LAYER_TAP)) and
+                (a.arg >= LAYERS))
+            {
+                t.valid = false;
+            }
+            t.resolved[l][k] = a;
+        }
+    }
+    return t;
+}
+
+/// @brief Translates key events to keyboard usage changes, applied to a sink with a
+///        `set_key(hid::page::keyboard_keypad, bool)` method (e.g. @ref nkro_keyboard).
+///        The caller sends a report after each @ref process and @ref poll call.
+///        A key is released with the action it was pressed with, even if the layer changed.
+///        A layer-tap key is a hold when another key is pressed, or the tapping term elapses,
+///        otherwise its release taps the usage. Taps and macro steps keep each key change
+///        for the report gap, so that the transport sends each change in a separate report.
+///        Only one macro plays at a time, a macro key pressed meanwhile is ignored.
+/// @tparam TABLE the type made by @ref make_table
+template <typename TABLE>
+class engine
+{
+  public:
+    using macro_list = std::span<const std::span<const step>>;
+
+    /// @param ticks_per_ms the resolution of the timestamps
+    /// @param tapping_term_ms the longest press of a layer-tap key that counts as tap
+    /// @param report_gap_ticks the time between the reports of a sequence,
+    ///        at least the transport's report interval
+    constexpr engine(const TABLE& table, macro_list macros, uint32_t ticks_per_ms,
+                     uint32_t tapping_term_ms, uint32_t report_gap_ticks)
+        : table_(table),
+          macros_(macros),
+          ticks_per_ms_(ticks_per_ms),
+          tapping_term_(tapping_term_ms * ticks_per_ms),
+          report_gap_(report_gap_ticks)
+    {}
+
+    /// @brief Applies a key event.
+    template <typename SINK>
+    void process(uint16_t code, bool pressed, uint32_t time, SINK& sink)
+    {
+        if (code > TABLE::max_code)
+        {
+            return;
+        }
+        auto k = table_.index[code];
+        if (k >= TABLE::key_count)
+        {
+            return;
+        }
+        if (!pressed)
+        {
+            release(k, time, sink);
+            return;
+        }
+        if (layer_tap_.active)
+        {
+            // interrupted by another key
+            hold();
+        }
+        auto a = table_.resolved[top_layer()][k];
+        held_[k] = a;
+        switch (a.type)
+        {
+        case kind::KEY:
+            sink.set_key(hid::page::keyboard_keypad(a.usage), true);
+            break;
+        case kind::MOMENTARY:
+            momentary_ |= 1u << a.arg;
+            break;
+        case kind::TOGGLE:
+            toggled_ ^= 1u << a.arg;
+            break;
+        case kind::LAYER_TAP:
+            layer_tap_ = {time, k, true};
+            break;
+        case kind::MACRO:
+            if (!macro_.active and (a.arg < macros_.size()))
+            {
+                macro_ = {macros_[a.arg], 0, time, true};
+                play(time, sink);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    /// @brief Applies the timed changes that are due.
+    template <typename SINK>
+    void poll(uint32_t now, SINK& sink)
+    {
+        if (layer_tap_.active and due(now, layer_tap_.time + tapping_term_))
+        {
+            hold();
+        }
+        if (tap_release_.active and due(now, tap_release_.time))
+        {
+            tap_release_.active = false;
+            sink.set_key(hid::page::keyboard_keypad(tap_release_.usage), false);
+        }
+        if (macro_.active and due(now, macro_.time))
+        {
+            play(now, sink);
+        }
+    }
+
+    /// @return the time of the next timed change, if any
+    std::optional<uint32_t> deadline() const
+    {
+        std::optional<uint32_t> next{};
+        auto consider = [&next](bool active, uint32_t time)
+        {
+            if (active and (!next or (static_cast<int32_t>(time - *next) < 0)))
+            {
+                next = time;
+            }
+        };
+        consider(layer_tap_.active, layer_tap_.time + tapping_term_);
+        consider(tap_release_.active, tap_release_.time);
+        consider(macro_.active, macro_.time);
+        return next;
+    }
+
+    uint32_t active_layers() const { return 1u | momentary_ | toggled_; }
+    uint8_t top_layer() const { return std::bit_width(active_layers()) - 1; }
+
+  private:
+    struct layer_tap_state
+    {
+        uint32_t time;
+        uint8_t key;
+        bool active;
+    };
+    struct tap_release_state
+    {
+        uint32_t time;
+        uint8_t usage;
+        bool active;
+    };
+    struct macro_state
+    {
+        std::span<const step> steps;
+        std::size_t pos;
+        uint32_t time;
+        bool active;
+    };
+
+    static bool due(uint32_t now, uint32_t time) { return static_cast<int32_t>(now - time) >= 0; }
+
+    void hold()
+    {
+        layer_tap_.active = false;
+        momentary_ |= 1u << held_[layer_tap_.key].arg;
+    }
+
+    template <typename SINK>
+    void release(uint8_t k, uint32_t time, SINK& sink)
+    {
+        auto a = held_[k];
+        held_[k] = none();
+        switch (a.type)
+        {
+        case kind::KEY:
+            sink.set_key(hid::page::keyboard_keypad(a.usage), false);
+            break;
+        case kind::MOMENTARY:
+            momentary_ &= ~(1u << a.arg);
+            break;
+        case kind::LAYER_TAP:
+            if (layer_tap_.active and (layer_tap_.key == k))
+            {
+                layer_tap_.active = false;
+                tap(a.usage, time, sink);
+            }
+            else
+            {
+                momentary_ &= ~(1u << a.arg);
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    template <typename SINK>
+    void tap(uint8_t usage, uint32_t time, SINK& sink)
+    {
+        if (tap_release_.active)
+        {
+            sink.set_key(hid::page::keyboard_keypad(tap_release_.usage), false);
+        }
+        sink.set_key(hid::page::keyboard_keypad(usage), true);
+        tap_release_ = {time + report_gap_, usage, true};
+    }
+
+    template <typename SINK>
+    void play(uint32_t now, SINK& sink)
+    {
+        if (macro_.pos == macro_.steps.size())
+        {
+            macro_.active = false;
+            return;
+        }
+        auto s = macro_.steps[macro_.pos++];
+        switch (s.code)
+        {
+        case step::op::PRESS:
+            sink.set_key(hid::page::keyboard_keypad(s.value), true);
+            macro_.time = now + report_gap_;
+            break;
+        case step::op::RELEASE:
+            sink.set_key(hid::page::keyboard_keypad(s.value), false);
+            macro_.time = now + report_gap_;
+            break;
+        case step::op::TAP:
+            tap(s.value, now, sink);
+            macro_.time = now + 2 * report_gap_;
+            break;
+        case step::op::DELAY:
+            macro_.time = now + s.value * ticks_per_ms_;
+            break;
+        }
+    }
+
+    const TABLE& table_;
+    macro_list macros_;
+    uint32_t ticks_per_ms_;
+    uint32_t tapping_term_;
+    uint32_t report_gap_;
+    std::array<action, TABLE::key_count> held_{};
+    layer_tap_state layer_tap_{};
+    tap_release_state tap_release_{};
+    macro_state macro_{};
+    uint32_t momentary_{};
+    uint32_t toggled_{};
+};
+
+} // namespace keymap
+
+#endif // __KEYMAP_HPP__
@@ -0,0 +1,187 @@
+#ifndef __MOTION_ACCUMULATOR_HPP__
+#define __MOTION_ACCUMULATOR_HPP__
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <limits>
+#include <zephyr/kernel.h>
+
+/// @brief Accumulates relative motion on multiple axes between report transfers.
+///        Motion is measured in physical units (encoder ticks, sensor counts),
+///        and is either added as deltas, or as a continuous velocity
+///        (e.g. while a button is held), which is integrated over time.
+///        Each axis scales the physical units to report units with its own fixed-point factor
+///        (e.g. the negotiated resolution multiplier), and keeps the fractional part
+///        of the result, so no precision is lost over long gestures.
+///        Taking the motion into report fields saturates to the field's range,
+///        and carries the remainder over to the next report.
+/// @tparam AXES the number of axes
+template <std::size_t AXES>
+class motion_accumulator
+{
+  public:
+    using axes = std::array<int32_t, AXES>;
+    static constexpr unsigned FRACTION_BITS = 16;
+
+    /// @brief Creates a fixed-point scale factor of report units per physical unit.
+    static constexpr int32_t scale(int32_t numerator, int32_t denominator = 1)
+    {
+        return (static_cast<int64_t>(numerator) << FRACTION_BITS) / denominator;
+    }
+
+    /// @brief Sets the scale factor of an axis, the accumulated motion is preserved.
+    void set_scale(std::size_t axis, int32_t scale)
+    {
+        __ASSERT_NO_MSG(scale != 0);
+        auto key = k_spin_lock(&lock_);
+        integrate(k_cycle_get_32());
+        if (scale_[axis] != scale)
+        {
+            // convert the pending motion to the new resolution, split to avoid overflow
+            const int64_t old_scale = scale_[axis];
+            acc_[axis] = (acc_[axis] / old_scale) * scale +
+                         (acc_[axis] % old_scale) * scale / old_scale;
+            scale_[axis] = scale;
+        }
+        k_spin_unlock(&lock_, key);
+    }
+
+    /// @brief Adds relative motion, in physical units.
+    void add(const axes& delta)
+    {
+        auto key = k_spin_lock(&lock_);
+        for (std::size_t i = 0; i < AXES; i++)
+        {
+            acc_[i] = saturating_add(acc_[i], static_cast<int64_t>(delta[i]) * scale_[i]);
+        }
+        k_spin_unlock(&lock_, key);
+    }
+
+    /// @brief Sets the continuous motion, in physical units per second.
+    void set_velocity(const axes& velocity)
+    {
+        auto key = k_spin_lock(&lock_);
+        integrate(k_cycle_get_32());
+        velocity_ = velocity;
+        k_spin_unlock(&lock_, key);
+    }
+
+    /// @brief Moves the whole units of the accumulated motion into the report fields,
+    ///        as much as each can hold.
+    /// @return true if any of the fields is non-zero
+    template <typename... TFields>
+    bool take(TFields&... fields)
+    {
+        static_assert(sizeof...(TFields) == AXES, "a field is needed for each axis");
+        auto key = k_spin_lock(&lock_);
+        integrate(k_cycle_get_32());
+        std::size_t i = 0;
+        bool moved = false;
+        ((moved |= take_axis(acc_[i++], fields)), ...);
+        k_spin_unlock(&lock_, key);
+        return moved;
+    }
+
+    /// @brief Returns the motion of report fields that weren't sent, in report units.
+    template <typename... TFields>
+    void put_back(const TFields&... fields)
+    {
+        static_assert(sizeof...(TFields) == AXES, "a field is needed for each axis");
+        auto key = k_spin_lock(&lock_);
+        std::size_t i = 0;
+        ((acc_[i] = saturating_add(acc_[i], static_cast<int64_t>(fields) * ONE), i++), ...);
+        k_spin_unlock(&lock_, key);
+    }
+
+    /// @brief Checks if there is at least a whole unit of motion to report.
+    bool pending()
+    {
+        auto key = k_spin_lock(&lock_);
+        integrate(k_cycle_get_32());
+        bool pending = std::any_of(acc_.begin(), acc_.end(), [](auto v) { return whole(v) != 0; });
+        k_spin_unlock(&lock_, key);
+        return pending;
+    }
+
+    /// @brief The time until the continuous motion amounts to a whole report unit on any axis.
+    /// @return K_FOREVER when there is no continuous motion
+    k_timeout_t next_due()
+    {
+        auto key = k_spin_lock(&lock_);
+        int64_t min_cycles = std::numeric_limits<int64_t>::max();
+        for (std::size_t i = 0; i < AXES; i++)
+        {
+            if (velocity_[i] == 0)
+            {
+                continue;
+            }
+            // the report units still missing for a whole unit, in the direction of motion
+            const int64_t step = velocity_[i] > 0 ? ONE : -ONE;
+            const int64_t missing = std::abs(step - (acc_[i] % ONE));
+            const int64_t rate = std::abs(static_cast<int64_t>(velocity_[i]) * scale_[i]);
+            min_cycles = std::min(min_cycles, (missing * CYCLES_PER_SEC + rate - 1) / rate);
+        }
+        k_spin_unlock(&lock_, key);
+        if (min_cycles == std::numeric_limits<int64_t>::max())
+        {
+            return K_FOREVER;
+        }
+        return K_CYC(min_cycles);
+    }
+
+  private:
+    static constexpr int64_t CYCLES_PER_SEC = CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC;
+    static constexpr int64_t ONE = int64_t(1) << FRACTION_BITS;
+
+    static int64_t saturating_add(int64_t a, int64_t b)
+    {
+        // the limit is far below the int64_t range, so the sum doesn't overflow
+        constexpr int64_t limit = static_cast<int64_t>(std::numeric_limits<int32_t>::max())
+                                  << FRACTION_BITS;
+        return std::clamp<int64_t>(a + b, -limit, limit);
+    }
+
+    /// @brief The whole units, rounded towards zero, so the fraction keeps the sign.
+    static int64_t whole(int64_t value) { return value / ONE; }
+
+    template <typename T>
+    static bool take_axis(int64_t& acc, T& field)
+    {
+        auto value = std::clamp<int64_t>(whole(acc), std::numeric_limits<T>::min(),
+                                         std::numeric_limits<T>::max());
+        field = static_cast<T>(value);
+        acc -= value * ONE;
+        return value != 0;
+    }
+
+    /// @brief Converts the continuous motion since the last integration to fixed-point units,
+    ///        keeping the remainder of the division (in units * cycles) as residue.
+    void integrate(uint32_t now)
+    {
+        // limit the time span so the product cannot overflow, the velocity is set
+        // with much shorter update periods anyway
+        const int64_t elapsed = std::min<int64_t>(now - last_integration_, CYCLES_PER_SEC);
+        last_integration_ = now;
+        for (std::size_t i = 0; i < AXES; i++)
+        {
+            int64_t total =
+                residue_[i] + static_cast<int64_t>(velocity_[i]) * scale_[i] * elapsed;
+            acc_[i] = saturating_add(acc_[i], total / CYCLES_PER_SEC);
+            residue_[i] = total % CYCLES_PER_SEC;
+        }
+    }
+
+    std::array<int64_t, AXES> acc_{};
+    std::array<int64_t, AXES> residue_{};
+    axes velocity_{};
+    axes scale_{[] {
+        axes s{};
+        s.fill(scale(1));
+        return s;
+    }()};
+    uint32_t last_integration_{k_cycle_get_32()};
+    k_spinlock lock_{};
+};
+
+#endif // __MOTION_ACCUMULATOR_HPP__
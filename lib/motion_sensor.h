@@ -0,0 +1,57 @@
+#ifndef __MOTION_SENSOR_H__
+#define __MOTION_SENSOR_H__
+#include <errno.h>
+#include <stdint.h>
+#include <zephyr/device.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+    /** @brief Relative motion read from the sensor. */
+    struct motion_sample
+    {
+        int16_t dx;
+        int16_t dy;
+        uint32_t timestamp; /* k_cycle_get_32() at the end of the read */
+    };
+
+    /**
+     * @brief Called from interrupt context when the sensor signals new motion.
+     */
+    typedef void (*motion_sensor_handler_t)(const struct device* dev, void* user_data);
+
+    __subsystem struct motion_sensor_driver_api
+    {
+        int (*read)(const struct device* dev, struct motion_sample* sample);
+        int (*set_handler)(const struct device* dev, motion_sensor_handler_t handler,
+                           void* user_data);
+    };
+
+    /**
+     * @brief Reads the motion accumulated by the sensor since the last read, in a single burst.
+     */
+    static inline int motion_sensor_read(const struct device* dev, struct motion_sample* sample)
+    {
+        const struct motion_sensor_driver_api* api =
+            (const struct motion_sensor_driver_api*)dev->api;
+        return api->read(dev, sample);
+    }
+
+    /**
+     * @brief Registers the motion interrupt handler.
+     */
+    static inline int motion_sensor_set_handler(const struct device* dev,
+                                                motion_sensor_handler_t handler, void* user_data)
+    {
+        const struct motion_sensor_driver_api* api =
+            (const struct motion_sensor_driver_api*)dev->api;
+        return api->set_handler(dev, handler, user_data);
+    }
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif // __MOTION_SENSOR_H__
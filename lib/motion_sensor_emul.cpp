@@ -0,0 +1,130 @@
+#include <motion_sensor.h>
+#include <zephyr/kernel.h>
+#include <zephyr/shell/shell.h>
+
+#define DT_DRV_COMPAT c2usb_motion_sensor_emul
+
+extern "C"
+{
+    struct motion_sensor_emul_config
+    {
+        uint32_t motion_interval_us;
+        int16_t delta_x;
+        int16_t delta_y;
+    };
+
+    struct motion_sensor_emul_data
+    {
+        const struct device* dev;
+        struct k_timer timer;
+        struct k_spinlock lock;
+        motion_sensor_handler_t handler;
+        void* user_data;
+        // the motion the emulated sensor has accumulated since the last read
+        int32_t dx;
+        int32_t dy;
+    };
+
+    static int motion_sensor_emul_read(const struct device* dev, struct motion_sample* sample)
+    {
+        auto* data = static_cast<motion_sensor_emul_data*>(dev->data);
+
+        auto key = k_spin_lock(&data->lock);
+        sample->dx = static_cast<int16_t>(CLAMP(data->dx, INT16_MIN, INT16_MAX));
+        sample->dy = static_cast<int16_t>(CLAMP(data->dy, INT16_MIN, INT16_MAX));
+        data->dx -= sample->dx;
+        data->dy -= sample->dy;
+        k_spin_unlock(&data->lock, key);
+        sample->timestamp = k_cycle_get_32();
+        return 0;
+    }
+
+    static int motion_sensor_emul_set_handler(const struct device* dev,
+                                              motion_sensor_handler_t handler, void* user_data)
+    {
+        auto* data = static_cast<motion_sensor_emul_data*>(dev->data);
+
+        data->user_data = user_data;
+        data->handler = handler;
+        return 0;
+    }
+
+    /// @brief Emulates sensor motion, signaling it like the motion interrupt does.
+    static void motion_sensor_emul_move(const struct device* dev, int32_t dx, int32_t dy)
+    {
+        auto* data = static_cast<motion_sensor_emul_data*>(dev->data);
+
+        auto key = k_spin_lock(&data->lock);
+        data->dx += dx;
+        data->dy += dy;
+        k_spin_unlock(&data->lock, key);
+        if (data->handler != nullptr)
+        {
+            data->handler(dev, data->user_data);
+        }
+    }
+
+    static void motion_sensor_emul_timer(struct k_timer* timer)
+    {
+        auto* data = CONTAINER_OF(timer, struct motion_sensor_emul_data, timer);
+        auto* cfg = static_cast<const motion_sensor_emul_config*>(data->dev->config);
+
+        motion_sensor_emul_move(data->dev, cfg->delta_x, cfg->delta_y);
+    }
+
+    static int motion_sensor_emul_init(const struct device* dev)
+    {
+        auto* cfg = static_cast<const motion_sensor_emul_config*>(dev->config);
+        auto* data = static_cast<motion_sensor_emul_data*>(dev->data);
+
+        data->dev = dev;
+        k_timer_init(&data->timer, motion_sensor_emul_timer, nullptr);
+        if (cfg->motion_interval_us > 0)
+        {
+            k_timer_start(&data->timer, K_USEC(cfg->motion_interval_us),
+                          K_USEC(cfg->motion_interval_us));
+        }
+        return 0;
+    }
+
+    static const struct motion_sensor_driver_api motion_sensor_emul_api = {
+        .read = motion_sensor_emul_read,
+        .set_handler = motion_sensor_emul_set_handler,
+    };
+
+#if CONFIG_SHELL
+    static int cmd_sensor_move(const shell* sh, size_t argc, char** argv)
+    {
+        const struct device* dev = device_get_binding(argv[1]);
+        int err = 0;
+        auto dx = shell_strtol(argv[2], 10, &err);
+        auto dy = shell_strtol(argv[3], 10, &err);
+        if ((dev == nullptr) or (dev->api != &motion_sensor_emul_api) or err)
+        {
+            shell_error(sh, "Invalid arguments %d", err);
+            return -EINVAL;
+        }
+        motion_sensor_emul_move(dev, dx, dy);
+        return 0;
+    }
+
+    SHELL_STATIC_SUBCMD_SET_CREATE(sub_sensor,
+                                   SHELL_CMD_ARG(move, NULL, "Emulate motion <device> <dx> <dy>",
+                                                 cmd_sensor_move, 4, 0),
+                                   SHELL_SUBCMD_SET_END);
+    SHELL_CMD_REGISTER(sensor_emul, &sub_sensor, "Emulated motion sensor", NULL);
+#endif // CONFIG_SHELL
+
+#define MOTION_SENSOR_EMUL_DEFINE(n)                                                               \
+    static const struct motion_sensor_emul_config motion_sensor_emul_config_##n = {                \
+        .motion_interval_us = DT_INST_PROP(n, motion_interval_us),                                 \
+        .delta_x = DT_INST_PROP(n, delta_x),                                                       \
+        .delta_y = DT_INST_PROP(n, delta_y),                                                       \
+    };                                                                                             \
+    static struct motion_sensor_emul_data motion_sensor_emul_data_##n;                             \
+    DEVICE_DT_INST_DEFINE(n, motion_sensor_emul_init, NULL, &motion_sensor_emul_data_##n,          \
+                          &motion_sensor_emul_config_##n, POST_KERNEL,                             \
+                          CONFIG_DEMO_MOTION_SENSOR_INIT_PRIORITY, &motion_sensor_emul_api);
+
+    DT_INST_FOREACH_STATUS_OKAY(MOTION_SENSOR_EMUL_DEFINE)
+}
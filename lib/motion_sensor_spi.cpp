@@ -0,0 +1,176 @@
+#include <motion_sensor.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+LOG_MODULE_REGISTER(motion_sensor_spi, LOG_LEVEL_INF);
+
+#define DT_DRV_COMPAT c2usb_spi_motion_sensor
+
+extern "C"
+{
+    // PixArt PMW33xx compatible register map
+    static constexpr uint8_t REG_MOTION = 0x02;
+    static constexpr uint8_t REG_DELTA_Y_H = 0x06;
+    static constexpr uint8_t REG_POWER_UP_RESET = 0x3a;
+    static constexpr uint8_t REG_MOTION_BURST = 0x50;
+    static constexpr uint8_t POWER_UP_RESET = 0x5a;
+    static constexpr uint8_t REG_WRITE_FLAG = 0x80;
+    // delay between the burst address byte and the first data byte
+    static constexpr uint32_t T_SRAD_MOTBR_US = 35;
+    // delay after a register write, before the next access
+    static constexpr uint32_t T_SWW_US = 180;
+    // delay between a register address byte and its data byte
+    static constexpr uint32_t T_SRAD_US = 160;
+
+    struct motion_sensor_spi_config
+    {
+        struct spi_dt_spec bus;
+        struct gpio_dt_spec motion_gpio;
+    };
+
+    struct motion_sensor_spi_data
+    {
+        const struct device* dev;
+        struct gpio_callback motion_cb;
+        motion_sensor_handler_t handler;
+        void* user_data;
+        // burst read layout: motion, observation, delta X L/H, delta Y L/H
+        uint8_t burst[6];
+    };
+
+    /// @brief Keeps the chip select asserted between the address and data phases,
+    ///        as the sensor needs a delay in between.
+    static int transfer(const struct device* dev, uint8_t address, uint8_t* data, size_t size,
+                        bool write, uint32_t address_delay_us)
+    {
+        auto* cfg = static_cast<const motion_sensor_spi_config*>(dev->config);
+        const spi_buf addr_buf{.buf = &address, .len = sizeof(address)};
+        const spi_buf_set addr_set{.buffers = &addr_buf, .count = 1};
+        const spi_buf data_buf{.buf = data, .len = size};
+        const spi_buf_set data_set{.buffers = &data_buf, .count = 1};
+
+        int err = spi_write_dt(&cfg->bus, &addr_set);
+        if (err == 0)
+        {
+            k_busy_wait(address_delay_us);
+            err = write ? spi_write_dt(&cfg->bus, &data_set) : spi_read_dt(&cfg->bus, &data_set);
+        }
+        spi_release_dt(&cfg->bus);
+        return err;
+    }
+
+    static int write_register(const struct device* dev, uint8_t reg, uint8_t value)
+    {
+        int err = transfer(dev, reg | REG_WRITE_FLAG, &value, sizeof(value), true, 0);
+        k_busy_wait(T_SWW_US);
+        return err;
+    }
+
+    static int read_register(const struct device* dev, uint8_t reg, uint8_t* value)
+    {
+        return transfer(dev, reg, value, sizeof(*value), false, T_SRAD_US);
+    }
+
+    static int motion_sensor_spi_read(const struct device* dev, struct motion_sample* sample)
+    {
+        auto* data = static_cast<motion_sensor_spi_data*>(dev->data);
+
+        // only burst reads are done after init, so the burst mode stays active
+        int err = transfer(dev, REG_MOTION_BURST, data->burst, sizeof(data->burst), false,
+                           T_SRAD_MOTBR_US);
+        if (err)
+        {
+            return err;
+        }
+        sample->timestamp = k_cycle_get_32();
+        sample->dx = static_cast<int16_t>(sys_get_le16(&data->burst[2]));
+        sample->dy = static_cast<int16_t>(sys_get_le16(&data->burst[4]));
+        return 0;
+    }
+
+    static void motion_isr(const struct device*, struct gpio_callback* cb, uint32_t)
+    {
+        auto* data = CONTAINER_OF(cb, struct motion_sensor_spi_data, motion_cb);
+        if (data->handler != nullptr)
+        {
+            data->handler(data->dev, data->user_data);
+        }
+    }
+
+    static int motion_sensor_spi_set_handler(const struct device* dev,
+                                             motion_sensor_handler_t handler, void* user_data)
+    {
+        auto* cfg = static_cast<const motion_sensor_spi_config*>(dev->config);
+        auto* data = static_cast<motion_sensor_spi_data*>(dev->data);
+
+        data->user_data = user_data;
+        data->handler = handler;
+        return gpio_pin_interrupt_configure_dt(&cfg->motion_gpio, handler != nullptr
+                                                                      ? GPIO_INT_EDGE_TO_ACTIVE
+                                                                      : GPIO_INT_DISABLE);
+    }
+
+    static int motion_sensor_spi_init(const struct device* dev)
+    {
+        auto* cfg = static_cast<const motion_sensor_spi_config*>(dev->config);
+        auto* data = static_cast<motion_sensor_spi_data*>(dev->data);
+        int err;
+
+        data->dev = dev;
+        if (!spi_is_ready_dt(&cfg->bus) or !gpio_is_ready_dt(&cfg->motion_gpio))
+        {
+            return -ENODEV;
+        }
+        err = gpio_pin_configure_dt(&cfg->motion_gpio, GPIO_INPUT);
+        if (err)
+        {
+            return err;
+        }
+        gpio_init_callback(&data->motion_cb, motion_isr, BIT(cfg->motion_gpio.pin));
+        err = gpio_add_callback_dt(&cfg->motion_gpio, &data->motion_cb);
+        if (err)
+        {
+            return err;
+        }
+
+        err = write_register(dev, REG_POWER_UP_RESET, POWER_UP_RESET);
+        if (err)
+        {
+            LOG_ERR("Sensor reset failed (err %d)", err);
+            return err;
+        }
+        k_msleep(50);
+        // clear the motion registers
+        for (uint8_t reg = REG_MOTION; reg <= REG_DELTA_Y_H; reg++)
+        {
+            uint8_t value;
+            read_register(dev, reg, &value);
+        }
+        // writing the burst register (any value) activates the burst mode
+        return write_register(dev, REG_MOTION_BURST, 0);
+    }
+
+    static const struct motion_sensor_driver_api motion_sensor_spi_api = {
+        .read = motion_sensor_spi_read,
+        .set_handler = motion_sensor_spi_set_handler,
+    };
+
+#define MOTION_SENSOR_SPI_OPERATION                                                                \
+    (SPI_OP_MODE_MASTER | SPI_WORD_SET(8) | SPI_TRANSFER_MSB | SPI_MODE_CPOL | SPI_MODE_CPHA |     \
+     SPI_HOLD_ON_CS | SPI_LOCK_ON)
+
+#define MOTION_SENSOR_SPI_DEFINE(n)                                                                \
+    static const struct motion_sensor_spi_config motion_sensor_spi_config_##n = {                  \
+        .bus = SPI_DT_SPEC_INST_GET(n, MOTION_SENSOR_SPI_OPERATION, 0),                            \
+        .motion_gpio = GPIO_DT_SPEC_INST_GET(n, motion_gpios),                                     \
+    };                                                                                             \
+    static struct motion_sensor_spi_data motion_sensor_spi_data_##n;                               \
+    DEVICE_DT_INST_DEFINE(n, motion_sensor_spi_init, NULL, &motion_sensor_spi_data_##n,            \
+                          &motion_sensor_spi_config_##n, POST_KERNEL,                              \
+                          CONFIG_DEMO_MOTION_SENSOR_INIT_PRIORITY, &motion_sensor_spi_api);
+
+    DT_INST_FOREACH_STATUS_OKAY(MOTION_SENSOR_SPI_DEFINE)
+}
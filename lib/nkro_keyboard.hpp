@@ -0,0 +1,401 @@
+#ifndef __NKRO_KEYBOARD_HPP__
+#define __NKRO_KEYBOARD_HPP__
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <event_trace.h>
+#include <functional>
+#include <key_state.hpp>
+#include <report_queue.hpp>
+#include <zephyr/kernel.h>
+
+#include <hid/app/keyboard.hpp>
+#include <hid/application.hpp>
+#include <hid/report_protocol.hpp>
+
+/// @brief N-key-rollover keyboard, reporting every key state as one bit in a bitmap.
+///        Key changes are applied to the live state with @ref set_key, and @ref send
+///        transmits the whole state at once, only if it differs from the last queued report.
+///        The reports are queued for transports that accept multiple in flight,
+///        a state change while all queue slots are in flight is sent on the next completion,
+///        a second change of the same key waits for the first one to be queued,
+///        see @ref key_state.
+///        In boot protocol mode the bitmap is converted to the 6KRO boot keyboard report.
+/// @tparam REPORT_ID the report ID to use for the keyboard reports
+/// @tparam LAST_KEY the last keyboard usage that is reported (the modifiers are always included),
+///         the default covers the whole ANSI/ISO layout while staying within the BLE default MTU
+/// @tparam QUEUE_DEPTH the number of reports that can be queued or in flight, a power of 2
+template <uint8_t REPORT_ID = 0, uint8_t LAST_KEY = 0x67, std::size_t QUEUE_DEPTH = 1>
+class nkro_keyboard : public hid::application
+{
+    static_assert(((LAST_KEY + 1) % 8) == 0, "the key bitmap must be byte aligned");
+    static constexpr uint8_t FIRST_MODIFIER = 0xe0;
+    static constexpr uint8_t LAST_MODIFIER = 0xe7;
+    static constexpr uint8_t ERROR_ROLL_OVER = 0x01;
+    static constexpr uint8_t FIRST_KEY = 0x04;
+
+  public:
+    static constexpr std::size_t KEY_COUNT = LAST_KEY + 1;
+
+    template <uint8_t ID>
+    struct keys_report : public hid::report::base<hid::report::type::INPUT, ID>
+    {
+        uint8_t modifiers{};
+        std::array<uint8_t, KEY_COUNT / 8> bitmap{};
+
+        bool operator==(const keys_report& other) const
+        {
+            return (modifiers == other.modifiers) and (bitmap == other.bitmap);
+        }
+    };
+    using kb_keys_report = keys_report<REPORT_ID>;
+    using kb_leds_report = hid::app::keyboard::output_report<REPORT_ID>;
+
+    /// @brief Fixed layout boot keyboard report, without report ID.
+    struct boot_keys_report
+    {
+        uint8_t modifiers{};
+        uint8_t reserved{};
+        std::array<uint8_t, 6> scancodes{};
+    };
+
+    using queue_type =
+        report_queue<std::max(sizeof(kb_keys_report), sizeof(boot_keys_report)), QUEUE_DEPTH>;
+    /// @brief The modifier bits, followed by the key bitmap.
+    using state_type = key_state<1 + KEY_COUNT / 8>;
+
+    static constexpr auto report_desc()
+    {
+        using namespace hid::page;
+        using namespace hid::rdf;
+
+        // clang-format off
+        return descriptor(
+            usage_page<generic_desktop>(),
+            usage(generic_desktop::KEYBOARD),
+            collection::application(
+                conditional_report_id<REPORT_ID>(),
+                report_size(1),
+                logical_limits<1, 1>(0, 1),
+                usage_page<keyboard_keypad>(),
+
+                // modifier bits
+                report_count(8),
+                usage_limits(keyboard_keypad(FIRST_MODIFIER), keyboard_keypad(LAST_MODIFIER)),
+                input::absolute_variable(),
+
+                // key bitmap
+                report_count(KEY_COUNT),
+                usage_limits(keyboard_keypad(0), keyboard_keypad(LAST_KEY)),
+                input::absolute_variable(),
+
+                hid::app::keyboard::leds_output_report_descriptor<REPORT_ID>()
+            )
+        );
+        // clang-format on
+    }
+
+    static const hid::report_protocol& report_prot()
+    {
+        static constexpr const auto rd{report_desc()};
+        static constexpr const hid::report_protocol rp{rd};
+        return rp;
+    }
+
+    template <typename TCallback>
+    nkro_keyboard(TCallback&& leds_cb)
+        : hid::application(report_prot()), leds_cb_(std::forward<TCallback>(leds_cb))
+    {}
+
+    /// @brief Updates the live key state, without sending it.
+    ///        A change of a key whose previous change isn't queued yet is held back until it is.
+    /// @return false if the key cannot be represented in the report
+    bool set_key(hid::page::keyboard_keypad key, bool pressed)
+    {
+        auto code = static_cast<uint8_t>(key);
+        std::size_t index;
+        if ((code >= FIRST_MODIFIER) and (code <= LAST_MODIFIER))
+        {
+            index = code - FIRST_MODIFIER;
+        }
+        else if (code <= LAST_KEY)
+        {
+            index = 8 + code;
+        }
+        else
+        {
+            return false;
+        }
+        auto key_lock = k_spin_lock(&lock_);
+        keys_.change(index, pressed);
+        k_spin_unlock(&lock_, key_lock);
+        return true;
+    }
+
+    /// @brief Sends the live key state, if it differs from the last queued report.
+    /// @param tag identifies the oldest change in the report once it completes,
+    ///        see @ref in_report_completed, 0 if unused
+    hid::result send(uint32_t tag = 0)
+    {
+        auto key_lock = k_spin_lock(&lock_);
+        if (tag_ == 0)
+        {
+            tag_ = tag;
+        }
+        enqueue();
+        return transmit(key_lock);
+    }
+
+    /// @brief Sends the live key state even if it was already queued, e.g. to a new host.
+    hid::result resend()
+    {
+        auto key_lock = k_spin_lock(&lock_);
+        resend_ = true;
+        enqueue();
+        return transmit(key_lock);
+    }
+
+    /// @brief Drops the reports that aren't in flight yet, and sends the live key state
+    ///        instead, e.g. to a host that became ready after the queued changes.
+    hid::result resync()
+    {
+        auto key_lock = k_spin_lock(&lock_);
+        queue_.discard_pending();
+        keys_.restart();
+        tag_ = 0;
+        resend_ = true;
+        enqueue();
+        return transmit(key_lock);
+    }
+
+    auto send_key(hid::page::keyboard_keypad key, bool pressed)
+    {
+        set_key(key, pressed);
+        return send();
+    }
+
+    const kb_leds_report& leds_report() const { return leds_; }
+
+    /// @brief Starts on a (new) transport: the live key state is kept, the keys held
+    ///        through e.g. a transport switch stay pressed, and it's sent right away.
+    void start(hid::protocol prot) override
+    {
+        auto key_lock = k_spin_lock(&lock_);
+        prot_ = prot;
+        keys_.restart();
+        queue_.clear();
+        tag_ = 0;
+        // a transmit() of the previous transport may still be in transmit_report(),
+        // it finds the epoch changed and leaves the new queue alone
+        epoch_++;
+        transmitting_ = false;
+        k_spin_unlock(&lock_, key_lock);
+        receive_report(std::span<uint8_t>(leds_.data(), sizeof(leds_)));
+        resend();
+    }
+
+    void stop() override {}
+
+    void set_report(hid::report::type type, const std::span<const uint8_t>& data) override
+    {
+        if ((type == hid::report::type::OUTPUT) and !data.empty())
+        {
+            // boot protocol LED reports never have a report ID, only copy the LED bits
+            *(leds_.data() + sizeof(leds_) - 1) = data.back();
+            leds_cb_(leds_);
+        }
+        receive_report(std::span<uint8_t>(leds_.data(), sizeof(leds_)));
+    }
+
+    void get_report(hid::report::selector select, const std::span<uint8_t>& buffer) override
+    {
+        if (select.type() == hid::report::type::OUTPUT)
+        {
+            send_report(std::span<const uint8_t>(leds_.data(), sizeof(leds_)),
+                        hid::report::type::OUTPUT);
+            return;
+        }
+        // answered on the control pipe, independently of the interrupt transfers
+        auto key_lock = k_spin_lock(&lock_);
+        auto bits = keys_.live();
+        auto prot = prot_;
+        k_spin_unlock(&lock_, key_lock);
+        std::size_t size;
+        if (prot == hid::protocol::REPORT)
+        {
+            auto keys = to_report(bits);
+            size = std::min(sizeof(keys), buffer.size());
+            std::memcpy(buffer.data(), keys.data(), size);
+        }
+        else
+        {
+            auto boot_keys = to_boot_report(bits);
+            size = std::min(sizeof(boot_keys), buffer.size());
+            std::memcpy(buffer.data(), &boot_keys, size);
+        }
+        send_report(buffer.subspan(0, size));
+    }
+
+    void in_report_sent(const std::span<const uint8_t>& data) override
+    {
+        event_trace(EVENT_TRACE_REPORT_SENT, data.size());
+        reports_sent_++;
+        auto key_lock = k_spin_lock(&lock_);
+        auto tag = queue_.completed();
+        enqueue();
+        transmit(key_lock);
+        if (tag != 0)
+        {
+            in_report_completed(tag);
+        }
+    }
+
+    hid::protocol get_protocol() const override { return prot_; }
+
+    /// @brief Whether every queue slot is in flight, a new report waits for a completion.
+    bool busy()
+    {
+        auto key_lock = k_spin_lock(&lock_);
+        bool busy = queue_.in_flight() == QUEUE_DEPTH;
+        k_spin_unlock(&lock_, key_lock);
+        return busy;
+    }
+
+    /// @brief The number of completed input report transfers.
+    uint32_t reports_sent() const { return reports_sent_; }
+
+    typename queue_type::statistics queue_stats()
+    {
+        auto key_lock = k_spin_lock(&lock_);
+        auto stats = queue_.stats();
+        k_spin_unlock(&lock_, key_lock);
+        return stats;
+    }
+
+  protected:
+    /// @brief Called when a report has been sent, with the tag of its oldest change.
+    virtual void in_report_completed(uint32_t tag) {}
+
+    /// @brief Passes a queued input report to the transport,
+    ///        overridden when the application picks the destination of each report.
+    virtual hid::result transmit_report(const std::span<const uint8_t>& data)
+    {
+        return send_report(data);
+    }
+
+  private:
+    static kb_keys_report to_report(const typename state_type::bits_type& bits)
+    {
+        kb_keys_report keys{};
+        keys.modifiers = bits[0];
+        std::memcpy(keys.bitmap.data(), bits.data() + 1, keys.bitmap.size());
+        return keys;
+    }
+
+    /// @brief Converts the key state to the 6KRO boot keyboard report.
+    static boot_keys_report to_boot_report(const typename state_type::bits_type& bits)
+    {
+        boot_keys_report boot_keys{};
+        boot_keys.modifiers = bits[0];
+        std::size_t count = 0;
+        for (std::size_t code = FIRST_KEY; code < KEY_COUNT; code++)
+        {
+            if (!state_type::test_bit(bits, 8 + code))
+            {
+                continue;
+            }
+            if (count == boot_keys.scancodes.size())
+            {
+                boot_keys.scancodes.fill(ERROR_ROLL_OVER);
+                break;
+            }
+            boot_keys.scancodes[count++] = code;
+        }
+        return boot_keys;
+    }
+
+    /// @brief Snapshots the live state into queue slots, as long as it changes (or a resend
+    ///        is due) and a slot is available, must be called locked.
+    ///        When all slots are in flight, the state is queued on the next completion.
+    void enqueue()
+    {
+        auto commit = [this](std::span<uint8_t> buffer, const auto& bits)
+        {
+            commit_snapshot(buffer, bits);
+        };
+        while ((resend_ or keys_.changed()) and keys_.snapshot(queue_, commit))
+        {
+            resend_ = false;
+        }
+    }
+
+    void commit_snapshot(std::span<uint8_t> buffer, const typename state_type::bits_type& bits)
+    {
+        if (prot_ == hid::protocol::REPORT)
+        {
+            auto keys = to_report(bits);
+            std::memcpy(buffer.data(), keys.data(), sizeof(keys));
+            queue_.commit(sizeof(keys), tag_);
+        }
+        else
+        {
+            auto boot_keys = to_boot_report(bits);
+            std::memcpy(buffer.data(), &boot_keys, sizeof(boot_keys));
+            queue_.commit(sizeof(boot_keys), tag_);
+        }
+        tag_ = 0;
+    }
+
+    /// @brief Passes the pending reports to the transport, until it accepts no more.
+    ///        Must be called locked, and unlocks. Only one context transmits at a time,
+    ///        so a refused report can be put back, and is retried with the next send or
+    ///        completion. A restart by @ref start while the lock is released ends it.
+    hid::result transmit(k_spinlock_key_t key_lock)
+    {
+        auto result = hid::result::OK;
+        if (transmitting_)
+        {
+            k_spin_unlock(&lock_, key_lock);
+            return result;
+        }
+        transmitting_ = true;
+        auto epoch = epoch_;
+        for (auto data = queue_.next(); !data.empty(); data = queue_.next())
+        {
+            // in flight before sending, as the completion may arrive before send_report returns
+            queue_.transmitted();
+            k_spin_unlock(&lock_, key_lock);
+            event_trace(EVENT_TRACE_REPORT_SEND, data.size());
+            result = transmit_report(data);
+            key_lock = k_spin_lock(&lock_);
+            if (epoch != epoch_)
+            {
+                // the queue and the transmitting flag belong to the new transport now
+                k_spin_unlock(&lock_, key_lock);
+                return result;
+            }
+            if (result != hid::result::OK)
+            {
+                queue_.untransmitted();
+                break;
+            }
+        }
+        transmitting_ = false;
+        k_spin_unlock(&lock_, key_lock);
+        return result;
+    }
+
+    queue_type queue_{};
+    alignas(4) kb_leds_report leds_{};
+    state_type keys_{};
+    std::function<void(const kb_leds_report&)> leds_cb_;
+    k_spinlock lock_{};
+    hid::protocol prot_{};
+    bool transmitting_{};
+    bool resend_{};
+    uint32_t epoch_{}; // counts the starts
+    uint32_t tag_{};
+    uint32_t reports_sent_{};
+};
+
+#endif // __NKRO_KEYBOARD_HPP__
@@ -0,0 +1,243 @@
+#include <ram_budget.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net_buf.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/iterable_sections.h>
+#include <zephyr/sys/sys_heap.h>
+
+LOG_MODULE_REGISTER(ram_budget, LOG_LEVEL_INF);
+
+extern "C"
+{
+    // the variable sized pool of the UDC endpoints, its size is CONFIG_UDC_BUF_POOL_SIZE
+    static constexpr const char* udc_pool_name = "udc_ep_pool";
+
+    struct pool_usage
+    {
+        const char* name;
+        uint16_t count;
+        uint16_t max_used;
+        // only known for variable sized data pools
+        size_t data_size;
+        size_t max_data_used;
+    };
+
+    static pool_usage get_usage(struct net_buf_pool* pool)
+    {
+        pool_usage usage{pool->name, pool->pool_size, pool->max_used, 0, 0};
+        if (pool->alloc->cb == &net_buf_var_cb)
+        {
+            auto* heap = static_cast<struct k_heap*>(pool->alloc->alloc_data);
+            struct sys_memory_stats stats;
+            if (sys_heap_runtime_stats_get(&heap->heap, &stats) == 0)
+            {
+                usage.data_size = stats.free_bytes + stats.allocated_bytes;
+                usage.max_data_used = stats.max_allocated_bytes;
+            }
+        }
+        return usage;
+    }
+
+    /// @brief The recommended pool size: the peak allocation and a 25% margin
+    ///        for the heap fragmentation, rounded up to whole words.
+    static size_t recommended_data_size(const pool_usage& usage)
+    {
+        return ROUND_UP(usage.max_data_used + usage.max_data_used / 4, sizeof(void*));
+    }
+
+    /// @brief The recommended buffer count: the peak with one buffer of headroom,
+    ///        the peak is only the highest count seen during the test.
+    static unsigned recommended_buf_count(const pool_usage& usage)
+    {
+        return usage.max_used + 1;
+    }
+
+#if CONFIG_SHELL
+#define RAM_BUDGET_PRINT(sh, ...)                                                                  \
+    do                                                                                             \
+    {                                                                                              \
+        if ((sh) != nullptr)                                                                       \
+        {                                                                                          \
+            shell_print((sh), __VA_ARGS__);                                                        \
+        }                                                                                          \
+        else                                                                                       \
+        {                                                                                          \
+            LOG_INF(__VA_ARGS__);                                                                  \
+        }                                                                                          \
+    } while (0)
+#else
+#define RAM_BUDGET_PRINT(sh, ...) LOG_INF(__VA_ARGS__)
+#endif
+
+    /// @brief Prints to the shell, or to the log when there is no shell.
+    static void report(const struct shell* sh)
+    {
+        STRUCT_SECTION_FOREACH(net_buf_pool, pool)
+        {
+            auto usage = get_usage(pool);
+            if (usage.data_size > 0)
+            {
+                RAM_BUDGET_PRINT(sh, "%s: %u/%u buffers, %zu/%zu data bytes used at peak",
+                                 usage.name, usage.max_used, usage.count, usage.max_data_used,
+                                 usage.data_size);
+            }
+            else
+            {
+                RAM_BUDGET_PRINT(sh, "%s: %u/%u buffers used at peak", usage.name,
+                                 usage.max_used, usage.count);
+            }
+            if ((usage.name != nullptr) and (strcmp(usage.name, udc_pool_name) == 0))
+            {
+                RAM_BUDGET_PRINT(sh, "recommended: CONFIG_UDC_BUF_COUNT=%u "
+                                     "CONFIG_UDC_BUF_POOL_SIZE=%zu",
+                                 recommended_buf_count(usage), recommended_data_size(usage));
+            }
+        }
+    }
+
+#if CONFIG_DEMO_RAM_PROFILE
+    struct tracked_queue
+    {
+        const char* kconfig;
+        size_t capacity;
+        ram_budget_peak_fn peak;
+        const void* queue;
+    };
+    static tracked_queue app_queues[4];
+    static size_t app_queue_count;
+
+    void ram_budget_track_queue(const char* kconfig, size_t capacity, ram_budget_peak_fn peak,
+                                const void* queue)
+    {
+        if (app_queue_count < ARRAY_SIZE(app_queues))
+        {
+            app_queues[app_queue_count++] = {kconfig, capacity, peak, queue};
+        }
+    }
+
+    // the kernel doesn't track the peak usage of the message queues,
+    // so it's sampled periodically, from an ISR that preempts the consumer threads
+    struct msgq_peak
+    {
+        const struct k_msgq* msgq;
+        uint32_t peak;
+    };
+    static msgq_peak msgq_peaks[CONFIG_DEMO_RAM_PROFILE_MAX_MSGQS];
+
+    static int sample_msgq(struct k_obj_core* obj_core, void*)
+    {
+        auto* msgq = CONTAINER_OF(obj_core, struct k_msgq, obj_core);
+        for (auto& p : msgq_peaks)
+        {
+            if (p.msgq == nullptr)
+            {
+                p.msgq = msgq;
+            }
+            if (p.msgq == msgq)
+            {
+                p.peak = MAX(p.peak, msgq->used_msgs);
+                break;
+            }
+        }
+        return 0;
+    }
+
+    static void sample_timer_handler(struct k_timer*)
+    {
+        k_obj_type_walk_locked(k_obj_type_find(K_OBJ_TYPE_MSGQ_ID), sample_msgq, nullptr);
+    }
+
+    K_TIMER_DEFINE(sample_timer, sample_timer_handler, NULL);
+
+    static int start_sampling(void)
+    {
+        k_timer_start(&sample_timer, K_USEC(CONFIG_DEMO_RAM_PROFILE_SAMPLE_US),
+                      K_USEC(CONFIG_DEMO_RAM_PROFILE_SAMPLE_US));
+        return 0;
+    }
+
+    SYS_INIT(start_sampling, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+
+    static void profile_thread(const struct k_thread* thread, void* user_data)
+    {
+        auto* sh = static_cast<const struct shell*>(user_data);
+        size_t unused;
+        if (k_thread_stack_space_get(thread, &unused) != 0)
+        {
+            return;
+        }
+        const char* name = k_thread_name_get(const_cast<struct k_thread*>(thread));
+        RAM_BUDGET_PRINT(sh, "profile thread %zu %zu %s", thread->stack_info.size,
+                         thread->stack_info.size - unused,
+                         ((name != nullptr) and (name[0] != '\0')) ? name : "?");
+    }
+
+    /// @brief Prints the high-water marks in the format of scripts/ram_profile.py,
+    ///        the thread and pool names are last, as they may contain spaces.
+    static void profile(const struct shell* sh)
+    {
+        RAM_BUDGET_PRINT(sh, "profile begin");
+        k_thread_foreach_unlocked(profile_thread, const_cast<struct shell*>(sh));
+        for (auto& p : msgq_peaks)
+        {
+            if (p.msgq != nullptr)
+            {
+                RAM_BUDGET_PRINT(sh, "profile msgq %zu %u %u %p", p.msgq->msg_size,
+                                 p.msgq->max_msgs, p.peak, p.msgq);
+            }
+        }
+        for (size_t i = 0; i < app_queue_count; i++)
+        {
+            auto& q = app_queues[i];
+            RAM_BUDGET_PRINT(sh, "profile queue %zu %zu %s", q.capacity, q.peak(q.queue),
+                             q.kconfig);
+        }
+        STRUCT_SECTION_FOREACH(net_buf_pool, pool)
+        {
+            auto usage = get_usage(pool);
+            RAM_BUDGET_PRINT(sh, "profile pool %u %u %zu %zu %s", usage.count, usage.max_used,
+                             usage.data_size, usage.max_data_used,
+                             (usage.name != nullptr) ? usage.name : "?");
+        }
+        RAM_BUDGET_PRINT(sh, "profile end");
+    }
+#endif // CONFIG_DEMO_RAM_PROFILE
+
+    void ram_budget_log(void)
+    {
+        report(nullptr);
+#if CONFIG_DEMO_RAM_PROFILE
+        profile(nullptr);
+#endif
+    }
+
+#if CONFIG_SHELL
+    static int cmd_ram_pools(const shell* sh, size_t argc, char** argv)
+    {
+        report(sh);
+        return 0;
+    }
+
+#if CONFIG_DEMO_RAM_PROFILE
+    static int cmd_ram_profile(const shell* sh, size_t argc, char** argv)
+    {
+        profile(sh);
+        return 0;
+    }
+#endif
+
+    SHELL_STATIC_SUBCMD_SET_CREATE(sub_ram,
+                                   SHELL_CMD(pools, NULL, "Print the peak net_buf pool usage",
+                                             cmd_ram_pools),
+#if CONFIG_DEMO_RAM_PROFILE
+                                   SHELL_CMD(profile, NULL,
+                                             "Print the stack and queue high-water marks, "
+                                             "for scripts/ram_profile.py",
+                                             cmd_ram_profile),
+#endif
+                                   SHELL_SUBCMD_SET_END);
+    SHELL_CMD_REGISTER(ram, &sub_ram, "RAM budget", NULL);
+#endif // CONFIG_SHELL
+}
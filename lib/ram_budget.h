@@ -0,0 +1,44 @@
+#ifndef __RAM_BUDGET_H__
+#define __RAM_BUDGET_H__
+#include <stddef.h>
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+
+    /**
+     * @brief Logs the peak usage of each net_buf pool since boot,
+     *        and the minimal UDC buffer count and pool size that would have sufficed.
+     *        Exercise all the functions of the configuration (enumeration, suspend, traffic)
+     *        before reading the values.
+     *        With CONFIG_DEMO_RAM_PROFILE the stack and queue high-water marks are logged as well.
+     */
+    void ram_budget_log(void);
+
+    /**
+     * @brief Callback returning the peak occupancy of an application queue.
+     */
+    typedef size_t (*ram_budget_peak_fn)(const void* queue);
+
+#if CONFIG_DEMO_RAM_PROFILE
+    /**
+     * @brief Adds an application queue to the high-water profile (CONFIG_DEMO_RAM_PROFILE),
+     *        the kernel message queues are tracked without registration.
+     * @param kconfig the Kconfig symbol of the queue depth, without the CONFIG_ prefix
+     * @param capacity the current queue depth
+     */
+    void ram_budget_track_queue(const char* kconfig, size_t capacity, ram_budget_peak_fn peak,
+                                const void* queue);
+#else
+    static inline void ram_budget_track_queue(const char* kconfig, size_t capacity,
+                                              ram_budget_peak_fn peak, const void* queue)
+    {
+    }
+#endif
+
+#if defined(__cplusplus)
+} // extern "C"
+#endif
+
+#endif // __RAM_BUDGET_H__
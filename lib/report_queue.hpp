@@ -0,0 +1,131 @@
+#ifndef __REPORT_QUEUE_HPP__
+#define __REPORT_QUEUE_HPP__
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+/// @brief FIFO of input report snapshots, between the application and a transport
+///        that accepts multiple reports in flight (e.g. BLE notifications filling one
+///        connection event). Each slot owns its buffer until the transport completes it,
+///        the reports complete in the order they were transmitted.
+///        The slots are either in flight, or pending transmission. When all slots are used,
+///        a new snapshot replaces the last pending one (merge), the owner checks @ref merging
+///        and skips the snapshot if the merge would lose a change of the pending one.
+///        Each slot carries a tag (e.g. the capture time of its oldest input event),
+///        a merged slot keeps the older tag. The methods aren't thread-safe, the owner locks.
+/// @tparam SIZE the maximum report size
+/// @tparam DEPTH the number of slots, a power of 2
+template <std::size_t SIZE, std::size_t DEPTH>
+class report_queue
+{
+    static_assert((DEPTH > 0) and ((DEPTH & (DEPTH - 1)) == 0), "DEPTH must be a power of 2");
+
+  public:
+    struct statistics
+    {
+        uint32_t queued;        // the snapshots that got a slot of their own
+        uint32_t merged;        // the snapshots that replaced a pending one
+        uint32_t max_in_flight; // the most reports the transport accepted at once
+    };
+
+    /// @brief Gets the slot for a new snapshot, which must be filled with @ref commit.
+    /// @return the buffer to fill, or empty if all slots are in flight
+    std::span<uint8_t> prepare()
+    {
+        if ((tail_ - head_) < DEPTH)
+        {
+            merging_ = false;
+            return std::span<uint8_t>(slot(tail_).data);
+        }
+        if (tail_ != sent_)
+        {
+            merging_ = true;
+            return std::span<uint8_t>(slot(tail_ - 1).data);
+        }
+        return {};
+    }
+
+    /// @return whether the slot given by @ref prepare is the last pending one, to be replaced
+    bool merging() const { return merging_; }
+
+    /// @brief Completes the snapshot in the slot given by @ref prepare.
+    void commit(std::size_t size, uint32_t tag)
+    {
+        if (merging_)
+        {
+            auto& s = slot(tail_ - 1);
+            s.size = size;
+            s.tag = (s.tag != 0) ? s.tag : tag;
+            stats_.merged++;
+            return;
+        }
+        auto& s = slot(tail_);
+        s.size = size;
+        s.tag = tag;
+        tail_++;
+        stats_.queued++;
+    }
+
+    /// @return the oldest pending report, or empty if there is none
+    std::span<const uint8_t> next() const
+    {
+        if (sent_ == tail_)
+        {
+            return {};
+        }
+        auto& s = slot(sent_);
+        return std::span<const uint8_t>(s.data.data(), s.size);
+    }
+
+    /// @brief Marks the report returned by @ref next as in flight.
+    void transmitted()
+    {
+        sent_++;
+        stats_.max_in_flight = std::max(stats_.max_in_flight, in_flight());
+    }
+
+    /// @brief Puts back the report that the transport refused, it's the next one again.
+    void untransmitted() { sent_--; }
+
+    /// @brief Releases the oldest report in flight.
+    /// @return its tag
+    uint32_t completed()
+    {
+        if (head_ == sent_)
+        {
+            return 0;
+        }
+        return slot(head_++).tag;
+    }
+
+    /// @brief Drops the reports pending transmission, the ones in flight still complete.
+    void discard_pending() { tail_ = sent_; }
+
+    void clear() { head_ = sent_ = tail_ = 0; }
+
+    uint32_t in_flight() const { return sent_ - head_; }
+    uint32_t pending() const { return tail_ - sent_; }
+    const statistics& stats() const { return stats_; }
+
+  private:
+    struct entry
+    {
+        alignas(4) std::array<uint8_t, SIZE> data;
+        std::size_t size;
+        uint32_t tag;
+    };
+
+    entry& slot(uint32_t index) { return slots_[index % DEPTH]; }
+    const entry& slot(uint32_t index) const { return slots_[index % DEPTH]; }
+
+    std::array<entry, DEPTH> slots_{};
+    uint32_t head_{}; // the oldest in flight
+    uint32_t sent_{}; // the oldest pending
+    uint32_t tail_{}; // the next free
+    statistics stats_{};
+    bool merging_{};
+};
+
+#endif // __REPORT_QUEUE_HPP__
@@ -0,0 +1,43 @@
+#ifndef __USB_ENDPOINT_BUDGET_HPP__
+#define __USB_ENDPOINT_BUDGET_HPP__
+#include <cstddef>
+#include <cstdint>
+
+#include <usb/base.hpp>
+
+namespace demo
+{
+/// @brief Assigns the endpoint addresses of a configuration at compile time,
+///        and calculates the UDC buffers the configuration needs.
+///        IN and OUT endpoints are numbered from 1 in the order of their indexes,
+///        so each function only needs to list its endpoints in an enum.
+/// @tparam IN_COUNT the number of IN endpoints in the configuration (besides control)
+/// @tparam OUT_COUNT the number of OUT endpoints in the configuration (besides control)
+template <std::size_t IN_COUNT, std::size_t OUT_COUNT>
+struct endpoint_budget
+{
+    static_assert((IN_COUNT < 16) and (OUT_COUNT < 16), "too many endpoints");
+
+    static constexpr usb::endpoint::address in(std::size_t index)
+    {
+        return usb::endpoint::address(static_cast<uint8_t>(0x81 + index));
+    }
+    static constexpr usb::endpoint::address out(std::size_t index)
+    {
+        return usb::endpoint::address(static_cast<uint8_t>(0x01 + index));
+    }
+
+    static constexpr std::size_t count = IN_COUNT + OUT_COUNT;
+
+    // the control endpoint uses the rest, see the RAM optimization notes in the prj.conf files
+    static constexpr std::size_t udc_buf_count = 3 + count;
+
+#ifdef CONFIG_UDC_BUF_COUNT
+    static_assert(udc_buf_count <= CONFIG_UDC_BUF_COUNT,
+                  "CONFIG_UDC_BUF_COUNT is too low for the endpoints of the configuration");
+#endif
+};
+
+} // namespace demo
+
+#endif // __USB_ENDPOINT_BUDGET_HPP__
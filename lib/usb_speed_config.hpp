@@ -0,0 +1,74 @@
+#ifndef __USB_SPEED_CONFIG_HPP__
+#define __USB_SPEED_CONFIG_HPP__
+#include <algorithm>
+#include <cstdint>
+#include <zephyr/sys/util.h>
+
+#include <usb/base.hpp>
+
+namespace demo
+{
+/// @brief The maximal USB device speed, as selected in Kconfig.
+constexpr auto usb_max_speed =
+    IS_ENABLED(CONFIG_DEMO_USB_HIGH_SPEED) ? usb::speed::HIGH : usb::speed::FULL;
+
+/// @brief Encodes the interrupt endpoint bInterval field for the given bus speed.
+///        High-speed polls every 2^(bInterval-1) microframes of 125us,
+///        full-speed polls every bInterval frames of 1ms.
+/// @param interval_us the requested polling interval, rounded down to the nearest valid value
+constexpr uint8_t interrupt_interval(usb::speed speed, unsigned interval_us)
+{
+    if (speed == usb::speed::HIGH)
+    {
+        uint8_t binterval = 1;
+        while ((binterval < 16) and ((125u << binterval) <= interval_us))
+        {
+            binterval++;
+        }
+        return binterval;
+    }
+    return std::clamp(interval_us / 1000u, 1u, 255u);
+}
+
+/// @brief The HID interrupt IN endpoint bInterval, as selected in Kconfig.
+constexpr uint8_t hid_in_interval(usb::speed speed)
+{
+    return interrupt_interval(speed, CONFIG_DEMO_HID_POLL_INTERVAL_US);
+}
+
+#if CONFIG_DEMO_HID_OUTPUT_INTERRUPT
+/// @brief The HID interrupt OUT endpoint bInterval, as selected in Kconfig.
+constexpr uint8_t hid_out_interval(usb::speed speed)
+{
+    return interrupt_interval(speed, CONFIG_DEMO_HID_OUT_POLL_INTERVAL_US);
+}
+#endif
+
+/// @brief Builds and registers the device configuration of each supported bus speed.
+///        The endpoint sizes and the bInterval encoding depend on the speed, so a high-speed
+///        capable device also gets a separate full-speed configuration, which is used
+///        on full-speed hosts, and reported as the other speed configuration.
+/// @param make returns the configuration for the bus speed it's called with
+template <typename TDevice, typename TMake>
+void set_speed_configs(TDevice& dev, TMake&& make)
+{
+    static const auto fs_config = make(usb::speed::FULL);
+    if constexpr (usb_max_speed == usb::speed::HIGH)
+    {
+        static const auto hs_config = make(usb::speed::HIGH);
+        dev.set_config(hs_config, fs_config);
+    }
+    else
+    {
+        dev.set_config(fs_config);
+    }
+}
+
+static_assert(interrupt_interval(usb::speed::HIGH, 125) == 1);
+static_assert(interrupt_interval(usb::speed::HIGH, 1000) == 4);
+static_assert(interrupt_interval(usb::speed::FULL, 125) == 1);
+static_assert(interrupt_interval(usb::speed::FULL, 10000) == 10);
+
+} // namespace demo
+
+#endif // __USB_SPEED_CONFIG_HPP__
@@ -0,0 +1,266 @@
+#ifndef __USB_SUSPEND_HPP__
+#define __USB_SUSPEND_HPP__
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <event_trace.h>
+#include <span>
+#include <zephyr/kernel.h>
+#include <zephyr/sys/time_units.h>
+
+#include <hid/application.hpp>
+#include <usb/df/device.hpp>
+
+/// @brief Handles the suspend / resume cycle of a USB HID device:
+///        The remote wakeup is signalled right from the input edge, instead of waiting
+///        for the application thread to dequeue the event.
+///        The application thread waits for the bus to resume before sending, the input events
+///        arriving meanwhile stay in its queue, and are replayed in order once resumed.
+///        The feature and output reports set by the host are kept, and restored to the
+///        application when the bus is suspended right after a reset. Some Linux hosts produce
+///        this sequence when waking up (on a subset of USB ports):
+///        1. L2 -> L0
+///        2. USB reset
+///        3. L0 -> L2
+///        4. L2 -> L0
+///        5. USB re-enumeration, this time without setting the reports again
+///        The latency from the input edge to the resume and to the first sent report is measured.
+/// @tparam SLOTS the number of distinct reports kept
+/// @tparam SIZE the size of the largest kept report
+template <std::size_t SLOTS = 4, std::size_t SIZE = 8>
+class usb_suspend_manager
+{
+  public:
+    struct statistics
+    {
+        uint32_t wakeups;           // the remote wakeups signalled
+        uint32_t wakeup_failures;   // the remote wakeups the device refused to signal
+        int last_wakeup_error;      // the result of the last refused remote wakeup
+        uint32_t restores;          // the report restorations after a reset
+        uint32_t last_resume_us;    // from the input edge until the bus resumed
+        uint32_t max_resume_us;
+        uint32_t last_report_us;    // from the input edge until the first report was sent
+        uint32_t max_report_us;
+    };
+
+    /// @param report_ids whether the application's reports start with a report ID,
+    ///        otherwise a single report is kept per type
+    usb_suspend_manager(usb::df::device& dev, hid::application& app, bool report_ids = false)
+        : dev_(dev), app_(app), report_ids_(report_ids)
+    {
+        wakeup_.self = this;
+        k_work_init(&wakeup_.work, wakeup_handler);
+        k_sem_init(&resumed_, 0, 1);
+    }
+
+    bool suspended() const { return dev_.power_state() == usb::power::state::L2_SUSPEND; }
+
+    /// @brief Signals remote wakeup on a new input, can be called from any context.
+    /// @param timestamp the capture time of the input, from k_cycle_get_32()
+    void input_edge(uint32_t timestamp = k_cycle_get_32())
+    {
+        if (!suspended() or waking_.exchange(true))
+        {
+            return;
+        }
+        wake_time_ = timestamp;
+        if (k_is_in_isr())
+        {
+            k_work_submit(&wakeup_.work);
+        }
+        else
+        {
+            wakeup();
+        }
+    }
+
+    /// @brief Blocks the application thread until the bus is resumed by a remote wakeup.
+    /// @return false if the bus is suspended without a remote wakeup in progress,
+    ///         or the host didn't resume it in time
+    bool wait_active(k_timeout_t timeout)
+    {
+        auto end = sys_timepoint_calc(timeout);
+        while (suspended())
+        {
+            if (!waking_.load())
+            {
+                return false;
+            }
+            if (k_sem_take(&resumed_, sys_timepoint_timeout(end)) != 0)
+            {
+                // let the next input edge signal remote wakeup again
+                waking_.store(false);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @brief Tracks the bus state, call from the device's power event delegate.
+    void power_event(usb::df::device::event ev)
+    {
+        using event = enum usb::df::device::event;
+        auto now = k_cycle_get_32();
+
+        if (ev == event::CONFIGURATION_CHANGE)
+        {
+            if (!dev_.configured())
+            {
+                reset_time_ = now;
+                reset_pending_ = true;
+            }
+            return;
+        }
+        event_trace(EVENT_TRACE_POWER_STATE, static_cast<uint16_t>(dev_.power_state()));
+        if (suspended())
+        {
+            if (!dev_.configured() and reset_pending_ and
+                (k_cyc_to_ms_floor32(now - reset_time_) < CONFIG_DEMO_USB_RESET_RESTORE_MS))
+            {
+                restore();
+            }
+            reset_pending_ = false;
+            return;
+        }
+        if (waking_.load())
+        {
+            auto resume_us = k_cyc_to_us_floor32(now - wake_time_);
+            auto key = k_spin_lock(&lock_);
+            stats_.last_resume_us = resume_us;
+            stats_.max_resume_us = std::max(stats_.max_resume_us, resume_us);
+            k_spin_unlock(&lock_, key);
+            awaiting_report_.store(true);
+            waking_.store(false);
+        }
+        k_sem_give(&resumed_);
+    }
+
+    /// @brief Keeps a report set by the host, call from the application's set_report().
+    void save_report(hid::report::type type, const std::span<const uint8_t>& data)
+    {
+        if ((type == hid::report::type::INPUT) or data.empty() or (data.size() > SIZE))
+        {
+            return;
+        }
+        auto key = k_spin_lock(&lock_);
+        saved_report* slot = nullptr;
+        for (auto& r : reports_)
+        {
+            if ((r.size > 0) and (r.type == type) and (!report_ids_ or (r.data[0] == data[0])))
+            {
+                slot = &r;
+                break;
+            }
+            if ((slot == nullptr) and (r.size == 0))
+            {
+                slot = &r;
+            }
+        }
+        if (slot != nullptr)
+        {
+            slot->type = type;
+            slot->size = data.size();
+            std::memcpy(slot->data.data(), data.data(), data.size());
+        }
+        k_spin_unlock(&lock_, key);
+    }
+
+    /// @brief Signals a sent input report, call from the application's in_report_sent().
+    void report_sent()
+    {
+        if (!awaiting_report_.exchange(false))
+        {
+            return;
+        }
+        auto report_us = k_cyc_to_us_floor32(k_cycle_get_32() - wake_time_);
+        auto key = k_spin_lock(&lock_);
+        stats_.last_report_us = report_us;
+        stats_.max_report_us = std::max(stats_.max_report_us, report_us);
+        k_spin_unlock(&lock_, key);
+    }
+
+    statistics stats() const
+    {
+        auto key = k_spin_lock(&lock_);
+        auto stats = stats_;
+        k_spin_unlock(&lock_, key);
+        return stats;
+    }
+
+  private:
+    struct saved_report
+    {
+        alignas(4) std::array<uint8_t, SIZE> data;
+        std::size_t size;
+        hid::report::type type;
+    };
+
+    struct wakeup_work
+    {
+        k_work work;
+        usb_suspend_manager* self;
+    };
+
+    static void wakeup_handler(k_work* work)
+    {
+        CONTAINER_OF(work, wakeup_work, work)->self->wakeup();
+    }
+
+    void wakeup()
+    {
+        auto result = dev_.remote_wakeup();
+        bool failed = result != decltype(result){};
+        auto key = k_spin_lock(&lock_);
+        if (failed)
+        {
+            stats_.wakeup_failures++;
+            stats_.last_wakeup_error = static_cast<int>(result);
+        }
+        else
+        {
+            stats_.wakeups++;
+        }
+        k_spin_unlock(&lock_, key);
+        if (failed)
+        {
+            // e.g. the host didn't enable remote wakeup: the application thread stops
+            // waiting for the resume, and the next input edge tries again
+            waking_.store(false);
+            k_sem_give(&resumed_);
+        }
+    }
+
+    /// @brief Replays the kept reports, as if the host had set them again.
+    void restore()
+    {
+        auto key = k_spin_lock(&lock_);
+        auto reports = reports_;
+        stats_.restores++;
+        k_spin_unlock(&lock_, key);
+        for (auto& r : reports)
+        {
+            if (r.size > 0)
+            {
+                app_.set_report(r.type, std::span<const uint8_t>(r.data.data(), r.size));
+            }
+        }
+    }
+
+    usb::df::device& dev_;
+    hid::application& app_;
+    std::array<saved_report, SLOTS> reports_{};
+    wakeup_work wakeup_{};
+    k_sem resumed_{};
+    mutable k_spinlock lock_{};
+    statistics stats_{};
+    uint32_t wake_time_{};
+    uint32_t reset_time_{};
+    std::atomic<bool> waking_{};
+    std::atomic<bool> awaiting_report_{};
+    bool reset_pending_{};
+    bool report_ids_;
+};
+
+#endif // __USB_SUSPEND_HPP__
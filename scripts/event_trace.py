@@ -0,0 +1,138 @@
+# SPDX-License-Identifier: MIT
+"""
+Converts the output of the "trace dump" shell command (CONFIG_DEMO_EVENT_TRACE)
+to the Chrome JSON trace format, which the Perfetto UI (https://ui.perfetto.dev) opens.
+
+The input may be a whole console log, only the lines of the dump are used:
+  trace begin: <cycles/s> Hz, <records> records, <lost> lost
+  trace <timestamp in hex cycles> <event id> <argument in hex>
+  trace end
+The HID reports become slices from their send to their completion, the key queue depth
+and the USB power state become counters, the other events are instants.
+A record written by an interrupt may precede the one of the preempted thread in the ring,
+with a later timestamp, so the records are put in time order before conversion.
+
+Usage: event_trace.py <console log> [-o trace.json]
+"""
+import argparse
+import json
+import re
+import sys
+from collections import deque
+
+# see enum event_trace_id in lib/event_trace.h
+INPUT_EDGE = 1
+QUEUE_POST = 2
+QUEUE_GET = 3
+REPORT_SEND = 4
+REPORT_SENT = 5
+POWER_STATE = 6
+BLE_NOTIFY = 7
+
+# usb::power::state
+POWER_STATES = {0: 'L0_ON', 1: 'L1_SLEEP', 2: 'L2_SUSPEND', 3: 'L3_OFF'}
+
+TRACKS = {'input': 1, 'queue': 2, 'reports': 3, 'power': 4, 'ble': 5}
+
+
+def parse_dump(lines):
+    """Returns the cycle frequency and the (timestamp, id, arg) records of the last dump."""
+    frequency = None
+    records = None
+    for line in lines:
+        m = re.search(r'trace begin: (\d+) Hz', line)
+        if m:
+            frequency = int(m.group(1))
+            records = []
+            continue
+        if records is None:
+            continue
+        m = re.search(r'trace ([0-9a-fA-F]{8}) (\d+) ([0-9a-fA-F]{4})', line)
+        if m:
+            records.append((int(m.group(1), 16), int(m.group(2)), int(m.group(3), 16)))
+    if frequency is None:
+        sys.exit('no "trace dump" output found')
+    return frequency, records
+
+
+def unwrap(records):
+    """Extends the 32-bit cycle counter of the records, and sorts them by time.
+    Each timestamp is taken relative to the previous record's as a signed 32-bit delta,
+    so that a record slightly older than its predecessor isn't mistaken for a wraparound."""
+    unwrapped = []
+    last = None
+    for timestamp, event_id, arg in records:
+        if last is None:
+            cycles = timestamp
+        else:
+            delta = (timestamp - last[1]) & 0xffffffff
+            if delta >= 1 << 31:
+                delta -= 1 << 32
+            cycles = last[0] + delta
+        last = (cycles, timestamp)
+        unwrapped.append((cycles, event_id, arg))
+    # stable, the records of equal timestamps keep their ring order
+    return sorted(unwrapped, key=lambda r: r[0])
+
+
+def to_events(frequency, records):
+    """Converts the records to trace events, in time order."""
+    events = [{'name': 'thread_name', 'ph': 'M', 'pid': 1, 'tid': tid, 'args': {'name': name}}
+              for name, tid in TRACKS.items()]
+    in_flight = deque()
+    reports = 0
+    queue_depth = 0
+    for cycles, event_id, arg in unwrap(records):
+        ts = cycles * 1e6 / frequency
+
+        def instant(name, track, args):
+            events.append({'name': name, 'ph': 'i', 's': 't', 'ts': ts, 'pid': 1,
+                           'tid': TRACKS[track], 'args': args})
+
+        def counter(name, value):
+            events.append({'name': name, 'ph': 'C', 'ts': ts, 'pid': 1, 'args': {name: value}})
+
+        if event_id == INPUT_EDGE:
+            instant('press' if arg & 0x8000 else 'release', 'input', {'code': arg & 0x7fff})
+        elif event_id == QUEUE_POST:
+            queue_depth += 1
+            counter('key queue', queue_depth)
+        elif event_id == QUEUE_GET:
+            queue_depth = max(0, queue_depth - 1)
+            counter('key queue', queue_depth)
+        elif event_id == REPORT_SEND:
+            reports += 1
+            in_flight.append(reports)
+            events.append({'name': 'report', 'cat': 'hid', 'ph': 'b', 'id': reports,
+                           'ts': ts, 'pid': 1, 'tid': TRACKS['reports'], 'args': {'size': arg}})
+        elif event_id == REPORT_SENT:
+            if in_flight:
+                # the reports complete in the order they were sent
+                events.append({'name': 'report', 'cat': 'hid', 'ph': 'e', 'id': in_flight.popleft(),
+                               'ts': ts, 'pid': 1, 'tid': TRACKS['reports']})
+            else:
+                instant('report sent', 'reports', {'size': arg})
+        elif event_id == POWER_STATE:
+            counter('USB power state', arg)
+            instant(POWER_STATES.get(arg, str(arg)), 'power', {})
+        elif event_id == BLE_NOTIFY:
+            instant('notified', 'ble', {'key latency us': arg})
+        else:
+            instant(f'event {event_id}', 'input', {'arg': arg})
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log', type=argparse.FileType('r'), help='console log with a trace dump')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout)
+    args = parser.parse_args()
+
+    frequency, records = parse_dump(args.log)
+    json.dump({'traceEvents': to_events(frequency, records), 'displayTimeUnit': 'ns'},
+              args.output)
+
+
+if __name__ == '__main__':
+    main()
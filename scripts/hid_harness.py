@@ -0,0 +1,345 @@
+# SPDX-License-Identifier: MIT
+"""
+Host side latency and throughput test of the HID applications, without hardware.
+
+Each application is built for native_sim, and its virtual UDC is attached to the Linux host
+through USB/IP (usbip-host tools and the vhci-hcd kernel module, usually as root).
+The input events are injected into the emulated input devices through the shell
+(the emulated key matrix of the usb-keyboard, the emulated motion sensor of the usb-mouse),
+and the arrival of the resulting reports is timestamped through hidraw. The evdev nodes of
+the device are grabbed meanwhile, so the injected keys don't reach the host's consoles.
+The latency covers the whole path from the shell command to hidraw, so the values are
+meant for comparing builds (e.g. changes of the main loops, of kb_msgq(), or of the
+c2usb revision in west.yml), not as absolute device latencies.
+
+Reported per application: the latency distribution (p50 / p99 / max), the rate of the
+received reports, and the injected events that produced no report in time (lost).
+The suspend scenario then lets the host autosuspend the device (through the USB device's
+sysfs power attributes) and injects an event while it's suspended, which the device must
+signal with remote wakeup. The wakeup latency covers the event until the report arrived,
+a suspended device that produced no report counts as a lost wakeup. Hosts that never
+suspend the device (not every vhci-hcd does) skip the scenario with a warning.
+With --baseline the results are compared to a previous run's JSON output (-o), and the script
+fails when a value got worse by more than the tolerance.
+
+Usage: hid_harness.py [--app usb-keyboard --app usb-mouse] [--count N] [--release]
+                      [--wakeups N] [-o results.json] [--baseline results.json]
+"""
+import argparse
+import fcntl
+import json
+import os
+import select
+import shlex
+import statistics
+import subprocess
+import sys
+import time
+from pathlib import Path
+
+from hid_output_bench import find_hidraw, percentile
+from release_bench import NATIVE_SIM_RELEASE_ARGS, RELEASE_ARGS, NativeSim
+
+BOARD = 'native_sim'
+EVIOCGRAB = 0x40044590
+
+
+class KeyboardWorkload:
+    """Presses and releases the caps lock key of the emulated matrix (row 0, column 0)."""
+
+    # the report layout of nkro_keyboard without report ID: modifiers, then the key bitmap
+    CAPS_LOCK_BYTE = 1 + 0x39 // 8
+    CAPS_LOCK_MASK = 1 << (0x39 % 8)
+
+    def __init__(self):
+        self.pressed = False
+
+    def inject(self, sim):
+        self.pressed = not self.pressed
+        sim.command(f'matrix key 0 0 {"on" if self.pressed else "off"}')
+
+    def matches(self, report):
+        return (len(report) > self.CAPS_LOCK_BYTE
+                and bool(report[self.CAPS_LOCK_BYTE] & self.CAPS_LOCK_MASK) == self.pressed)
+
+    def finish(self, sim):
+        if self.pressed:
+            self.inject(sim)
+
+
+class MouseWorkload:
+    """Moves the emulated motion sensor back and forth."""
+
+    def __init__(self):
+        self.dx = 1
+
+    def inject(self, sim):
+        self.dx = -self.dx
+        sim.command(f'sensor_emul move motion-sensor {self.dx} 0')
+
+    def matches(self, report):
+        return True
+
+    def finish(self, sim):
+        pass
+
+
+WORKLOADS = {
+    'usb-keyboard': KeyboardWorkload,
+    'usb-mouse': MouseWorkload,
+}
+
+
+def build(args, app, build_dir):
+    cmd = ['west', 'build', '-p', 'auto', '-b', BOARD, '-d', str(build_dir), app]
+    if args.release:
+        cmd += ['--'] + RELEASE_ARGS + NATIVE_SIM_RELEASE_ARGS
+    print(' '.join(cmd), file=sys.stderr)
+    subprocess.run(cmd, check=True)
+
+
+def wait_hidraw(args, timeout):
+    end = time.monotonic() + timeout
+    while time.monotonic() < end:
+        device = find_hidraw(args.vid, args.pid)
+        if device is not None:
+            return device
+        time.sleep(0.1)
+    sys.exit(f'no hidraw device found for {args.vid:04x}:{args.pid:04x}')
+
+
+def grab_inputs(hidraw):
+    """Grabs the evdev nodes of a HID device, so that its events only reach this process."""
+    fds = []
+    for event in Path('/sys/class/hidraw', hidraw.name, 'device', 'input').glob('input*/event*'):
+        fd = os.open(Path('/dev/input', event.name), os.O_RDONLY)
+        fcntl.ioctl(fd, EVIOCGRAB, 1)
+        fds.append(fd)
+    return fds
+
+
+def read_report(fd, timeout):
+    ready, _, _ = select.select([fd], [], [], timeout)
+    if not ready:
+        return None
+    return os.read(fd, 64)
+
+
+def usb_device(hidraw):
+    """The sysfs node of the USB device that a hidraw node belongs to."""
+    path = Path('/sys/class/hidraw', hidraw.name, 'device').resolve()
+    while not (path / 'idVendor').exists():
+        if path == path.parent:
+            sys.exit(f'{hidraw} is not a USB device')
+        path = path.parent
+    return path
+
+
+def write_sysfs(args, path, value):
+    if os.access(path, os.W_OK):
+        path.write_text(value)
+    else:
+        subprocess.run(shlex.split(args.sudo) + ['tee', str(path)], input=value, text=True,
+                       stdout=subprocess.DEVNULL, check=True)
+
+
+def wait_report(args, fd, workload, start):
+    """Returns the latency of the report matching the injected event, None if none arrived."""
+    end = time.monotonic() + args.timeout
+    while True:
+        report = read_report(fd, max(0, end - time.monotonic()))
+        if report is None:
+            return None
+        if workload.matches(report):
+            return (time.perf_counter_ns() - start) / 1000
+
+
+def measure(args, sim, workload, fd):
+    """Injects the events one by one, returns the latencies, the lost and received counts."""
+    latencies_us = []
+    lost = 0
+    reports = 0
+    for _ in range(args.count):
+        # the reports of the previous event, which arrived after it was matched
+        while read_report(fd, 0) is not None:
+            reports += 1
+        start = time.perf_counter_ns()
+        workload.inject(sim)
+        end = time.monotonic() + args.timeout
+        while True:
+            report = read_report(fd, max(0, end - time.monotonic()))
+            if report is None:
+                lost += 1
+                break
+            reports += 1
+            if workload.matches(report):
+                latencies_us.append((time.perf_counter_ns() - start) / 1000)
+                break
+        time.sleep(args.interval / 1000)
+    workload.finish(sim)
+    return latencies_us, lost, reports
+
+
+def measure_wakeups(args, sim, workload, fd, device):
+    """Lets the host suspend the device, then injects an event, for each wakeup.
+    Returns the latencies from the event to its report, and the wakeups without a report,
+    or None if the host never suspended the device."""
+    power = device / 'power'
+    write_sysfs(args, power / 'wakeup', 'enabled')
+    write_sysfs(args, power / 'autosuspend_delay_ms', '0')
+    latencies_us = []
+    lost = 0
+    try:
+        write_sysfs(args, power / 'control', 'auto')
+        for _ in range(args.wakeups):
+            sim.discard()
+            if not sim.wait_for(r'USB power state: L2_SUSPEND', args.suspend_timeout):
+                if not latencies_us and not lost:
+                    return None
+                lost += 1
+                continue
+            while read_report(fd, 0) is not None:
+                pass
+            start = time.perf_counter_ns()
+            workload.inject(sim)
+            latency_us = wait_report(args, fd, workload, start)
+            if latency_us is None:
+                lost += 1
+            else:
+                latencies_us.append(latency_us)
+            # release the key, the device suspends again once idle
+            workload.finish(sim)
+    finally:
+        write_sysfs(args, power / 'control', 'on')
+    return latencies_us, lost
+
+
+def run_app(args, app):
+    build_dir = args.build_dir / f'{app}-{BOARD}{"-release" if args.release else ""}'
+    if not args.no_build:
+        build(args, app, build_dir)
+
+    sim = NativeSim(build_dir / 'zephyr' / 'zephyr.exe')
+    grabbed = []
+    fd = None
+    try:
+        # the USB/IP server starts with the device
+        time.sleep(1)
+        subprocess.run(shlex.split(args.usbip) + ['attach', '-r', '127.0.0.1', '-b', args.busid],
+                       check=True)
+        if not sim.wait_for(r'USB configured: 1', 10):
+            sys.exit(f'{app}: the host did not configure the device')
+        hidraw = wait_hidraw(args, 5)
+        grabbed = grab_inputs(hidraw)
+        fd = os.open(hidraw, os.O_RDONLY)
+
+        run_start = time.monotonic()
+        latencies_us, lost, reports = measure(args, sim, WORKLOADS[app](), fd)
+        duration = time.monotonic() - run_start
+        wakeups = None
+        if args.wakeups > 0:
+            wakeups = measure_wakeups(args, sim, WORKLOADS[app](), fd, usb_device(hidraw))
+            if wakeups is None:
+                print(f'{app}: warning: the host did not suspend the device, '
+                      'the suspend scenario is skipped', file=sys.stderr)
+    finally:
+        if fd is not None:
+            os.close(fd)
+        for g in grabbed:
+            os.close(g)
+        sim.close()
+
+    result = {'events': args.count, 'lost': lost,
+              'report_rate': round(reports / duration, 1)}
+    if latencies_us:
+        result.update({
+            'latency_p50_us': round(statistics.median(latencies_us)),
+            'latency_p99_us': round(percentile(latencies_us, 99)),
+            'latency_max_us': round(max(latencies_us)),
+        })
+    if wakeups is not None:
+        wakeup_latencies_us, wakeup_lost = wakeups
+        result.update({'wakeups': args.wakeups, 'wakeup_lost': wakeup_lost})
+        if wakeup_latencies_us:
+            result.update({
+                'wakeup_p50_us': round(statistics.median(wakeup_latencies_us)),
+                'wakeup_max_us': round(max(wakeup_latencies_us)),
+            })
+    return result
+
+
+def regressions(results, baseline, tolerance):
+    """Returns the values that got worse than the baseline by more than the tolerance."""
+    found = []
+    for app, result in results.items():
+        old = baseline.get(app, {})
+        for metric in ('latency_p50_us', 'latency_p99_us', 'wakeup_p50_us'):
+            if old.get(metric) and result.get(metric, 0) > old[metric] * (1 + tolerance / 100):
+                found.append(f'{app} {metric}: {old[metric]} -> {result[metric]}')
+        if result['lost'] > old.get('lost', 0):
+            found.append(f'{app} lost: {old.get("lost", 0)} -> {result["lost"]}')
+        if result.get('wakeup_lost', 0) > old.get('wakeup_lost', 0):
+            found.append(f'{app} wakeup_lost: {old.get("wakeup_lost", 0)} -> '
+                         f'{result["wakeup_lost"]}')
+    return found
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--app', action='append', choices=sorted(WORKLOADS),
+                        help='the applications to test, all by default')
+    parser.add_argument('--release', action='store_true', help='test the release profile')
+    parser.add_argument('--build-dir', type=Path, default=Path('build'),
+                        help='the builds go to <dir>/<app>-native_sim')
+    parser.add_argument('--no-build', action='store_true', help='use the existing builds')
+    parser.add_argument('--count', type=int, default=500, help='number of injected events')
+    parser.add_argument('--interval', type=float, default=20, help='ms between the events')
+    parser.add_argument('--timeout', type=float, default=0.5,
+                        help='seconds to wait for the report of an event')
+    parser.add_argument('--wakeups', type=int, default=10,
+                        help='number of suspend / remote wakeup cycles, 0 to skip')
+    parser.add_argument('--suspend-timeout', type=float, default=5,
+                        help='seconds to wait for the host to suspend the device')
+    parser.add_argument('--vid', type=lambda x: int(x, 0), default=0x2fe3)
+    parser.add_argument('--pid', type=lambda x: int(x, 0), default=0x0001)
+    parser.add_argument('--usbip', default='sudo usbip', help='the usbip command')
+    parser.add_argument('--busid', default='1-1', help='the USB/IP bus ID of the device')
+    parser.add_argument('--sudo', default='sudo',
+                        help='the prefix of the sysfs writes that need root')
+    parser.add_argument('-o', '--output', type=Path, help='save the results as JSON')
+    parser.add_argument('--baseline', type=Path, help='the JSON results to compare against')
+    parser.add_argument('--tolerance', type=float, default=10,
+                        help='the allowed latency regression against the baseline, in percent')
+    args = parser.parse_args()
+    if not sys.platform.startswith('linux'):
+        sys.exit('the harness needs a Linux host (USB/IP, hidraw, evdev)')
+
+    results = {}
+    for app in args.app or sorted(WORKLOADS):
+        result = run_app(args, app)
+        results[app] = result
+        print(f'{app}: {result["events"]} events, {result["lost"]} lost, '
+              f'{result["report_rate"]} reports/s')
+        if 'latency_p50_us' in result:
+            print(f'  latency p50 {result["latency_p50_us"]} us, '
+                  f'p99 {result["latency_p99_us"]} us, max {result["latency_max_us"]} us')
+        if 'wakeups' in result:
+            print(f'  remote wakeups: {result["wakeups"]}, {result["wakeup_lost"]} lost', end='')
+            if 'wakeup_p50_us' in result:
+                print(f', latency p50 {result["wakeup_p50_us"]} us, '
+                      f'max {result["wakeup_max_us"]} us', end='')
+            print()
+
+    if args.output:
+        args.output.write_text(json.dumps(results, indent=2) + '\n')
+    if args.baseline:
+        found = regressions(results, json.loads(args.baseline.read_text()), args.tolerance)
+        for line in found:
+            print(f'regression: {line}')
+        if found:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
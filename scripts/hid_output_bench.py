@@ -0,0 +1,100 @@
+# SPDX-License-Identifier: MIT
+"""
+Round-trip latency of HID output reports, measured on a Linux host through hidraw.
+
+The usb-keyboard built with CONFIG_DEMO_HID_OUTPUT_ECHO=y answers each output report (LEDs)
+with an input report toggling a reserved usage. The kernel sends the output reports
+on the interrupt OUT endpoint when the interface has one (CONFIG_DEMO_HID_OUTPUT_INTERRUPT),
+and with SET_REPORT requests on the control pipe otherwise, so building the application
+with each choice compares the two delivery paths.
+The UDC buffer usage of each path is printed by the "ram pools" shell command
+(CONFIG_DEMO_RAM_BUDGET=y) after a run.
+
+Usage: hid_output_bench.py [--device /dev/hidrawN] [--count N]
+"""
+import argparse
+import os
+import select
+import statistics
+import sys
+import time
+from pathlib import Path
+
+# the report layout of nkro_keyboard without report ID: modifiers, then the key bitmap
+RESERVED_USAGE_BYTE = 1
+RESERVED_USAGE_MASK = 0x01
+NUM_LOCK_LED = 0x01
+
+
+def find_hidraw(vid, pid):
+    """Returns the first hidraw device node of the given USB device."""
+    for node in sorted(Path('/sys/class/hidraw').glob('hidraw*')):
+        uevent = (node / 'device' / 'uevent').read_text()
+        for line in uevent.splitlines():
+            if line.startswith('HID_ID='):
+                _, v, p = line.split('=', 1)[1].split(':')
+                if int(v, 16) == vid and int(p, 16) == pid:
+                    return Path('/dev') / node.name
+    return None
+
+
+def read_reserved_usage(fd, timeout):
+    """Returns the reserved usage state of the next input report, or None on timeout."""
+    ready, _, _ = select.select([fd], [], [], timeout)
+    if not ready:
+        return None
+    report = os.read(fd, 64)
+    if len(report) <= RESERVED_USAGE_BYTE:
+        return None
+    return bool(report[RESERVED_USAGE_BYTE] & RESERVED_USAGE_MASK)
+
+
+def percentile(values, p):
+    ordered = sorted(values)
+    return ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--device', type=Path, help='hidraw node, found by VID:PID if omitted')
+    parser.add_argument('--vid', type=lambda x: int(x, 0), default=0x2fe3)
+    parser.add_argument('--pid', type=lambda x: int(x, 0), default=0x0001)
+    parser.add_argument('--count', type=int, default=1000, help='number of output reports')
+    parser.add_argument('--timeout', type=float, default=0.5,
+                        help='seconds to wait for each echo')
+    args = parser.parse_args()
+
+    device = args.device or find_hidraw(args.vid, args.pid)
+    if device is None:
+        sys.exit(f'no hidraw device found for {args.vid:04x}:{args.pid:04x}')
+
+    fd = os.open(device, os.O_RDWR)
+    # drop the reports queued before the measurement
+    while read_reserved_usage(fd, 0) is not None:
+        pass
+
+    latencies_us = []
+    lost = 0
+    leds = 0
+    for _ in range(args.count):
+        leds ^= NUM_LOCK_LED
+        start = time.perf_counter_ns()
+        # the first byte is the report ID, 0 when the device doesn't use IDs
+        os.write(fd, bytes([0, leds]))
+        if read_reserved_usage(fd, args.timeout) is None:
+            lost += 1
+            continue
+        latencies_us.append((time.perf_counter_ns() - start) / 1000)
+    os.write(fd, bytes([0, 0]))
+    os.close(fd)
+
+    print(f'{device}: {len(latencies_us)} echoes, {lost} lost')
+    if latencies_us:
+        print(f'round-trip latency: min {min(latencies_us):.0f} us, '
+              f'median {statistics.median(latencies_us):.0f} us, '
+              f'p99 {percentile(latencies_us, 99):.0f} us, max {max(latencies_us):.0f} us')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,123 @@
+# SPDX-License-Identifier: MIT
+"""
+Static RAM budget of a zephyr build, broken down by subsystem.
+
+The linker map file (built with -fdata-sections) lists each RAM object as an input section,
+together with the library and object file it comes from, which is used to group the objects.
+
+Usage: ram_budget.py <build>/zephyr/zephyr.map [--top N]
+"""
+import argparse
+import re
+import sys
+from collections import defaultdict
+from pathlib import Path
+
+# (category, regex on the object file path, regex on the section/symbol name)
+# the first matching rule wins
+CATEGORIES = [
+    ('UDC buffer pools', None, r'udc_ep_pool|net_buf_data_udc|_net_buf_udc'),
+    ('UDC driver', r'drivers__usb__udc|drivers/usb/udc', None),
+    ('c2usb stack', r'c2usb', r'udc_mac|3usb'),
+    ('c2usb device and config objects', r'app/libapp\.a|/app/', r'6device|3mac|_config|usb_'),
+    ('message queues', None, r'msgq'),
+    ('BT buffers', r'bluetooth', r'net_buf|acl|evt_pool|_pool'),
+    ('BT host', r'bluetooth|subsys__bluetooth', r'bt_'),
+    ('shell', r'subsys__shell', r'shell'),
+    ('logging', r'subsys__logging', r'log_'),
+    ('thread stacks', None, r'stack'),
+    ('kernel', r'kernel/libkernel|libkernel\.a', None),
+    ('C library', r'lib(c|newlib|picolibc|stdc\+\+|gcc)', None),
+    ('application', r'app/libapp\.a|/app/', None),
+    ('demo lib', r'lib/liblib|modules__', None),
+]
+
+
+def parse_memory_regions(lines):
+    """Returns the RAM regions from the 'Memory Configuration' table."""
+    regions = []
+    in_table = False
+    for line in lines:
+        if line.startswith('Memory Configuration'):
+            in_table = True
+            continue
+        if in_table and line.startswith('Linker script and memory map'):
+            break
+        m = re.match(r'^(\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s*(\S*)', line)
+        # IDT_LIST is a placeholder region of zephyr's intermediate builds
+        if (in_table and m and m.group(1) not in ('*default*', 'IDT_LIST')
+                and 'w' in m.group(4)):
+            start = int(m.group(2), 16)
+            regions.append((m.group(1), start, start + int(m.group(3), 16)))
+    return regions
+
+
+def parse_objects(lines):
+    """Yields (name, address, size, object file) of the input sections."""
+    pending = None
+    for line in lines:
+        if pending is not None:
+            m = re.match(r'^\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)', line)
+            name, pending = pending, None
+            if m:
+                yield name, int(m.group(1), 16), int(m.group(2), 16), m.group(3)
+                continue
+        # long input section names are wrapped to the next line
+        m = re.match(r'^ (\.\S+)\s*$', line)
+        if m:
+            pending = m.group(1)
+            continue
+        m = re.match(r'^ (\.\S+)\s+0x([0-9a-fA-F]+)\s+0x([0-9a-fA-F]+)\s+(\S+)', line)
+        if m:
+            yield m.group(1), int(m.group(2), 16), int(m.group(3), 16), m.group(4)
+
+
+def categorize(name, obj):
+    for category, obj_re, name_re in CATEGORIES:
+        if obj_re and not re.search(obj_re, obj):
+            continue
+        if name_re and not re.search(name_re, name):
+            continue
+        return category
+    return 'other'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('map', type=Path, help='the zephyr.map linker map file')
+    parser.add_argument('--top', type=int, default=3,
+                        help='the number of largest objects listed per category')
+    args = parser.parse_args()
+
+    lines = args.map.read_text(errors='replace').splitlines()
+    regions = parse_memory_regions(lines)
+    if not regions:
+        sys.exit(f'no writable memory region found in {args.map}')
+
+    def in_ram(address):
+        return any(start <= address < end for _, start, end in regions)
+
+    totals = defaultdict(int)
+    objects = defaultdict(list)
+    seen = set()
+    for name, address, size, obj in parse_objects(lines):
+        if size == 0 or not in_ram(address) or (address, name) in seen:
+            continue
+        seen.add((address, name))
+        category = categorize(name, obj)
+        totals[category] += size
+        objects[category].append((size, name, Path(obj).name))
+
+    ram_size = sum(end - start for _, start, end in regions)
+    used = sum(totals.values())
+    print(f'{"category":<34}{"bytes":>10}{"share":>8}')
+    for category, size in sorted(totals.items(), key=lambda item: -item[1]):
+        print(f'{category:<34}{size:>10}{size * 100 / used:>7.1f}%')
+        for obj_size, name, obj in sorted(objects[category], reverse=True)[:args.top]:
+            print(f'    {obj_size:>8}  {name} ({obj})')
+    print(f'{"total static RAM":<34}{used:>10}{used * 100 / ram_size:>7.1f}% of {ram_size}')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,197 @@
+# SPDX-License-Identifier: MIT
+"""
+Generates a Kconfig overlay with right-sized stacks, queue depths and UDC buffer pools,
+from the high-water marks measured at runtime.
+
+Build the application with CONFIG_DEMO_RAM_PROFILE=y, run a representative workload
+(enumeration, suspend / resume, key and report floods, shell use), then save the output of
+the "ram profile" shell command, or the log of the next USB suspend. The input may be
+a whole console log, the last block is used:
+  profile begin
+  profile thread <stack size> <stack used> <thread name>
+  profile msgq <message size> <max messages> <peak messages> <address>
+  profile queue <capacity> <peak> <Kconfig symbol>
+  profile pool <buffers> <peak buffers> <data bytes> <peak data bytes> <pool name>
+  profile end
+Each value is the measured peak plus the margin. The items without a known Kconfig symbol
+are listed as comments. With --config the current values are read from the build's .config,
+the RAM change is printed, and the UDC driver message queue is recognized by its depth.
+The message queue peaks are only sampled by a timer, so a short burst may be missed: the UDC
+driver queue is never shrunk, only listed. The UDC buffer count stays at least 3 more than
+the endpoints of the configuration (--endpoints), like demo::endpoint_budget requires.
+
+Usage: ram_profile.py <console log> [--config <build>/zephyr/.config] [--endpoints N]
+                      [-o profile.conf]
+then build with: west build -- -DEXTRA_CONF_FILE=profile.conf
+"""
+import argparse
+import math
+import re
+import sys
+from pathlib import Path
+
+# thread name (regex) -> stack size symbol
+THREAD_STACKS = [
+    (r'main', 'MAIN_STACK_SIZE'),
+    (r'idle', 'IDLE_STACK_SIZE'),
+    (r'sysworkq', 'SYSTEM_WORKQUEUE_STACK_SIZE'),
+    (r'logging', 'LOG_PROCESS_THREAD_STACK_SIZE'),
+    (r'shell_.*', 'SHELL_STACK_SIZE'),
+    (r'BT RX( WQ)?', 'BT_RX_STACK_SIZE'),
+    (r'BT LW WQ', 'BT_LONG_WQ_STACK_SIZE'),
+    (r'deferred_log_thread', 'DEMO_DEFERRED_LOG_STACK_SIZE'),
+]
+
+# queue depths that must stay a power of 2
+POWER_OF_2 = {'DEMO_KEY_EVENT_RING_SIZE'}
+
+# the c2usb UDC driver queue, only recognized by its depth
+UDC_MAC_MSGQ = 'C2USB_UDC_MAC_MSGQ_SIZE'
+UDC_POOL = 'udc_ep_pool'
+
+STACK_ALIGN = 64
+WORD = 8
+
+
+def round_up(value, align):
+    return (value + align - 1) // align * align
+
+
+def parse_profile(lines):
+    """Returns the records of the last profile block, grouped by kind."""
+    block = None
+    last = None
+    for line in lines:
+        m = re.search(r'profile (begin|end|thread|msgq|queue|pool)\b ?(.*?)\s*$', line)
+        if not m:
+            continue
+        kind, rest = m.groups()
+        if kind == 'begin':
+            block = {'thread': [], 'msgq': [], 'queue': [], 'pool': []}
+        elif kind == 'end':
+            if block is not None:
+                last = block
+            block = None
+        elif block is not None:
+            # the name is last, and may contain spaces
+            fields = rest.split(' ', {'thread': 2, 'msgq': 3, 'queue': 2, 'pool': 4}[kind])
+            block[kind].append([int(f) for f in fields[:-1]] + [fields[-1]])
+    if last is None:
+        sys.exit('no complete "ram profile" output found')
+    return last
+
+
+def parse_config(path):
+    """Returns the integer options of a .config file."""
+    values = {}
+    for line in path.read_text().splitlines():
+        m = re.match(r'^CONFIG_(\w+)=(\d+)$', line)
+        if m:
+            values[m.group(1)] = int(m.group(2))
+    return values
+
+
+def with_margin(value, margin, minimum=0):
+    return value + max(math.ceil(value * margin / 100), minimum)
+
+
+def thread_symbol(name):
+    for pattern, symbol in THREAD_STACKS:
+        if re.fullmatch(pattern, name):
+            return symbol
+    return None
+
+
+def recommend(profile, config, args):
+    """Returns the recommended values by symbol, as (value, bytes per unit, comment),
+    and the comments of the items without a symbol."""
+    values = {}
+    comments = []
+
+    def set_value(symbol, value, unit, comment):
+        # several threads may share the symbol (e.g. shell backends), keep the largest
+        if symbol not in values or values[symbol][0] < value:
+            values[symbol] = (value, unit, comment)
+
+    for size, used, name in profile['thread']:
+        stack = round_up(with_margin(used, args.margin, args.stack_min_margin), STACK_ALIGN)
+        comment = f'thread "{name}": {used}/{size} bytes used at peak'
+        symbol = thread_symbol(name)
+        if symbol is None:
+            comments.append(f'{comment}, suggested stack size {stack}')
+        else:
+            set_value(symbol, stack, 1, comment)
+
+    for msg_size, depth, peak, address in profile['msgq']:
+        comment = f'message queue {address}: {peak}/{depth} messages of {msg_size} bytes at peak'
+        if config.get(UDC_MAC_MSGQ) == depth:
+            # a sampled peak may miss the bursts of the driver, which mustn't overflow
+            comment += f', likely {UDC_MAC_MSGQ}, kept as is'
+        comments.append(comment)
+
+    for capacity, peak, symbol in profile['queue']:
+        depth = max(1, with_margin(peak, args.margin, 1))
+        if symbol in POWER_OF_2:
+            depth = 1 << (depth - 1).bit_length()
+        set_value(symbol, depth, None, f'{peak}/{capacity} entries used at peak')
+
+    for count, max_used, data_size, max_data_used, name in profile['pool']:
+        comment = f'pool {name}: {max_used}/{count} buffers'
+        if data_size > 0:
+            comment += f', {max_data_used}/{data_size} data bytes'
+        comment += ' used at peak'
+        if name == UDC_POOL:
+            # the control endpoint needs 3 buffers, and each other endpoint one
+            set_value('UDC_BUF_COUNT',
+                      max(3 + args.endpoints, with_margin(max_used, args.margin, 1)), None,
+                      comment)
+            if data_size > 0:
+                set_value('UDC_BUF_POOL_SIZE',
+                          round_up(with_margin(max_data_used, args.margin), WORD), 1, comment)
+        else:
+            comments.append(comment)
+    return values, comments
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('log', type=argparse.FileType('r'),
+                        help='console log with a "ram profile" output')
+    parser.add_argument('--config', type=Path,
+                        help='the .config of the profiled build')
+    parser.add_argument('--margin', type=int, default=25,
+                        help='safety margin on top of the peaks, in percent')
+    parser.add_argument('--stack-min-margin', type=int, default=128,
+                        help='the smallest stack margin in bytes, for the untested paths')
+    parser.add_argument('--endpoints', type=int, default=1,
+                        help='the endpoints of the USB configuration besides control')
+    parser.add_argument('-o', '--output', type=argparse.FileType('w'), default=sys.stdout)
+    args = parser.parse_args()
+
+    profile = parse_profile(args.log)
+    config = parse_config(args.config) if args.config else {}
+
+    values, comments = recommend(profile, config, args)
+
+    out = args.output
+    out.write(f'# generated by scripts/ram_profile.py from {args.log.name}, '
+              f'margin {args.margin}%\n')
+    saved = 0
+    for symbol, (value, unit, comment) in sorted(values.items()):
+        current = config.get(symbol)
+        if current is not None:
+            comment += f', was {current}'
+            if unit is not None:
+                saved += (current - value) * unit
+        out.write(f'# {comment}\nCONFIG_{symbol}={value}\n')
+    if comments:
+        out.write('\n# not sized automatically:\n')
+        for comment in comments:
+            out.write(f'# {comment}\n')
+    if config:
+        print(f'RAM change of the sized items: {-saved:+} bytes', file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
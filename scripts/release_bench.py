@@ -0,0 +1,259 @@
+# SPDX-License-Identifier: MIT
+"""
+Compares the debug (prj.conf) and release (prj.conf + conf/release.conf + the application's
+release.conf) builds of an application:
+the flash and RAM size, and on native_sim the key to report latency and the processing cost
+of a report, measured with the same workload.
+
+The workload is the "kb bench" shell command of the usb-keyboard (CONFIG_DEMO_KEY_EVENT_STATS,
+enabled on native_sim): synthetic key events go through the key event queue, the keymap and
+the HID report path, toggling a usage that hosts ignore. The device is attached to the Linux
+host through USB/IP (usbip-host tools and the vhci-hcd kernel module, usually as root),
+so the reports are actually transferred.
+On native_sim the code runs in zero simulated time, so the processing cost is taken from
+the host CPU time of the process instead of the device's cycle counter.
+
+With --baseline the results are compared to a previous run's JSON output (-o), and the script
+fails when a value got worse by more than the tolerance.
+
+Usage: release_bench.py [--app usb-keyboard] [--board native_sim] [-o results.json]
+                        [--baseline results.json] [--no-run]
+"""
+import argparse
+import json
+import os
+import queue
+import re
+import shlex
+import struct
+import subprocess
+import sys
+import threading
+import time
+from pathlib import Path
+
+PROFILES = ('debug', 'release')
+
+# the shared release overlay, then the application's own differences,
+# relative to the application directory
+RELEASE_ARGS = ['-DEXTRA_CONF_FILE=../conf/release.conf;release.conf']
+
+# the host toolchain has no picolibc for the C++ standard library, and the posix
+# architecture doesn't support LTO, these release options stay off on native_sim
+NATIVE_SIM_RELEASE_ARGS = ['-DCONFIG_PICOLIBC=n', '-DCONFIG_NEWLIB_LIBC=y', '-DCONFIG_LTO=n',
+                           '-DCONFIG_ISR_TABLES_LOCAL_DECLARATION=n']
+
+# the metrics where lower is better, with their units
+METRICS = {
+    'flash': 'bytes',
+    'ram': 'bytes',
+    'latency_avg_us': 'us',
+    'latency_max_us': 'us',
+    'cpu_us_per_report': 'us',
+    'cycles_per_report': 'cycles',
+}
+
+SHF_WRITE = 0x1
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+
+def elf_sizes(path):
+    """Returns the flash (loaded contents) and RAM (writable) size of an ELF image."""
+    data = path.read_bytes()
+    if data[:4] != b'\x7fELF':
+        sys.exit(f'{path} is not an ELF file')
+    is64 = data[4] == 2
+    endian = '<' if data[5] == 1 else '>'
+    if is64:
+        shoff, = struct.unpack_from(endian + 'Q', data, 0x28)
+        shentsize, shnum = struct.unpack_from(endian + 'HH', data, 0x3a)
+        header = endian + 'IIQQQQ'
+    else:
+        shoff, = struct.unpack_from(endian + 'I', data, 0x20)
+        shentsize, shnum = struct.unpack_from(endian + 'HH', data, 0x2e)
+        header = endian + 'IIIIII'
+    flash = ram = 0
+    for i in range(shnum):
+        _, sh_type, flags, _, _, size = struct.unpack_from(header, data, shoff + i * shentsize)
+        if not flags & SHF_ALLOC:
+            continue
+        if sh_type != SHT_NOBITS:
+            flash += size
+        if flags & SHF_WRITE:
+            ram += size
+    return flash, ram
+
+
+def build(args, profile, build_dir):
+    cmd = ['west', 'build', '-p', 'auto', '-b', args.board, '-d', str(build_dir), args.app]
+    if profile == 'release':
+        cmd += ['--'] + RELEASE_ARGS
+        if args.board.startswith('native_sim'):
+            cmd += NATIVE_SIM_RELEASE_ARGS
+    print(' '.join(cmd), file=sys.stderr)
+    subprocess.run(cmd, check=True)
+
+
+class NativeSim:
+    """A native_sim executable, with its UART on stdin / stdout."""
+
+    def __init__(self, exe):
+        self.proc = subprocess.Popen([str(exe), '-uart_stdinout'], stdin=subprocess.PIPE,
+                                     stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                                     text=True, bufsize=1)
+        self.lines = queue.Queue()
+        threading.Thread(target=self._reader, daemon=True).start()
+
+    def _reader(self):
+        for line in self.proc.stdout:
+            self.lines.put(line.rstrip())
+
+    def wait_for(self, pattern, timeout):
+        """Returns the match of the first output line matching the pattern."""
+        end = time.monotonic() + timeout
+        while time.monotonic() < end:
+            try:
+                line = self.lines.get(timeout=max(0, end - time.monotonic()))
+            except queue.Empty:
+                break
+            m = re.search(pattern, line)
+            if m:
+                return m
+        return None
+
+    def discard(self):
+        """Drops the output received so far, so that wait_for() only matches newer lines."""
+        while not self.lines.empty():
+            self.lines.get_nowait()
+
+    def command(self, cmd):
+        self.proc.stdin.write(cmd + '\n')
+        self.proc.stdin.flush()
+
+    def cpu_seconds(self):
+        """The user and system CPU time of the process."""
+        fields = Path(f'/proc/{self.proc.pid}/stat').read_text().rsplit(')', 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / os.sysconf('SC_CLK_TCK')
+
+    def close(self):
+        self.proc.terminate()
+        try:
+            self.proc.wait(timeout=5)
+        except subprocess.TimeoutExpired:
+            self.proc.kill()
+
+
+def run_bench(args, build_dir):
+    """Runs the workload on a native_sim build, returns the measured metrics."""
+    sim = NativeSim(build_dir / 'zephyr' / 'zephyr.exe')
+    try:
+        # the USB/IP server starts with the device
+        time.sleep(1)
+        subprocess.run(shlex.split(args.usbip) + ['attach', '-r', '127.0.0.1', '-b', args.busid],
+                       check=True)
+        if not sim.wait_for(r'USB configured: 1', 10):
+            sys.exit('the host did not configure the device')
+        cpu_start = sim.cpu_seconds()
+        sim.command(f'kb bench {args.presses} {args.interval}')
+        time.sleep(args.presses * 2 * args.interval / 1000)
+        for _ in range(50):
+            sim.command('kb stats')
+            m = sim.wait_for(r'kb stats: (\d+) reports, latency avg: (\d+)us max: (\d+)us, '
+                             r'processing avg: (\d+) max: \d+ cycles at \d+ Hz, dropped: (\d+)',
+                             1)
+            if m:
+                break
+        else:
+            sys.exit('no "kb stats" output')
+        cpu = sim.cpu_seconds() - cpu_start
+    finally:
+        sim.close()
+
+    reports, latency_avg, latency_max, cycles, dropped = (int(v) for v in m.groups())
+    if reports == 0:
+        sys.exit('no reports were sent')
+    return {
+        'reports': reports,
+        'dropped': dropped,
+        'latency_avg_us': latency_avg,
+        'latency_max_us': latency_max,
+        'cpu_us_per_report': round(cpu * 1e6 / reports, 1),
+        'cycles_per_report': cycles,
+    }
+
+
+def print_table(results):
+    print(f'{"metric":<28}' + ''.join(f'{p:>12}' for p in PROFILES) + f'{"change":>10}')
+    for metric, unit in METRICS.items():
+        values = [results[p].get(metric) for p in PROFILES]
+        if None in values:
+            continue
+        change = f'{(values[1] - values[0]) * 100 / values[0]:+.1f}%' if values[0] else ''
+        print(f'{metric + " [" + unit + "]":<28}' + ''.join(f'{v:>12}' for v in values)
+              + f'{change:>10}')
+
+
+def regressions(results, baseline, tolerance):
+    """Returns the metrics that got worse than the baseline by more than the tolerance."""
+    found = []
+    for profile in PROFILES:
+        for metric in METRICS:
+            old = baseline.get(profile, {}).get(metric)
+            new = results[profile].get(metric)
+            if old and new is not None and new > old * (1 + tolerance / 100):
+                found.append(f'{profile} {metric}: {old} -> {new}')
+    return found
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__,
+                                     formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--app', default='usb-keyboard')
+    parser.add_argument('--board', default='native_sim')
+    parser.add_argument('--build-dir', type=Path, default=Path('build'),
+                        help='the builds go to <dir>/<app>-debug and <dir>/<app>-release')
+    for profile in PROFILES:
+        parser.add_argument(f'--{profile}-build', type=Path,
+                            help=f'the {profile} build directory, instead of the default')
+    parser.add_argument('--no-build', action='store_true', help='use the existing builds')
+    parser.add_argument('--no-run', action='store_true', help='only compare the sizes')
+    parser.add_argument('--presses', type=int, default=500)
+    parser.add_argument('--interval', type=int, default=10, help='ms between key events')
+    parser.add_argument('--usbip', default='sudo usbip', help='the usbip command')
+    parser.add_argument('--busid', default='1-1', help='the USB/IP bus ID of the device')
+    parser.add_argument('-o', '--output', type=Path, help='save the results as JSON')
+    parser.add_argument('--baseline', type=Path, help='the JSON results to compare against')
+    parser.add_argument('--tolerance', type=float, default=5,
+                        help='the allowed regression against the baseline, in percent')
+    args = parser.parse_args()
+
+    run = not args.no_run and args.board.startswith('native_sim')
+    results = {}
+    for profile in PROFILES:
+        build_dir = (getattr(args, f'{profile}_build')
+                     or args.build_dir / f'{args.app}-{profile}')
+        if not args.no_build:
+            build(args, profile, build_dir)
+        elf = build_dir / 'zephyr' / 'zephyr.elf'
+        if not elf.exists():
+            elf = build_dir / 'zephyr' / 'zephyr.exe'
+        flash, ram = elf_sizes(elf)
+        results[profile] = {'flash': flash, 'ram': ram}
+        if run:
+            results[profile].update(run_bench(args, build_dir))
+
+    print(f'{args.app} on {args.board}')
+    print_table(results)
+    if args.output:
+        args.output.write_text(json.dumps(results, indent=2) + '\n')
+    if args.baseline:
+        found = regressions(results, json.loads(args.baseline.read_text()), args.tolerance)
+        for line in found:
+            print(f'regression: {line}')
+        if found:
+            sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
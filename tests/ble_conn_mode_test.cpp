@@ -0,0 +1,98 @@
+#include "test_check.hpp"
+#include <ble_conn_mode.hpp>
+
+using mode = ble_conn_mode::mode;
+
+static constexpr ble_conn_mode::config config{12, 5000};
+static constexpr uint16_t active_interval = 6;
+static constexpr uint16_t idle_interval = 80;
+static constexpr uint16_t idle_latency = 4;
+
+static void test_idle_and_back()
+{
+    ble_conn_mode link;
+    ble_conn_mode::statistics stats{};
+    mode to_request;
+    int64_t now = 0;
+    link.attach(now, active_interval, 0, 1000, config);
+    CHECK(link.current() == mode::ACTIVE);
+
+    // nothing is requested before the link settles
+    CHECK_EQ(link.process(now, now, to_request, stats), 1000);
+    CHECK(to_request == mode::NONE);
+
+    // active until the idle delay passes without user input
+    now = 1000;
+    CHECK_EQ(link.process(now, 0, to_request, stats), config.idle_delay_ms);
+    CHECK(to_request == mode::NONE);
+    now = config.idle_delay_ms;
+    CHECK_EQ(link.process(now, 0, to_request, stats), now + ble_conn_mode::response_timeout_ms);
+    CHECK(to_request == mode::IDLE);
+    link.updated(now + 100, idle_interval, idle_latency, stats);
+    CHECK(link.current() == mode::IDLE);
+    CHECK(link.requested() == mode::NONE);
+    CHECK_EQ(link.process(now + 100, 0, to_request, stats), ble_conn_mode::never);
+
+    // user input snaps it back
+    now += 1000;
+    link.process(now, now, to_request, stats);
+    CHECK(to_request == mode::ACTIVE);
+    link.updated(now + 50, active_interval, 0, stats);
+    CHECK(link.current() == mode::ACTIVE);
+    CHECK_EQ(stats.updates, 2u);
+    CHECK_EQ(stats.rejected, 0u);
+    CHECK_EQ(stats.active_ms, static_cast<uint32_t>(config.idle_delay_ms + 100));
+    CHECK_EQ(stats.idle_ms, 950u);
+}
+
+static void test_one_request_in_flight()
+{
+    ble_conn_mode link;
+    ble_conn_mode::statistics stats{};
+    mode to_request;
+    int64_t now = 0;
+    link.attach(now, idle_interval, idle_latency, 0, config);
+    link.process(now, now, to_request, stats);
+    CHECK(to_request == mode::ACTIVE);
+
+    // idle again before the central answers, no second request is started
+    now = 1000;
+    CHECK_EQ(link.process(now, now - config.idle_delay_ms, to_request, stats),
+             ble_conn_mode::response_timeout_ms);
+    CHECK(to_request == mode::NONE);
+}
+
+static void test_rejection_backs_off()
+{
+    ble_conn_mode link;
+    ble_conn_mode::statistics stats{};
+    mode to_request;
+    int64_t now = 0;
+    link.attach(now, idle_interval, idle_latency, 0, config);
+    link.process(now, now, to_request, stats);
+    CHECK(to_request == mode::ACTIVE);
+
+    // the central applies other parameters than requested
+    link.updated(now + 100, idle_interval, 0, stats);
+    CHECK_EQ(stats.rejected, 1u);
+    auto retry = now + 100 + ble_conn_mode::response_timeout_ms;
+    CHECK_EQ(link.process(now + 100, now, to_request, stats), retry);
+    CHECK(to_request == mode::NONE);
+
+    // unanswered, the back-off doubles
+    link.process(retry, retry, to_request, stats);
+    CHECK(to_request == mode::ACTIVE);
+    now = retry + ble_conn_mode::response_timeout_ms;
+    CHECK_EQ(link.process(now, retry, to_request, stats),
+             now + 2 * ble_conn_mode::response_timeout_ms);
+    CHECK(to_request == mode::NONE);
+    CHECK_EQ(stats.rejected, 2u);
+}
+
+int main()
+{
+    test_idle_and_back();
+    test_one_request_in_flight();
+    test_rejection_backs_off();
+    return test_result();
+}
@@ -0,0 +1,157 @@
+#include "test_check.hpp"
+#include <ble_link_steps.hpp>
+
+using step = ble_link_steps::step;
+using result = ble_link_steps::start_result;
+
+static constexpr ble_link_steps::timing timing{400, 1000, 30000};
+
+static auto supported = [](step) { return false; };
+
+/// @brief Processes at the wake time until a step is to be started.
+static ble_link_steps::action run_until_start(ble_link_steps& steps, int64_t& now,
+                                              ble_link_steps::statistics& stats)
+{
+    auto a = steps.process(now, stats, supported);
+    while ((a.start == step::NONE) and (a.wake != ble_link_steps::never))
+    {
+        now = std::max(now, a.wake);
+        a = steps.process(now, stats, supported);
+    }
+    return a;
+}
+
+static void test_sequence()
+{
+    ble_link_steps steps;
+    ble_link_steps::statistics stats{};
+    int64_t now = 0;
+    CHECK_EQ(steps.connected(now, timing), timing.settle_ms);
+    // nothing is started before the link settles
+    CHECK(steps.process(now, stats, supported).start == step::NONE);
+
+    for (auto s : {step::SECURITY, step::PHY, step::DATA_LEN})
+    {
+        auto a = run_until_start(steps, now, stats);
+        CHECK(a.start == s);
+        CHECK_EQ(steps.started(s, now, result::STARTED, stats), a.wake);
+        now += 10;
+        steps.procedure_done(s, false, now, stats);
+    }
+    auto a = run_until_start(steps, now, stats);
+    CHECK(a.start == step::CONN_PARAMS);
+    steps.started(step::CONN_PARAMS, now, result::NOT_NEEDED, stats);
+    CHECK_EQ(stats.completed, 1u);
+    CHECK(steps.process(now, stats, supported).wake == ble_link_steps::never);
+    CHECK(steps.current() == step::DONE);
+    CHECK_EQ(stats.retries, 0u);
+}
+
+static void test_retry_with_backoff()
+{
+    ble_link_steps steps;
+    ble_link_steps::statistics stats{};
+    int64_t now = 0;
+    steps.connected(now, timing);
+    auto a = run_until_start(steps, now, stats);
+    steps.started(a.start, now, result::NOT_NEEDED, stats);
+
+    a = run_until_start(steps, now, stats);
+    CHECK(a.start == step::PHY);
+    // refused, e.g. a procedure of the central is in progress
+    auto wake = steps.started(step::PHY, now, result::REFUSED, stats);
+    CHECK_EQ(wake, now);
+    a = steps.process(now, stats, supported);
+    CHECK(a.start == step::NONE);
+    CHECK_EQ(a.wake, now + ble_link_steps::min_backoff_ms);
+    CHECK_EQ(stats.retries, 1u);
+
+    // unanswered, the back-off doubles
+    now = a.wake;
+    a = steps.process(now, stats, supported);
+    CHECK(a.start == step::PHY);
+    now = a.wake;
+    a = steps.process(now, stats, supported);
+    CHECK_EQ(a.wake, now + 2 * ble_link_steps::min_backoff_ms);
+
+    // given up after the last attempt
+    now = a.wake;
+    a = steps.process(now, stats, supported);
+    CHECK(a.start == step::PHY);
+    now = a.wake;
+    a = steps.process(now, stats, supported);
+    CHECK(a.start == step::DATA_LEN);
+    CHECK_EQ(stats.retries, 3u);
+    CHECK_EQ(stats.skipped, 1u);
+}
+
+static void test_unsupported_fallback()
+{
+    ble_link_steps steps;
+    ble_link_steps::statistics stats{};
+    int64_t now = 0;
+    steps.connected(now, timing);
+    auto a = run_until_start(steps, now, stats);
+    steps.started(a.start, now, result::NOT_NEEDED, stats);
+    a = run_until_start(steps, now, stats);
+    CHECK(a.start == step::PHY);
+    steps.started(step::PHY, now, result::STARTED, stats);
+
+    // the rejection skips the data length update as well
+    steps.procedure_done(step::PHY, true, now, stats);
+    a = steps.process(now, stats, supported);
+    CHECK(a.start == step::CONN_PARAMS);
+    CHECK_EQ(stats.skipped, 1u);
+    CHECK_EQ(stats.retries, 0u);
+}
+
+static void test_unanswered_unsupported()
+{
+    ble_link_steps steps;
+    ble_link_steps::statistics stats{};
+    int64_t now = 0;
+    steps.connected(now, timing);
+    auto a = run_until_start(steps, now, stats);
+    steps.started(a.start, now, result::NOT_NEEDED, stats);
+    a = run_until_start(steps, now, stats);
+    steps.started(step::PHY, now, result::STARTED, stats);
+
+    // the features exchanged meanwhile tell that the remote can't answer
+    now = a.wake;
+    a = steps.process(now, stats, [](step s) { return s == step::PHY; });
+    CHECK(a.start == step::CONN_PARAMS);
+    CHECK_EQ(stats.retries, 0u);
+}
+
+static void test_central_procedure_defers()
+{
+    ble_link_steps steps;
+    ble_link_steps::statistics stats{};
+    int64_t now = 0;
+    steps.connected(now, timing);
+    auto a = run_until_start(steps, now, stats);
+    steps.started(a.start, now, result::NOT_NEEDED, stats);
+    a = steps.process(now, stats, supported);
+    CHECK(a.start == step::PHY);
+    steps.started(step::PHY, now, result::STARTED, stats);
+
+    // the central updates the connection parameters on its own
+    steps.procedure_done(step::CONN_PARAMS, false, now + 5, stats);
+    CHECK_EQ(stats.deferred, 1u);
+    steps.procedure_done(step::PHY, false, now + 10, stats);
+    a = steps.process(now + 10, stats, supported);
+    CHECK(a.start == step::NONE);
+    CHECK_EQ(a.wake, now + 5 + timing.settle_ms);
+    a = steps.process(a.wake, stats, supported);
+    CHECK(a.start == step::DATA_LEN);
+}
+
+int main()
+{
+    test_sequence();
+    test_retry_with_backoff();
+    test_unsupported_fallback();
+    test_unanswered_unsupported();
+    test_central_procedure_defers();
+    return test_result();
+}
@@ -0,0 +1,137 @@
+#include "test_check.hpp"
+#include <cstring>
+#include <key_state.hpp>
+#include <report_queue.hpp>
+
+// the owner side of nkro_keyboard, with the state bits as the report
+using state = key_state<2>;
+using queue = report_queue<2, 2>;
+
+static constexpr std::size_t KEY_A = 4;
+static constexpr std::size_t KEY_B = 5;
+
+static void enqueue(state& keys, queue& q)
+{
+    auto commit = [&q](std::span<uint8_t> buffer, const state::bits_type& bits)
+    {
+        std::memcpy(buffer.data(), bits.data(), bits.size());
+        q.commit(bits.size(), 0);
+    };
+    while (keys.changed() and keys.snapshot(q, commit))
+    {
+    }
+}
+
+/// @return the next pending report, put in flight
+static state::bits_type transmit(queue& q)
+{
+    state::bits_type bits{};
+    auto data = q.next();
+    CHECK_EQ(data.size(), bits.size());
+    std::memcpy(bits.data(), data.data(), bits.size());
+    q.transmitted();
+    return bits;
+}
+
+static bool pressed(const state::bits_type& bits, std::size_t key)
+{
+    return state::test_bit(bits, key);
+}
+
+static void test_tap_while_all_in_flight()
+{
+    state keys;
+    queue q;
+    keys.change(KEY_B, true);
+    enqueue(keys, q);
+    keys.change(KEY_B, false);
+    enqueue(keys, q);
+    transmit(q);
+    transmit(q);
+    CHECK_EQ(q.in_flight(), 2u);
+
+    // press and release before any slot completes
+    keys.change(KEY_A, true);
+    keys.change(KEY_A, false);
+    enqueue(keys, q);
+    CHECK(pressed(keys.live(), KEY_A));
+    CHECK_EQ(keys.held(), 1u);
+
+    q.completed();
+    enqueue(keys, q);
+    CHECK(pressed(transmit(q), KEY_A));
+    q.completed();
+    enqueue(keys, q);
+    CHECK(!pressed(transmit(q), KEY_A));
+    CHECK_EQ(keys.held(), 0u);
+    CHECK(!keys.changed());
+}
+
+static void test_merge_keeps_pending_change()
+{
+    state keys;
+    queue q;
+    keys.change(KEY_B, true);
+    enqueue(keys, q);
+    transmit(q);
+    keys.change(KEY_A, true);
+    enqueue(keys, q);
+    CHECK_EQ(q.pending(), 1u);
+
+    // the release would revert the pending press if merged, so it waits for a slot
+    keys.change(KEY_A, false);
+    enqueue(keys, q);
+    CHECK_EQ(q.stats().merged, 0u);
+    CHECK(keys.changed());
+
+    q.completed();
+    enqueue(keys, q);
+    CHECK(pressed(transmit(q), KEY_A));
+    CHECK(!pressed(transmit(q), KEY_A));
+}
+
+static void test_merge_of_other_keys()
+{
+    state keys;
+    queue q;
+    keys.change(KEY_B, true);
+    enqueue(keys, q);
+    transmit(q);
+    keys.change(KEY_A, true);
+    enqueue(keys, q);
+
+    // a different key may join the pending snapshot
+    keys.change(KEY_B, false);
+    enqueue(keys, q);
+    CHECK_EQ(q.stats().merged, 1u);
+    auto bits = transmit(q);
+    CHECK(pressed(bits, KEY_A));
+    CHECK(!pressed(bits, KEY_B));
+}
+
+static void test_held_order()
+{
+    state keys;
+    queue q;
+    keys.change(KEY_A, true);
+    keys.change(KEY_A, false);
+    // held behind the release, although it doesn't conflict itself
+    keys.change(KEY_B, true);
+    CHECK_EQ(keys.held(), 2u);
+    CHECK(!pressed(keys.live(), KEY_B));
+
+    enqueue(keys, q);
+    CHECK(pressed(transmit(q), KEY_A));
+    auto bits = transmit(q);
+    CHECK(!pressed(bits, KEY_A));
+    CHECK(pressed(bits, KEY_B));
+}
+
+int main()
+{
+    test_tap_while_all_in_flight();
+    test_merge_keeps_pending_change();
+    test_merge_of_other_keys();
+    test_held_order();
+    return test_result();
+}
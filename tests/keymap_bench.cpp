@@ -0,0 +1,87 @@
+#include "test_check.hpp"
+#include <chrono>
+#include <keymap.hpp>
+
+/// @brief Times the key lookup of the largest keymap the engine supports: every layer active,
+///        and every key of the upper layers transparent, down to the base layer.
+///        The layers are flattened at compile time, so the time shouldn't depend on the layers.
+using usage = hid::page::keyboard_keypad;
+
+static constexpr std::size_t LAYERS = 32;
+static constexpr std::size_t KEYS = 254;
+
+/// @brief Counts the key changes, so the lookups can't be optimized away.
+struct counter
+{
+    uint32_t presses{};
+    uint32_t releases{};
+    uint32_t usages{};
+
+    void set_key(usage key, bool pressed)
+    {
+        (pressed ? presses : releases)++;
+        usages += static_cast<uint8_t>(key);
+    }
+};
+
+static constexpr auto make_codes()
+{
+    std::array<uint16_t, KEYS> codes{};
+    for (std::size_t k = 0; k < KEYS; k++)
+    {
+        codes[k] = k;
+    }
+    return codes;
+}
+
+static constexpr auto make_layers()
+{
+    std::array<std::array<keymap::action, KEYS>, LAYERS> layers{};
+    for (std::size_t k = 0; k < KEYS; k++)
+    {
+        layers[0][k] = keymap::key(usage::KEYBOARD_A);
+    }
+    for (std::size_t l = 1; l < LAYERS; l++)
+    {
+        layers[l].fill(keymap::transparent());
+        // the toggles of the upper layers, on the first keys of the layer below
+        layers[l - 1][l - 1] = keymap::toggle(l);
+    }
+    return layers;
+}
+
+static constexpr auto table = keymap::make_table(make_codes(), make_layers());
+static_assert(table.valid);
+
+int main()
+{
+    using clock = std::chrono::steady_clock;
+    keymap::engine<decltype(table)> km{table, {}, 1, 200, 1};
+    counter sink;
+
+    // activate every layer, each toggle key is reached through the layers above the base
+    for (uint16_t code = 0; code < LAYERS - 1; code++)
+    {
+        km.process(code, true, 0, sink);
+        km.process(code, false, 0, sink);
+    }
+    CHECK_EQ(km.top_layer(), LAYERS - 1);
+
+    static constexpr uint32_t rounds = 20000;
+    auto start = clock::now();
+    for (uint32_t r = 0; r < rounds; r++)
+    {
+        for (uint16_t code = LAYERS; code < KEYS; code++)
+        {
+            km.process(code, true, r, sink);
+            km.process(code, false, r, sink);
+        }
+    }
+    auto elapsed = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+    auto events = 2.0 * rounds * (KEYS - LAYERS);
+
+    CHECK_EQ(sink.presses, rounds * (KEYS - LAYERS));
+    CHECK_EQ(sink.releases, sink.presses);
+    std::printf("%zu layers, %zu keys: %.1f ns per key event\n", LAYERS, KEYS, elapsed / events);
+    return test_result();
+}
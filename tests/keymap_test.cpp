@@ -0,0 +1,244 @@
+#include "test_check.hpp"
+#include <keymap.hpp>
+#include <vector>
+
+using usage = hid::page::keyboard_keypad;
+
+/// @brief Records the key changes of the engine, in order.
+struct recorder
+{
+    struct change
+    {
+        usage key;
+        bool pressed;
+        bool operator==(const change&) const = default;
+    };
+    std::vector<change> changes;
+
+    void set_key(usage key, bool pressed) { changes.push_back({key, pressed}); }
+
+    bool take(usage key, bool pressed)
+    {
+        if (changes.empty() or !(changes.front() == change{key, pressed}))
+        {
+            return false;
+        }
+        changes.erase(changes.begin());
+        return true;
+    }
+};
+
+// 1 tick per ms, keeps the times readable
+static constexpr uint32_t ticks_per_ms = 1;
+static constexpr uint32_t tapping_term_ms = 200;
+static constexpr uint32_t report_gap = 2;
+
+enum code : uint16_t
+{
+    KEY_A = 10,
+    KEY_LT = 11,
+    KEY_MACRO = 12,
+    KEY_TOGGLE = 13,
+    KEY_MO = 14,
+};
+
+static constexpr std::array<uint16_t, 5> codes{KEY_A, KEY_LT, KEY_MACRO, KEY_TOGGLE, KEY_MO};
+
+// clang-format off
+static constexpr std::array<std::array<keymap::action, 5>, 3> layers{{
+    {keymap::key(usage::KEYBOARD_A), keymap::layer_tap(usage::KEYBOARD_ENTER, 1),
+     keymap::macro(0), keymap::toggle(2), keymap::momentary(1)},
+    {keymap::key(usage::KEYBOARD_F1), keymap::transparent(),
+     keymap::transparent(), keymap::transparent(), keymap::transparent()},
+    {keymap::transparent(), keymap::none(),
+     keymap::key(usage::KEYBOARD_B), keymap::transparent(), keymap::transparent()},
+}};
+// clang-format on
+
+static constexpr auto table = keymap::make_table<0x20>(codes, layers);
+static_assert(table.valid);
+
+static constexpr std::array macro_steps{keymap::press(usage::KEYBOARD_C),
+                                        keymap::release(usage::KEYBOARD_C),
+                                        keymap::delay_ms(10), keymap::tap(usage::KEYBOARD_F2)};
+static constexpr std::array<std::span<const keymap::step>, 1> macros{macro_steps};
+
+using engine_type = keymap::engine<decltype(table)>;
+
+static engine_type make_engine()
+{
+    return engine_type{table, macros, ticks_per_ms, tapping_term_ms, report_gap};
+}
+
+static void test_table()
+{
+    // transparent keys resolve through the lower layers, an unused code maps to no key
+    CHECK(table.resolved[1][2].type == keymap::kind::MACRO);
+    // regardless of the state of the lower layer
+    CHECK(table.resolved[2][0].type == keymap::kind::KEY);
+    CHECK_EQ(table.resolved[2][0].usage, static_cast<uint8_t>(usage::KEYBOARD_F1));
+    CHECK(table.resolved[2][3].type == keymap::kind::TOGGLE);
+    CHECK_EQ(table.index[KEY_MO], 4);
+    CHECK_EQ(table.index[0], table.key_count);
+
+    static constexpr std::array<std::array<keymap::action, 1>, 1> bad_layer{
+        {{keymap::momentary(1)}}};
+    CHECK(!keymap::make_table(std::array<uint16_t, 1>{1}, bad_layer).valid);
+    static constexpr std::array<std::array<keymap::action, 1>, 1> one_key{
+        {{keymap::key(usage::KEYBOARD_A)}}};
+    CHECK(!keymap::make_table<0x20>(std::array<uint16_t, 1>{0x21}, one_key).valid);
+}
+
+static void test_layers()
+{
+    auto km = make_engine();
+    recorder sink;
+    km.process(KEY_A, true, 0, sink);
+    km.process(KEY_A, false, 1, sink);
+    CHECK(sink.take(usage::KEYBOARD_A, true));
+    CHECK(sink.take(usage::KEYBOARD_A, false));
+
+    // momentary layer
+    km.process(KEY_MO, true, 2, sink);
+    CHECK_EQ(km.top_layer(), 1);
+    km.process(KEY_A, true, 3, sink);
+    CHECK(sink.take(usage::KEYBOARD_F1, true));
+    // released with the action it was pressed with, after the layer is gone
+    km.process(KEY_MO, false, 4, sink);
+    CHECK_EQ(km.top_layer(), 0);
+    km.process(KEY_A, false, 5, sink);
+    CHECK(sink.take(usage::KEYBOARD_F1, false));
+
+    // toggled layer, transparent to the inactive layer below
+    km.process(KEY_TOGGLE, true, 6, sink);
+    km.process(KEY_TOGGLE, false, 7, sink);
+    CHECK_EQ(km.active_layers(), 0b101u);
+    km.process(KEY_A, true, 8, sink);
+    km.process(KEY_A, false, 9, sink);
+    CHECK(sink.take(usage::KEYBOARD_F1, true));
+    CHECK(sink.take(usage::KEYBOARD_F1, false));
+    km.process(KEY_MACRO, true, 9, sink);
+    km.process(KEY_MACRO, false, 9, sink);
+    CHECK(sink.take(usage::KEYBOARD_B, true));
+    CHECK(sink.take(usage::KEYBOARD_B, false));
+    // the highest active layer wins
+    km.process(KEY_MO, true, 10, sink);
+    CHECK_EQ(km.top_layer(), 2);
+    km.process(KEY_MO, false, 11, sink);
+    km.process(KEY_TOGGLE, true, 12, sink);
+    CHECK_EQ(km.active_layers(), 1u);
+
+    // unmapped and out of range codes are ignored
+    km.process(0, true, 13, sink);
+    km.process(0xffff, true, 14, sink);
+    CHECK(sink.changes.empty());
+}
+
+static void test_tap()
+{
+    auto km = make_engine();
+    recorder sink;
+    km.process(KEY_LT, true, 100, sink);
+    CHECK(km.deadline() == 100 + tapping_term_ms);
+    km.process(KEY_LT, false, 150, sink);
+    CHECK(sink.take(usage::KEYBOARD_ENTER, true));
+    CHECK(sink.changes.empty());
+    // the tap is released after the report gap
+    CHECK(km.deadline() == 150 + report_gap);
+    km.poll(150 + report_gap - 1, sink);
+    CHECK(sink.changes.empty());
+    km.poll(150 + report_gap, sink);
+    CHECK(sink.take(usage::KEYBOARD_ENTER, false));
+    CHECK(!km.deadline());
+    CHECK_EQ(km.active_layers(), 1u);
+}
+
+static void test_hold()
+{
+    auto km = make_engine();
+    recorder sink;
+
+    // held past the tapping term
+    km.process(KEY_LT, true, 0, sink);
+    km.poll(tapping_term_ms - 1, sink);
+    CHECK_EQ(km.top_layer(), 0);
+    km.poll(tapping_term_ms, sink);
+    CHECK_EQ(km.top_layer(), 1);
+    km.process(KEY_LT, false, 300, sink);
+    CHECK_EQ(km.top_layer(), 0);
+    CHECK(sink.changes.empty());
+
+    // interrupted by another key, which is already looked up on the held layer
+    km.process(KEY_LT, true, 400, sink);
+    km.process(KEY_A, true, 410, sink);
+    CHECK(sink.take(usage::KEYBOARD_F1, true));
+    km.process(KEY_LT, false, 420, sink);
+    km.process(KEY_A, false, 430, sink);
+    CHECK(sink.take(usage::KEYBOARD_F1, false));
+    CHECK(sink.changes.empty());
+    CHECK(!km.deadline());
+}
+
+static void test_macro()
+{
+    auto km = make_engine();
+    recorder sink;
+    uint32_t now = 1000;
+    km.process(KEY_MACRO, true, now, sink);
+    CHECK(sink.take(usage::KEYBOARD_C, true));
+    // another macro key is ignored while playing
+    km.process(KEY_MACRO, false, now, sink);
+    km.process(KEY_MACRO, true, now, sink);
+    CHECK(sink.changes.empty());
+
+    // each step waits for its deadline
+    now += report_gap;
+    CHECK(km.deadline() == now);
+    km.poll(now, sink);
+    CHECK(sink.take(usage::KEYBOARD_C, false));
+    now += report_gap;
+    km.poll(now, sink); // the delay step
+    CHECK(sink.changes.empty());
+    CHECK(km.deadline() == now + 10 * ticks_per_ms);
+    km.poll(now + 10 * ticks_per_ms - 1, sink);
+    CHECK(sink.changes.empty());
+    now += 10 * ticks_per_ms;
+    km.poll(now, sink);
+    CHECK(sink.take(usage::KEYBOARD_F2, true));
+    // the tap releases after one gap, the macro ends after two
+    for (uint32_t i = 1; i <= 2 * report_gap; i++)
+    {
+        km.poll(now + i, sink);
+    }
+    CHECK(sink.take(usage::KEYBOARD_F2, false));
+    CHECK(sink.changes.empty());
+    CHECK(!km.deadline());
+
+    // replays once finished
+    km.process(KEY_MACRO, false, now + 10, sink);
+    km.process(KEY_MACRO, true, now + 11, sink);
+    CHECK(sink.take(usage::KEYBOARD_C, true));
+}
+
+static void test_deadline_wraparound()
+{
+    auto km = make_engine();
+    recorder sink;
+    uint32_t start = UINT32_MAX - 50;
+    km.process(KEY_LT, true, start, sink);
+    km.poll(start + 100, sink); // wrapped, still within the tapping term
+    CHECK_EQ(km.top_layer(), 0);
+    km.poll(start + tapping_term_ms, sink);
+    CHECK_EQ(km.top_layer(), 1);
+}
+
+int main()
+{
+    test_table();
+    test_layers();
+    test_tap();
+    test_hold();
+    test_macro();
+    test_deadline_wraparound();
+    return test_result();
+}
@@ -0,0 +1,153 @@
+#include "test_check.hpp"
+#include <motion_accumulator.hpp>
+
+using accumulator = motion_accumulator<2>;
+
+static void test_accumulation()
+{
+    accumulator acc;
+    int8_t x{};
+    int16_t y{};
+    acc.add({3, -2});
+    acc.add({4, -5});
+    CHECK(acc.pending());
+    CHECK(acc.take(x, y));
+    CHECK_EQ(x, 7);
+    CHECK_EQ(y, -7);
+}
+
+static void test_fraction_carry()
+{
+    // e.g. a sensor with 7 counts per report unit
+    accumulator acc;
+    acc.set_scale(0, accumulator::scale(1, 7));
+    int8_t x{};
+    int16_t y{};
+    int total = 0;
+    for (int i = 0; i < 1000; i++)
+    {
+        acc.add({1, 0});
+        acc.take(x, y);
+        total += x;
+    }
+    // no precision lost over the whole gesture
+    CHECK_EQ(total, 1000 / 7);
+    // the remaining 6/7 is carried into the motion in the opposite direction
+    acc.add({-13, 0});
+    acc.take(x, y);
+    CHECK_EQ(x, -1);
+    CHECK(!acc.pending());
+}
+
+static void test_resolution_multiplier()
+{
+    accumulator acc;
+    acc.set_scale(1, accumulator::scale(8));
+    int8_t x{};
+    int16_t y{};
+    acc.add({1, 1});
+    acc.take(x, y);
+    CHECK_EQ(x, 1);
+    CHECK_EQ(y, 8);
+
+    // the pending fraction is converted to the new resolution
+    acc.set_scale(0, accumulator::scale(1, 2));
+    acc.add({1, 0});
+    CHECK(!acc.pending());
+    acc.set_scale(0, accumulator::scale(1));
+    CHECK(acc.take(x, y));
+    CHECK_EQ(x, 1);
+}
+
+static void test_field_saturation()
+{
+    accumulator acc;
+    int8_t x{};
+    int16_t y{};
+    acc.add({300, -40000});
+    acc.take(x, y);
+    CHECK_EQ(x, 127);
+    CHECK_EQ(y, -32768);
+    // the remainder is split across the following reports
+    acc.take(x, y);
+    CHECK_EQ(x, 127);
+    CHECK_EQ(y, -40000 + 32768);
+    acc.take(x, y);
+    CHECK_EQ(x, 300 - 2 * 127);
+    CHECK_EQ(y, 0);
+}
+
+static void test_accumulator_saturation()
+{
+    accumulator acc;
+    int8_t x{};
+    int16_t y{};
+    for (int i = 0; i < 4; i++)
+    {
+        acc.add({INT32_MAX, INT32_MIN + 1});
+    }
+    // clamped instead of overflowing and changing direction
+    acc.take(x, y);
+    CHECK_EQ(x, 127);
+    CHECK_EQ(y, -32768);
+}
+
+static void test_reset_on_read()
+{
+    accumulator acc;
+    int8_t x{};
+    int16_t y{};
+    acc.add({5, 5});
+    CHECK(acc.take(x, y));
+    CHECK(!acc.pending());
+    CHECK(!acc.take(x, y));
+    CHECK_EQ(x, 0);
+    CHECK_EQ(y, 0);
+}
+
+static void test_put_back()
+{
+    accumulator acc;
+    int8_t x{};
+    int16_t y{};
+    acc.add({5, -6});
+    acc.take(x, y);
+    // the report was refused
+    acc.put_back(x, y);
+    acc.add({1, 1});
+    acc.take(x, y);
+    CHECK_EQ(x, 6);
+    CHECK_EQ(y, -5);
+}
+
+static void test_velocity()
+{
+    host_stub::cycles = 0;
+    accumulator acc;
+    int8_t x{};
+    int16_t y{};
+    CHECK(acc.next_due().ticks == K_TICKS_FOREVER);
+    acc.set_velocity({1000, -250});
+    // a whole unit of x is due in 1ms
+    CHECK_EQ(acc.next_due().ticks, CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC / 1000);
+    host_stub::cycles += CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC / 10;
+    acc.take(x, y);
+    CHECK_EQ(x, 100);
+    CHECK_EQ(y, -25);
+    acc.set_velocity({0, 0});
+    host_stub::cycles += CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC;
+    CHECK(!acc.pending());
+}
+
+int main()
+{
+    test_accumulation();
+    test_fraction_carry();
+    test_resolution_multiplier();
+    test_field_saturation();
+    test_accumulator_saturation();
+    test_reset_on_read();
+    test_put_back();
+    test_velocity();
+    return test_result();
+}
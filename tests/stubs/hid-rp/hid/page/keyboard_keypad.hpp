@@ -0,0 +1,21 @@
+#ifndef __HOST_STUB_HID_PAGE_KEYBOARD_KEYPAD_HPP__
+#define __HOST_STUB_HID_PAGE_KEYBOARD_KEYPAD_HPP__
+/// @brief The subset of the hid-rp keyboard usage page used by the host unit tests,
+///        only when the hid-rp library isn't found next to the repository.
+#include <cstdint>
+
+namespace hid::page
+{
+enum class keyboard_keypad : std::uint8_t
+{
+    KEYBOARD_A = 0x04,
+    KEYBOARD_B = 0x05,
+    KEYBOARD_C = 0x06,
+    KEYBOARD_ENTER = 0x28,
+    KEYBOARD_CAPS_LOCK = 0x39,
+    KEYBOARD_F1 = 0x3a,
+    KEYBOARD_F2 = 0x3b,
+};
+} // namespace hid::page
+
+#endif // __HOST_STUB_HID_PAGE_KEYBOARD_KEYPAD_HPP__
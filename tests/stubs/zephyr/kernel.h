@@ -0,0 +1,44 @@
+#ifndef __HOST_STUB_ZEPHYR_KERNEL_H__
+#define __HOST_STUB_ZEPHYR_KERNEL_H__
+/// @brief The subset of the Zephyr kernel API used by the header-only lib components,
+///        for running them in host unit tests. The cycle counter is set by the test.
+#include <cassert>
+#include <cstdint>
+
+#ifndef CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC
+#define CONFIG_SYS_CLOCK_HW_CYCLES_PER_SEC 1000000
+#endif
+
+#define __ASSERT_NO_MSG(test) assert(test)
+
+namespace host_stub
+{
+inline uint32_t cycles{};
+} // namespace host_stub
+
+inline uint32_t k_cycle_get_32()
+{
+    return host_stub::cycles;
+}
+
+struct k_spinlock
+{};
+using k_spinlock_key_t = int;
+
+inline k_spinlock_key_t k_spin_lock(k_spinlock*)
+{
+    return 0;
+}
+inline void k_spin_unlock(k_spinlock*, k_spinlock_key_t) {}
+
+struct k_timeout_t
+{
+    int64_t ticks;
+};
+
+#define K_TICKS_FOREVER (-1)
+#define K_FOREVER (k_timeout_t{K_TICKS_FOREVER})
+// the stub kernel ticks at the cycle counter's frequency
+#define K_CYC(t) (k_timeout_t{static_cast<int64_t>(t)})
+
+#endif // __HOST_STUB_ZEPHYR_KERNEL_H__
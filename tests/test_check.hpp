@@ -0,0 +1,48 @@
+#ifndef __TEST_CHECK_HPP__
+#define __TEST_CHECK_HPP__
+#include <cstdio>
+
+/// @brief Minimal test assertions for the host unit tests, without dependencies.
+///        A failed check is reported and counted, the test continues,
+///        and main() returns test_result() for ctest.
+namespace test
+{
+inline int failures{};
+} // namespace test
+
+#define CHECK(expr)                                                                                \
+    do                                                                                             \
+    {                                                                                              \
+        if (!(expr))                                                                               \
+        {                                                                                          \
+            std::printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #expr);                   \
+            test::failures++;                                                                      \
+        }                                                                                          \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                                 \
+    do                                                                                             \
+    {                                                                                              \
+        auto a_ = (actual);                                                                        \
+        auto e_ = (expected);                                                                      \
+        if (!(a_ == e_))                                                                           \
+        {                                                                                          \
+            std::printf("%s:%d: CHECK_EQ(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__,      \
+                        #actual, #expected, static_cast<long long>(a_),                            \
+                        static_cast<long long>(e_));                                               \
+            test::failures++;                                                                      \
+        }                                                                                          \
+    } while (0)
+
+inline int test_result()
+{
+    if (test::failures > 0)
+    {
+        std::printf("%d check(s) failed\n", test::failures);
+        return 1;
+    }
+    std::printf("all checks passed\n");
+    return 0;
+}
+
+#endif // __TEST_CHECK_HPP__
@@ -0,0 +1,334 @@
+#include "boot_trace.h"
+#include "deferred_log.hpp"
+#include "iolib.h"
+#include "nkro_keyboard.hpp"
+#include "ram_budget.h"
+#include "usb_endpoint_budget.hpp"
+#include "usb_speed_config.hpp"
+#include <algorithm>
+#include <atomic>
+#include <utility>
+#include <zephyr/drivers/hwinfo.h>
+#include <zephyr/input/input.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include <high_resolution_mouse.hpp>
+#include <magic_enum.hpp>
+#include <port/zephyr/udc_mac.hpp>
+#include <port/zephyr/usb_shell.hpp>
+#include <usb/df/class/hid.hpp>
+#include <usb/df/device.hpp>
+
+LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
+
+// the endpoints of the configuration, in the order of their numbers
+enum in_endpoint : uint8_t
+{
+    KEYBOARD_IN,
+    MOUSE_IN,
+    SHELL_IN,
+    SHELL_NOTIFY,
+    IN_ENDPOINT_COUNT,
+};
+enum out_endpoint : uint8_t
+{
+    SHELL_OUT,
+    OUT_ENDPOINT_COUNT,
+};
+using endpoints = demo::endpoint_budget<IN_ENDPOINT_COUNT, OUT_ENDPOINT_COUNT>;
+
+struct report_latency_stats
+{
+    uint32_t reports{};
+    uint32_t min_latency_cyc{UINT32_MAX};
+    uint32_t max_latency_cyc{};
+    uint64_t total_latency_cyc{};
+
+    void update(uint32_t latency)
+    {
+        reports++;
+        total_latency_cyc += latency;
+        min_latency_cyc = std::min(min_latency_cyc, latency);
+        max_latency_cyc = std::max(max_latency_cyc, latency);
+    }
+};
+
+// the reserved usage is part of the key bitmap, but hosts ignore it
+static constexpr auto latency_test_key = hid::page::keyboard_keypad(0);
+
+/// @brief Keyboard measuring the time from submitting a report
+///        until the host has fetched it from the interrupt IN endpoint.
+class keyboard_type : public nkro_keyboard<>
+{
+  public:
+    using nkro_keyboard<>::nkro_keyboard;
+
+    /// @brief Sends a report that only changes the reserved usage.
+    void send_test_report()
+    {
+        if (submit_time_.load() != 0)
+        {
+            // the previous report is still pending
+            return;
+        }
+        toggle_ = !toggle_;
+        submit_time_.store(k_cycle_get_32());
+        if (send_key(latency_test_key, toggle_) != hid::result::OK)
+        {
+            submit_time_.store(0);
+        }
+    }
+
+    void in_report_sent(const std::span<const uint8_t>& data) override
+    {
+        if (auto submit_time = submit_time_.exchange(0); submit_time != 0)
+        {
+            auto latency = k_cycle_get_32() - submit_time;
+            auto key = k_spin_lock(&lock_);
+            stats_.update(latency);
+            k_spin_unlock(&lock_, key);
+        }
+        nkro_keyboard<>::in_report_sent(data);
+    }
+
+    report_latency_stats take_stats()
+    {
+        auto key = k_spin_lock(&lock_);
+        auto stats = std::exchange(stats_, {});
+        k_spin_unlock(&lock_, key);
+        return stats;
+    }
+
+  private:
+    report_latency_stats stats_{};
+    k_spinlock lock_{};
+    std::atomic<uint32_t> submit_time_{};
+    bool toggle_{};
+};
+
+auto& keyboard_app()
+{
+    static keyboard_type keyb{[](const nkro_keyboard<>::kb_leds_report& report)
+                              {
+                                  iolib_set_led(0, report.leds.test(hid::page::leds::CAPS_LOCK));
+                              }};
+    return keyb;
+}
+
+auto& mouse()
+{
+    static high_resolution_mouse<> m(
+        [](const high_resolution_mouse<>::resolution_multiplier_report& report)
+        { LOG_INF("multiplier report: %x", report.resolutions); });
+    return m;
+}
+
+static void input_cb(input_event* evt, void*)
+{
+    static high_resolution_mouse<>::mouse_report report{};
+
+    switch (evt->code)
+    {
+    case INPUT_KEY_0:
+        keyboard_app().send_key(hid::page::keyboard_keypad::KEYBOARD_CAPS_LOCK, evt->value);
+        break;
+    case INPUT_KEY_1:
+        report.wheel_y = evt->value ? 1 : 0;
+        mouse().send(report);
+        break;
+    case INPUT_KEY_2:
+        report.buttons.set(hid::page::button(1), evt->value);
+        mouse().send(report);
+        break;
+    default:
+        break;
+    }
+}
+
+INPUT_CALLBACK_DEFINE(nullptr, input_cb, nullptr);
+
+// the HID latency test sends a keyboard report periodically
+static void latency_test_work_fn(k_work*)
+{
+    keyboard_app().send_test_report();
+}
+
+K_WORK_DEFINE(latency_test_work, latency_test_work_fn);
+
+static void latency_test_timer_fn(k_timer*)
+{
+    k_work_submit(&latency_test_work);
+}
+
+K_TIMER_DEFINE(latency_test_timer, latency_test_timer_fn, nullptr);
+
+// the log flood saturates the shell's bulk IN endpoint, while the HID latency is measured
+K_SEM_DEFINE(flood_sem, 0, 1);
+static std::atomic<bool> flooding{};
+
+static void log_flood_fn(void*, void*, void*)
+{
+    while (true)
+    {
+        k_sem_take(&flood_sem, K_FOREVER);
+        for (uint32_t line = 0; flooding.load(); line++)
+        {
+            LOG_INF("flood %08u: the quick brown fox jumps over the lazy dog", line);
+            k_yield();
+        }
+    }
+}
+
+K_THREAD_DEFINE(log_flood, 1024, log_flood_fn, nullptr, nullptr, nullptr,
+                K_LOWEST_APPLICATION_THREAD_PRIO, 0, 0);
+
+static int cmd_latency_start(const shell* sh, size_t argc, char** argv)
+{
+    int err = 0;
+    uint32_t period_ms = (argc > 1) ? shell_strtoul(argv[1], 10, &err) : 10;
+    if (err or (period_ms == 0))
+    {
+        shell_error(sh, "Invalid period %s", argv[1]);
+        return -EINVAL;
+    }
+    keyboard_app().take_stats();
+    k_timer_start(&latency_test_timer, K_MSEC(period_ms), K_MSEC(period_ms));
+    return 0;
+}
+
+static int cmd_latency_stop(const shell* sh, size_t argc, char** argv)
+{
+    k_timer_stop(&latency_test_timer);
+    auto stats = keyboard_app().take_stats();
+    if (stats.reports == 0)
+    {
+        shell_print(sh, "no reports were sent");
+        return 0;
+    }
+    shell_print(sh, "HID reports: %u, latency min/avg/max: %u/%u/%u us, log flood: %s",
+                stats.reports, k_cyc_to_us_floor32(stats.min_latency_cyc),
+                k_cyc_to_us_floor32(stats.total_latency_cyc / stats.reports),
+                k_cyc_to_us_floor32(stats.max_latency_cyc), flooding.load() ? "on" : "off");
+    return 0;
+}
+
+static int cmd_latency_flood(const shell* sh, size_t argc, char** argv)
+{
+    int err = 0;
+    bool on = shell_strtobool(argv[1], 10, &err);
+    if (err)
+    {
+        shell_error(sh, "Invalid argument %s", argv[1]);
+        return -EINVAL;
+    }
+    if (on and !flooding.exchange(true))
+    {
+        k_sem_give(&flood_sem);
+    }
+    else if (!on)
+    {
+        flooding.store(false);
+    }
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    sub_latency,
+    SHELL_CMD_ARG(start, NULL, "Send a HID report periodically [period ms]", cmd_latency_start, 1,
+                  1),
+    SHELL_CMD(stop, NULL, "Stop sending and print the HID report latency", cmd_latency_stop),
+    SHELL_CMD_ARG(flood, NULL, "Flood the shell with log messages <on|off>", cmd_latency_flood,
+                  2, 0),
+    SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(latency, &sub_latency, "HID latency measurement", NULL);
+
+static uint8_t serial_number[16]{};
+constexpr usb::product_info product_info{CONFIG_DEMO_MANUFACTURER_ID, CONFIG_DEMO_MANUFACTURER,
+                                         CONFIG_DEMO_PRODUCT_ID,      CONFIG_DEMO_PRODUCT,
+                                         usb::version("1.0"),         serial_number};
+
+auto& mac()
+{
+    static usb::zephyr::udc_mac mac{DEVICE_DT_GET(DT_NODELABEL(zephyr_udc0))};
+    return mac;
+}
+
+auto& device()
+{
+    static usb::df::device_instance<demo::usb_max_speed> device{mac(), product_info};
+    return device;
+}
+
+/// @brief Formats the USB state changes, outside of the USB stack's context.
+static void log_usb_state(const deferred_log::usb_state& s)
+{
+    auto power_state = static_cast<usb::power::state>(s.power_state);
+    if (s.configuration_change)
+    {
+        LOG_INF("USB configured: %u, granted current: %uuA", s.configured, s.granted_uA);
+        return;
+    }
+    LOG_INF("USB power state: %s, granted current: %uuA", magic_enum::enum_name(power_state).data(),
+            s.granted_uA);
+    if (IS_ENABLED(CONFIG_DEMO_RAM_BUDGET) and (power_state == usb::power::state::L2_SUSPEND))
+    {
+        ram_budget_log();
+    }
+}
+
+//[[noreturn]]
+int main(void)
+{
+    boot_trace_mark("kernel init");
+    // observing device state
+    device().set_power_event_delegate(
+        [](usb::df::device& dev, usb::df::device::event ev)
+        {
+            deferred_log::log<log_usb_state>(deferred_log::usb_state::capture(dev, ev));
+            if ((ev == usb::df::device::event::CONFIGURATION_CHANGE) and dev.configured())
+            {
+                boot_trace_done("configured");
+            }
+        });
+
+    // use HW info as serial number
+    if (IS_ENABLED(CONFIG_HWINFO))
+    {
+        hwinfo_get_device_id(serial_number, sizeof(serial_number));
+    }
+    boot_trace_mark("hwinfo");
+    // define configuration and start device
+    {
+        static constexpr auto config_header =
+            usb::df::config::header(usb::df::config::power::bus(500, true), "composite config");
+
+        static usb::df::hid::function usb_kb{keyboard_app(), "keyboard",
+                                             usb::hid::boot_protocol_mode::KEYBOARD};
+        static usb::df::hid::function usb_mouse{mouse(), "mouse",
+                                                usb::hid::boot_protocol_mode::NONE};
+
+        demo::set_speed_configs(
+            device(),
+            [](usb::speed speed)
+            {
+                return usb::df::config::make_config(
+                    config_header,
+                    usb::df::hid::config(usb_kb, speed, endpoints::in(KEYBOARD_IN),
+                                         demo::hid_in_interval(speed)),
+                    usb::df::hid::config(usb_mouse, speed, endpoints::in(MOUSE_IN),
+                                         demo::hid_in_interval(speed)),
+                    usb::df::cdc::config(usb::zephyr::usb_shell::handle(), speed,
+                                         endpoints::out(SHELL_OUT), endpoints::in(SHELL_IN),
+                                         endpoints::in(SHELL_NOTIFY)));
+            });
+        boot_trace_mark("set_config");
+        device().open();
+        boot_trace_mark("open");
+    }
+
+    while (true)
+    {
+        k_sleep(K_FOREVER);
+    }
+}
@@ -1,42 +1,294 @@
+#include "boot_trace.h"
+#include "deferred_log.hpp"
+#include "demo_keymap.hpp"
+#include "event_trace.h"
 #include "iolib.h"
+#include "key_event_ring.hpp"
+#include "key_matrix.h"
+#include "ram_budget.h"
+#include "usb_endpoint_budget.hpp"
+#include "usb_speed_config.hpp"
+#include "usb_suspend.hpp"
+#include <algorithm>
 #include <zephyr/drivers/hwinfo.h>
 #include <zephyr/input/input.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
 
-#include <port/zephyr/message_queue.hpp>
 #include <port/zephyr/udc_mac.hpp>
 #include <usb/df/class/hid.hpp>
 #include <usb/df/device.hpp>
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
-#include "simple_keyboard.hpp"
+#include "nkro_keyboard.hpp"
 
 using namespace magic_enum::bitwise_operators;
 
+using suspend_manager = usb_suspend_manager<>;
+suspend_manager& usb_suspend();
+
 auto& kb_msgq()
 {
-    static os::zephyr::message_queue_instance<input_event, 2> msgq;
+    static key_event_queue<CONFIG_DEMO_KEY_EVENT_RING_SIZE> msgq;
     return msgq;
 }
 
 static void input_cb(input_event* evt, void*)
 {
-    kb_msgq().post(*evt);
+    if (evt->type != INPUT_EV_KEY)
+    {
+        return;
+    }
+    event_trace(EVENT_TRACE_INPUT_EDGE, evt->code | (evt->value ? 0x8000 : 0));
+    // matrix keys are timestamped at the scan that detected the edge
+    uint32_t timestamp = k_cycle_get_32();
+    if (IS_ENABLED(CONFIG_DEMO_KEY_MATRIX))
+    {
+        key_matrix_edge_timestamp(evt->dev, &timestamp);
+    }
+    kb_msgq().post(evt->code, evt->value, timestamp);
+    if (evt->value)
+    {
+        usb_suspend().input_edge(timestamp);
+    }
 }
 
 INPUT_CALLBACK_DEFINE(nullptr, input_cb, nullptr);
 
+// the reserved usage is part of the key bitmap, but hosts ignore it
+[[maybe_unused]] static constexpr auto reserved_key = hid::page::keyboard_keypad(0);
+// the synthetic key events of "kb bench", outside of the keymap, they toggle the reserved usage
+static constexpr uint16_t bench_code = INPUT_BTN_TRIGGER_HAPPY;
+
+class keyboard_type : public nkro_keyboard<>
+{
+  public:
+    using nkro_keyboard<>::nkro_keyboard;
+
+    void in_report_sent(const std::span<const uint8_t>& data) override
+    {
+#if CONFIG_DEMO_HID_REPORT_RATE_TEST
+        // keeps the interrupt IN endpoint saturated, by changing the report
+        // each time the host completes a transfer
+        toggle_ = !toggle_;
+        set_key(reserved_key, toggle_);
+#endif
+        nkro_keyboard<>::in_report_sent(data);
+        // the endpoint is free for the key changes collected meanwhile
+        kb_msgq().notify();
+        usb_suspend().report_sent();
+    }
+
+  private:
+#if CONFIG_DEMO_HID_REPORT_RATE_TEST
+    bool toggle_{};
+#endif
+};
+
 auto& keyboard_app()
 {
-    static simple_keyboard<> keyb{[](const simple_keyboard<>::kb_leds_report& report)
-                                  {
-                                      iolib_set_led(0,
-                                                    report.leds.test(hid::page::leds::CAPS_LOCK));
-                                  }};
+    static keyboard_type keyb{[](const nkro_keyboard<>::kb_leds_report& report)
+                                {
+                                    iolib_set_led(0, report.leds.test(hid::page::leds::CAPS_LOCK));
+                                    // restored after a spurious reset
+                                    usb_suspend().save_report(
+                                        hid::report::type::OUTPUT,
+                                        std::span<const uint8_t>(report.data(), sizeof(report)));
+                                    if (IS_ENABLED(CONFIG_DEMO_HID_OUTPUT_ECHO))
+                                    {
+                                        // the host measures the round-trip time
+                                        static bool toggle{};
+                                        toggle = !toggle;
+                                        keyboard_app().send_key(reserved_key, toggle);
+                                    }
+                                }};
     return keyb;
 }
 
+auto& key_map()
+{
+    static auto km = demo::make_keymap();
+    return km;
+}
+
+static void send_batch(const key_batch<CONFIG_DEMO_KEY_EVENT_RING_SIZE>& batch)
+{
+    for (auto& evt : batch)
+    {
+        if (evt.code == bench_code)
+        {
+            keyboard_app().set_key(reserved_key, evt.value);
+            continue;
+        }
+        key_map().poll(evt.timestamp, keyboard_app());
+        key_map().process(evt.code, evt.value, evt.timestamp, keyboard_app());
+    }
+    // the whole batch is transmitted in a single report
+    keyboard_app().send();
+}
+
+/// @brief Updated by the main thread, read and reset by the shell, under its lock.
+class key_event_stats
+{
+  public:
+    struct counters
+    {
+        uint32_t reports{};
+        uint32_t max_latency_cyc{};
+        uint64_t total_latency_cyc{};
+        // the time spent applying the keymap and sending the report
+        uint32_t max_process_cyc{};
+        uint64_t total_process_cyc{};
+    };
+
+    /// @param process_cyc the cycles spent sending the batch
+    template <std::size_t SIZE>
+    void update(const key_batch<SIZE>& batch, uint32_t process_cyc)
+    {
+        auto latency = k_cycle_get_32() - batch.oldest_timestamp();
+        auto key = k_spin_lock(&lock_);
+        counters_.reports++;
+        counters_.total_latency_cyc += latency;
+        counters_.max_latency_cyc = std::max(counters_.max_latency_cyc, latency);
+        counters_.total_process_cyc += process_cyc;
+        counters_.max_process_cyc = std::max(counters_.max_process_cyc, process_cyc);
+        k_spin_unlock(&lock_, key);
+    }
+
+    counters get(bool reset = false)
+    {
+        auto key = k_spin_lock(&lock_);
+        auto c = counters_;
+        if (reset)
+        {
+            counters_ = {};
+        }
+        k_spin_unlock(&lock_, key);
+        return c;
+    }
+
+    void log()
+    {
+        auto c = get();
+        LOG_INF("key reports: %u, coalesced: %u, dropped: %u, latency avg: %uus max: %uus",
+                c.reports, kb_msgq().coalesced(), kb_msgq().drops(),
+                k_cyc_to_us_floor32(c.total_latency_cyc / c.reports),
+                k_cyc_to_us_floor32(c.max_latency_cyc));
+    }
+
+  private:
+    counters counters_{};
+    k_spinlock lock_{};
+};
+
+auto& kb_stats()
+{
+    static key_event_stats stats;
+    return stats;
+}
+
+#if CONFIG_SHELL && CONFIG_DEMO_KEY_EVENT_STATS
+static struct
+{
+    uint32_t remaining;
+    uint32_t interval_ms;
+    bool pressed;
+} bench;
+
+static void bench_fn(k_work* work)
+{
+    bench.pressed = !bench.pressed;
+    kb_msgq().post(bench_code, bench.pressed);
+    if (--bench.remaining > 0)
+    {
+        k_work_schedule(k_work_delayable_from_work(work), K_MSEC(bench.interval_ms));
+    }
+}
+
+K_WORK_DELAYABLE_DEFINE(bench_work, bench_fn);
+
+static int cmd_kb_bench(const shell* sh, size_t argc, char** argv)
+{
+    int err = 0;
+    auto presses = shell_strtoul(argv[1], 10, &err);
+    auto interval_ms = (argc > 2) ? shell_strtoul(argv[2], 10, &err) : 10;
+    if (err or (presses == 0) or (interval_ms == 0))
+    {
+        shell_error(sh, "Invalid arguments");
+        return -EINVAL;
+    }
+    if (k_work_delayable_is_pending(&bench_work))
+    {
+        shell_error(sh, "Bench already running");
+        return -EBUSY;
+    }
+    kb_stats().get(true);
+    // each press is followed by a release
+    bench.remaining = presses * 2;
+    bench.interval_ms = interval_ms;
+    bench.pressed = false;
+    k_work_schedule(&bench_work, K_NO_WAIT);
+    return 0;
+}
+
+static int cmd_kb_stats(const shell* sh, size_t argc, char** argv)
+{
+    auto stats = kb_stats().get();
+    if (k_work_delayable_is_pending(&bench_work))
+    {
+        shell_print(sh, "kb bench: running, %u events left", bench.remaining);
+        return -EBUSY;
+    }
+    // the line parsed by scripts/release_bench.py
+    shell_print(sh,
+                "kb stats: %u reports, latency avg: %uus max: %uus, "
+                "processing avg: %u max: %u cycles at %u Hz, dropped: %u",
+                stats.reports,
+                k_cyc_to_us_floor32(stats.total_latency_cyc / MAX(stats.reports, 1)),
+                k_cyc_to_us_floor32(stats.max_latency_cyc),
+                static_cast<uint32_t>(stats.total_process_cyc / MAX(stats.reports, 1)),
+                stats.max_process_cyc, sys_clock_hw_cycles_per_sec(), kb_msgq().drops());
+    return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    sub_kb,
+    SHELL_CMD_ARG(bench, NULL,
+                  "Inject key presses toggling the reserved usage <presses> [interval ms]",
+                  cmd_kb_bench, 2, 1),
+    SHELL_CMD(stats, NULL, "Print the key to report latency and processing cost", cmd_kb_stats),
+    SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(kb, &sub_kb, "Keyboard", NULL);
+#endif // CONFIG_SHELL && CONFIG_DEMO_KEY_EVENT_STATS
+
+#if CONFIG_DEMO_HID_REPORT_RATE_TEST
+static void log_report_rate(k_work* work)
+{
+    static uint32_t last_count{};
+    static int64_t last_time{};
+    auto count = keyboard_app().reports_sent();
+    auto now = k_uptime_get();
+    if (count == last_count)
+    {
+        // (re)start the transfer chain, e.g. after enumeration or resume
+        static bool toggle{};
+        toggle = !toggle;
+        keyboard_app().send_key(reserved_key, toggle);
+    }
+    else
+    {
+        LOG_INF("HID report rate: %u reports/s",
+                static_cast<uint32_t>((count - last_count) * 1000 / (now - last_time)));
+    }
+    last_count = count;
+    last_time = now;
+    k_work_schedule(k_work_delayable_from_work(work), K_SECONDS(1));
+}
+
+K_WORK_DELAYABLE_DEFINE(report_rate_work, log_report_rate);
+#endif
+
 static uint8_t serial_number[16]{};
 constexpr usb::product_info product_info{CONFIG_DEMO_MANUFACTURER_ID, CONFIG_DEMO_MANUFACTURER,
                                          CONFIG_DEMO_PRODUCT_ID,      CONFIG_DEMO_PRODUCT,
@@ -50,27 +302,68 @@ auto& mac()
 
 auto& device()
 {
-    static usb::df::device_instance<usb::speed::FULL> device{mac(), product_info};
+    static usb::df::device_instance<demo::usb_max_speed> device{mac(), product_info};
     return device;
 }
 
+suspend_manager& usb_suspend()
+{
+    static suspend_manager manager{device(), keyboard_app()};
+    return manager;
+}
+
+/// @brief Formats the USB state changes, outside of the USB stack's context.
+static void log_usb_state(const deferred_log::usb_state& s)
+{
+    auto power_state = static_cast<usb::power::state>(s.power_state);
+    if (s.configuration_change)
+    {
+        LOG_INF("USB configured: %u, granted current: %uuA", s.configured, s.granted_uA);
+        return;
+    }
+    LOG_INF("USB power state: %s, granted current: %uuA", magic_enum::enum_name(power_state).data(),
+            s.granted_uA);
+    if (power_state != usb::power::state::L2_SUSPEND)
+    {
+        return;
+    }
+    if (IS_ENABLED(CONFIG_DEMO_RAM_BUDGET))
+    {
+        ram_budget_log();
+    }
+    // the previous remote wakeup is complete by the next suspend
+    auto stats = usb_suspend().stats();
+    if (stats.wakeups > 0)
+    {
+        LOG_INF("remote wakeups: %u, edge to resume: %uus, to first report: %uus (max %uus)",
+                stats.wakeups, stats.last_resume_us, stats.last_report_us, stats.max_report_us);
+    }
+    if (stats.wakeup_failures > 0)
+    {
+        LOG_WRN("remote wakeup failed %u times, last error %d", stats.wakeup_failures,
+                stats.last_wakeup_error);
+    }
+}
+
 //[[noreturn]]
 int main(void)
 {
+    boot_trace_mark("kernel init");
+    if (IS_ENABLED(CONFIG_DEMO_RAM_PROFILE))
+    {
+        ram_budget_track_queue(
+            "DEMO_KEY_EVENT_RING_SIZE", kb_msgq().capacity(),
+            [](const void*) -> size_t { return kb_msgq().peak(); }, nullptr);
+    }
     // observing device state
     device().set_power_event_delegate(
         [](usb::df::device& dev, usb::df::device::event ev)
         {
-            if (ev == usb::df::device::event::CONFIGURATION_CHANGE)
-            {
-                LOG_INF("USB configured: %u, granted current: %uuA", dev.configured(),
-                        dev.granted_bus_current_uA());
-            }
-            else
+            usb_suspend().power_event(ev);
+            deferred_log::log<log_usb_state>(deferred_log::usb_state::capture(dev, ev));
+            if ((ev == usb::df::device::event::CONFIGURATION_CHANGE) and dev.configured())
             {
-                LOG_INF("USB power state: %s, granted current: %uuA",
-                        magic_enum::enum_name(dev.power_state()).data(),
-                        dev.granted_bus_current_uA());
+                boot_trace_done("configured");
             }
         });
 
@@ -79,47 +372,80 @@ int main(void)
     {
         hwinfo_get_device_id(serial_number, sizeof(serial_number));
     }
+    boot_trace_mark("hwinfo");
     // define configuration and start device
     {
-        constexpr auto speed = usb::speed::FULL;
-        constexpr auto config_header = usb::df::config::header(
+        static constexpr auto config_header = usb::df::config::header(
             usb::df::config::power::bus(500, true), "base config but make it longer.");
 
         static usb::df::hid::function usb_kb{keyboard_app(), "keyboard",
                                              usb::hid::boot_protocol_mode::KEYBOARD};
 
-        static const auto base_config = usb::df::config::make_config(
-            config_header, usb::df::hid::config(usb_kb, speed, usb::endpoint::address(0x81), 1
-#if 0
-            , usb::endpoint::address(0x01), 10
+        using endpoints =
+            demo::endpoint_budget<1, IS_ENABLED(CONFIG_DEMO_HID_OUTPUT_INTERRUPT) ? 1 : 0>;
+        demo::set_speed_configs(
+            device(),
+            [](usb::speed speed)
+            {
+#if CONFIG_DEMO_HID_OUTPUT_INTERRUPT
+                // the LED reports arrive on the interrupt OUT endpoint, instead of the control pipe
+                return usb::df::config::make_config(
+                    config_header,
+                    usb::df::hid::config(usb_kb, speed, endpoints::in(0),
+                                         demo::hid_in_interval(speed), endpoints::out(0),
+                                         demo::hid_out_interval(speed)));
+#else
+                return usb::df::config::make_config(
+                    config_header, usb::df::hid::config(usb_kb, speed, endpoints::in(0),
+                                                        demo::hid_in_interval(speed)));
 #endif
-                                                ));
-        device().set_config(base_config);
+            });
+        boot_trace_mark("set_config");
         device().open();
+        boot_trace_mark("open");
     }
+#if CONFIG_DEMO_HID_REPORT_RATE_TEST
+    k_work_schedule(&report_rate_work, K_SECONDS(1));
+#endif
 
+    key_batch<CONFIG_DEMO_KEY_EVENT_RING_SIZE> batch;
+    std::optional<key_event> next{};
     while (true)
     {
-        auto msg = kb_msgq().get();
-        if ((msg.value) && device().power_state() == usb::power::state::L2_SUSPEND)
+        if (!next)
         {
-            device().remote_wakeup();
+            // wake up for the keymap's timed changes (tap release, hold, macro steps)
+            if (auto deadline = key_map().deadline(); deadline)
+            {
+                next = kb_msgq().get_until(*deadline);
+            }
+            else
+            {
+                next = kb_msgq().get();
+            }
         }
-        switch (msg.code)
+        if (!next)
         {
-        case INPUT_KEY_0:
-            keyboard_app().send_key(hid::page::keyboard_keypad::KEYBOARD_CAPS_LOCK, msg.value);
-            break;
-#if 0
-        case INPUT_KEY_1:
-            keyboard_app().send_key(hid::page::keyboard_keypad::KEYBOARD_ENTER, msg.value);
-            break;
-        case INPUT_KEY_2:
-            keyboard_app().send_key(hid::page::keyboard_keypad::KEYBOARD_F1, msg.value);
-            break;
-#endif
-        default:
-            break;
+            key_map().poll(k_cycle_get_32(), keyboard_app());
+            keyboard_app().send();
+            continue;
+        }
+        auto first = *next;
+        // remote wakeup is signalled by the input callback,
+        // the events queued meanwhile are sent once the host resumed the bus
+        usb_suspend().wait_active(K_MSEC(CONFIG_DEMO_USB_RESUME_TIMEOUT_MS));
+        next = kb_msgq().collect(first, k_us_to_cyc_ceil32(CONFIG_DEMO_KEY_COALESCE_US), batch,
+                                 [] { return keyboard_app().busy(); });
+        auto send_start = k_cycle_get_32();
+        send_batch(batch);
+
+        if (IS_ENABLED(CONFIG_DEMO_KEY_EVENT_STATS))
+        {
+            kb_stats().update(batch, k_cycle_get_32() - send_start);
+            if (!next && kb_msgq().empty())
+            {
+                kb_stats().log();
+            }
         }
     }
 }
@@ -1,4 +1,14 @@
+#include "boot_trace.h"
+#include "deferred_log.hpp"
+#include "event_trace.h"
 #include "iolib.h"
+#include "motion_accumulator.hpp"
+#include "motion_sensor.h"
+#include "ram_budget.h"
+#include "usb_speed_config.hpp"
+#include "usb_suspend.hpp"
+#include <algorithm>
+#include <atomic>
 #include <zephyr/drivers/hwinfo.h>
 #include <zephyr/input/input.h>
 #include <zephyr/logging/log.h>
@@ -12,37 +22,267 @@
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
-struct kb_event
+using suspend_manager = usb_suspend_manager<>;
+suspend_manager& usb_suspend();
+
+#define MOTION_SENSOR_NODE DT_NODELABEL(motion_sensor)
+#define HAS_MOTION_SENSOR (CONFIG_DEMO_MOTION_SENSOR && DT_NODE_EXISTS(MOTION_SENSOR_NODE))
+
+// wakes the main thread to send the accumulated motion
+K_SEM_DEFINE(motion_sem, 0, 1);
+// the sensor has new motion, it's read right before the next report is sent
+static std::atomic<bool> sensor_motion{};
+
+struct sample_age_stats
 {
-    uint16_t code;
-    int32_t value;
+    uint32_t reports{};
+    uint32_t max_age_cyc{};
+    uint64_t total_age_cyc{};
+
+    void update(uint32_t sample_time)
+    {
+        auto age = k_cycle_get_32() - sample_time;
+        reports++;
+        total_age_cyc += age;
+        max_age_cyc = std::max(max_age_cyc, age);
+    }
+    void log() const
+    {
+        if (reports == 0)
+        {
+            return;
+        }
+        LOG_INF("sensor reports: %u, sample age at completion avg: %uus max: %uus", reports,
+                k_cyc_to_us_floor32(total_age_cyc / reports), k_cyc_to_us_floor32(max_age_cyc));
+    }
 };
 
-auto& kb_msgq()
+/// @brief Mouse that sends the accumulated motion exactly when the previous
+///        report transfer completes, and stays idle while there is no motion.
+class motion_mouse : public high_resolution_mouse<>
 {
-    static os::zephyr::message_queue_instance<kb_event, 2> msgq;
-    return msgq;
-}
+  public:
+    using high_resolution_mouse<>::high_resolution_mouse;
 
-static void input_cb(input_event* evt, void*)
-{
-    kb_event kb_evt{evt->code, evt->value};
-    kb_msgq().post(kb_evt);
-}
+    using motion_type = motion_accumulator<3>;
 
-INPUT_CALLBACK_DEFINE(nullptr, input_cb, nullptr);
+    // x, y, wheel_y
+    motion_type& motion() { return motion_; }
+
+    void set_button(hid::page::button button, bool pressed)
+    {
+        auto key = k_spin_lock(&lock_);
+        buttons_.set(button, pressed);
+        buttons_changed_ = true;
+        k_spin_unlock(&lock_, key);
+    }
+
+    /// @brief Adds the sensor motion, which is sent right away, unless a transfer is in flight.
+    void add_sample(const motion_sample& sample)
+    {
+        motion_.add({sample.dx, sample.dy, 0});
+        sample_time_.store(sample.timestamp);
+    }
+
+    bool busy() const { return busy_.load(); }
+
+    auto& sample_stats() { return sample_stats_; }
+
+    /// @brief Starts sending reports, unless a transfer is already in flight.
+    void kick()
+    {
+        while (!busy_.exchange(true))
+        {
+            auto status = send_next();
+            if (status == send_status::SENT)
+            {
+                return;
+            }
+            busy_.store(false);
+            // a refused report is retried with the next kick, otherwise
+            // recheck, in case new motion arrived before busy was cleared
+            if ((status == send_status::REFUSED) or !pending())
+            {
+                return;
+            }
+        }
+    }
+
+    void in_report_sent(const std::span<const uint8_t>& data) override
+    {
+        event_trace(EVENT_TRACE_REPORT_SENT, data.size());
+        high_resolution_mouse<>::in_report_sent(data);
+        usb_suspend().report_sent();
+        if (IS_ENABLED(CONFIG_DEMO_MOTION_SENSOR_STATS) and (tx_sample_time_ != 0))
+        {
+            sample_stats_.update(tx_sample_time_);
+        }
+        busy_.store(false);
+        if (sensor_motion.load())
+        {
+            // let the main thread read the freshest sample before sending
+            k_sem_give(&motion_sem);
+            return;
+        }
+        kick();
+    }
+
+  private:
+    enum class send_status
+    {
+        SENT,
+        IDLE,
+        REFUSED,
+    };
+
+    bool pending()
+    {
+        auto key = k_spin_lock(&lock_);
+        bool changed = buttons_changed_;
+        k_spin_unlock(&lock_, key);
+        return changed or motion_.pending();
+    }
+
+    send_status send_next()
+    {
+        auto key = k_spin_lock(&lock_);
+        bool changed = buttons_changed_;
+        buttons_changed_ = false;
+        report_.buttons = buttons_;
+        k_spin_unlock(&lock_, key);
+
+        bool moved = motion_.take(report_.x, report_.y, report_.wheel_y);
+        if (!moved and !changed)
+        {
+            return send_status::IDLE;
+        }
+        tx_sample_time_ = sample_time_.exchange(0);
+        event_trace(EVENT_TRACE_REPORT_SEND, sizeof(report_));
+        if (send(report_) == hid::result::OK)
+        {
+            return send_status::SENT;
+        }
+        // keep the motion and the button change for the next report
+        motion_.put_back(report_.x, report_.y, report_.wheel_y);
+        key = k_spin_lock(&lock_);
+        buttons_changed_ |= changed;
+        k_spin_unlock(&lock_, key);
+        uint32_t no_sample = 0;
+        sample_time_.compare_exchange_strong(no_sample, tx_sample_time_);
+        tx_sample_time_ = 0;
+        return send_status::REFUSED;
+    }
+
+    high_resolution_mouse<>::mouse_report report_{};
+    decltype(report_.buttons) buttons_{};
+    motion_type motion_{};
+    sample_age_stats sample_stats_{};
+    std::atomic<uint32_t> sample_time_{};
+    uint32_t tx_sample_time_{};
+    k_spinlock lock_{};
+    bool buttons_changed_{};
+    std::atomic<bool> busy_{};
+};
+
+// wheel units per detent when the host enables high-resolution scrolling,
+// the physical maximum of the resolution multiplier in the report descriptor
+static constexpr int32_t wheel_resolution = 120;
 
 auto& mouse()
 {
-    static high_resolution_mouse<> m(
+    static motion_mouse m(
         [](const high_resolution_mouse<>::resolution_multiplier_report& report)
         {
             iolib_set_led(0, report.resolutions != 0);
             LOG_INF("multiplier report: %x", report.resolutions);
+            // the wheel input is in detents, scale it to the negotiated resolution
+            auto multiplier = report.high_resolution() ? wheel_resolution : 1;
+            mouse().motion().set_scale(2, motion_mouse::motion_type::scale(multiplier));
+            // restored after a spurious reset
+            usb_suspend().save_report(
+                high_resolution_mouse<>::resolution_multiplier_report::type(),
+                std::span<const uint8_t>(report.data(), sizeof(report)));
         });
     return m;
 }
 
+// button 3 is the left mouse button
+// buttons 1 and 2 are either scrolling, or moving the cursor horizontally - depending on button
+// 4
+static void input_cb(input_event* evt, void*)
+{
+    // the speed of the continuous motion while the buttons are held,
+    // in pointer counts / second and wheel detents / second
+    static constexpr int32_t pointer_speed = 100;
+    static constexpr int32_t scroll_speed = 10;
+    static bool horizontal = false;
+
+    event_trace(EVENT_TRACE_INPUT_EDGE, evt->code | (evt->value ? 0x8000 : 0));
+    switch (evt->code)
+    {
+    case INPUT_KEY_0:
+    case INPUT_KEY_1:
+    {
+        int32_t direction = !evt->value ? 0 : (evt->code == INPUT_KEY_0 ? -1 : 1);
+        if (horizontal)
+        {
+            mouse().motion().set_velocity({direction * pointer_speed, 0, 0});
+        }
+        else
+        {
+            mouse().motion().set_velocity({0, 0, direction * scroll_speed});
+        }
+        break;
+    }
+    case INPUT_KEY_2:
+        mouse().set_button(hid::page::button(1), evt->value);
+        break;
+    case INPUT_KEY_3:
+        horizontal = evt->value;
+        break;
+    default:
+        return;
+    }
+    if (evt->value)
+    {
+        usb_suspend().input_edge();
+    }
+    k_sem_give(&motion_sem);
+}
+
+INPUT_CALLBACK_DEFINE(nullptr, input_cb, nullptr);
+
+#if HAS_MOTION_SENSOR
+static void sensor_motion_handler(const struct device*, void*)
+{
+    sensor_motion.store(true);
+    // the motion wakes up a suspended host, like the buttons
+    usb_suspend().input_edge();
+    k_sem_give(&motion_sem);
+}
+
+/// @brief Burst reads the sensor, the sample goes straight into the next report.
+static void read_sensor(const struct device* sensor)
+{
+    // cleared before reading: a motion interrupt during the read sets it again,
+    // the edge triggered interrupt doesn't repeat while the motion pin stays asserted
+    sensor_motion.store(false);
+    motion_sample sample;
+    if ((motion_sensor_read(sensor, &sample) != 0) or ((sample.dx == 0) and (sample.dy == 0)))
+    {
+        // the motion has stopped, wait for the next motion interrupt
+        if (IS_ENABLED(CONFIG_DEMO_MOTION_SENSOR_STATS))
+        {
+            mouse().sample_stats().log();
+        }
+        return;
+    }
+    // keep reading at each transfer completion while the sensor is moving
+    sensor_motion.store(true);
+    mouse().add_sample(sample);
+}
+#endif
+
 static uint8_t serial_number[16]{};
 constexpr usb::product_info product_info{CONFIG_DEMO_MANUFACTURER_ID, CONFIG_DEMO_MANUFACTURER,
                                          CONFIG_DEMO_PRODUCT_ID,      CONFIG_DEMO_PRODUCT,
@@ -56,61 +296,69 @@ auto& mac()
 
 auto& device()
 {
-    static usb::df::device_instance<usb::speed::FULL> device{mac(), product_info};
+    static usb::df::device_instance<demo::usb_max_speed> device{mac(), product_info};
     return device;
 }
 
+suspend_manager& usb_suspend()
+{
+    static suspend_manager manager{device(), mouse()};
+    return manager;
+}
+
+/// @brief Formats the USB state changes, outside of the USB stack's context.
+static void log_usb_state(const deferred_log::usb_state& s)
+{
+    auto power_state = static_cast<usb::power::state>(s.power_state);
+    if (s.configuration_change)
+    {
+        LOG_INF("USB configured: %u, granted current: %uuA", s.configured, s.granted_uA);
+        return;
+    }
+    LOG_INF("USB power state: %s, granted current: %uuA", magic_enum::enum_name(power_state).data(),
+            s.granted_uA);
+    if (power_state != usb::power::state::L2_SUSPEND)
+    {
+        return;
+    }
+    if (IS_ENABLED(CONFIG_DEMO_RAM_BUDGET))
+    {
+        ram_budget_log();
+    }
+    // the previous remote wakeup is complete by the next suspend
+    auto stats = usb_suspend().stats();
+    if (stats.wakeups > 0)
+    {
+        LOG_INF("remote wakeups: %u, edge to resume: %uus, to first report: %uus (max %uus), "
+                "multiplier restores: %u",
+                stats.wakeups, stats.last_resume_us, stats.last_report_us, stats.max_report_us,
+                stats.restores);
+    }
+    if (stats.wakeup_failures > 0)
+    {
+        LOG_WRN("remote wakeup failed %u times, last error %d", stats.wakeup_failures,
+                stats.last_wakeup_error);
+    }
+}
+
 //[[noreturn]]
 int main(void)
 {
+    boot_trace_mark("kernel init");
     // observing device state
     device().set_power_event_delegate(
         [](usb::df::device& dev, usb::df::device::event ev)
         {
-            using event = enum usb::df::device::event;
-            using namespace std::literals;
-            static high_resolution_mouse<>::resolution_multiplier_report report_backup{};
-            static os::zephyr::tick_timer::time_point last_reset_time{};
-
-            /* Linux hosts produce erroneous behavior when waking up (on a subset of USB ports):
-             * 1. L2 -> L0
-             * 2. USB reset
-             * 3. L0 -> L2
-             * 4. L2 -> L0
-             * 5. USB re-enumeration, this time without negotiating high-resolution scrolling
-             */
-            if (ev == event::CONFIGURATION_CHANGE)
-            {
-                LOG_INF("USB configured: %u, granted current: %uuA", (unsigned)dev.configured(),
-                        dev.granted_bus_current_uA());
-                if (!dev.configured())
-                {
-                    last_reset_time = os::zephyr::tick_timer::now();
-                }
-            }
-            else
+            // restores the multiplier when Linux hosts re-enumerate after waking up,
+            // without negotiating high-resolution scrolling again
+            usb_suspend().power_event(ev);
+            // let the main thread send the motion accumulated while suspended
+            k_sem_give(&motion_sem);
+
+            deferred_log::log<log_usb_state>(deferred_log::usb_state::capture(dev, ev));
+            if ((ev == usb::df::device::event::CONFIGURATION_CHANGE) and dev.configured())
             {
-                LOG_INF("USB power state: %s, granted current: %uuA",
-                        magic_enum::enum_name(dev.power_state()).data(),
-                        dev.granted_bus_current_uA());
-                if (dev.power_state() == usb::power::state::L2_SUSPEND)
-                {
-                    if (dev.configured())
-                    {
-                        report_backup = mouse().multiplier_report();
-                    }
-                    else if (std::chrono::duration_cast<std::chrono::milliseconds>(
-                                 os::zephyr::tick_timer::now() - last_reset_time) < 20ms)
-                    {
-                        // reset happened recently, restore the last known multiplier
-                        mouse().set_report(
-                            high_resolution_mouse<>::resolution_multiplier_report::type(),
-                            std::span<const uint8_t>(
-                                const_cast<const uint8_t*>(report_backup.data()),
-                                sizeof(report_backup)));
-                        LOG_INF("restored multiplier: %x", report_backup.resolutions);
-                    }
-                }
+                boot_trace_done("configured");
             }
         });
 
@@ -119,82 +367,54 @@ int main(void)
     {
         hwinfo_get_device_id(serial_number, sizeof(serial_number));
     }
+    boot_trace_mark("hwinfo");
     // define configuration and start device
     {
-        constexpr auto speed = usb::speed::FULL;
-        constexpr auto config_header =
+        static constexpr auto config_header =
             usb::df::config::header(usb::df::config::power::bus(500, true), "base config");
 
         static usb::df::hid::function usb_mouse{mouse(), "mouse",
                                                 usb::hid::boot_protocol_mode::NONE};
 
-        static const auto base_config = usb::df::config::make_config(
-            config_header, usb::df::hid::config(usb_mouse, speed, usb::endpoint::address(0x81), 1));
-        device().set_config(base_config);
+        demo::set_speed_configs(device(),
+                                [](usb::speed speed)
+                                {
+                                    return usb::df::config::make_config(
+                                        config_header,
+                                        usb::df::hid::config(usb_mouse, speed,
+                                                             usb::endpoint::address(0x81),
+                                                             demo::hid_in_interval(speed)));
+                                });
+        boot_trace_mark("set_config");
         device().open();
+        boot_trace_mark("open");
     }
 
-    // button 3 is the left mouse button
-    // buttons 1 and 2 are either scrolling, or moving the cursor horizontally - depending on button
-    // 4
-    high_resolution_mouse<>::mouse_report report{};
-    bool horizontal = false;
+#if HAS_MOTION_SENSOR
+    const struct device* sensor = DEVICE_DT_GET(MOTION_SENSOR_NODE);
+    if (device_is_ready(sensor))
+    {
+        motion_sensor_set_handler(sensor, sensor_motion_handler, nullptr);
+    }
+#endif
+
     while (true)
     {
-        using namespace std::chrono_literals;
-        auto wait_time = 100ms;
-        if (horizontal or mouse().multiplier_report().high_resolution())
-        {
-            wait_time = 10ms;
-        }
-        auto msg = kb_msgq().try_get_for(wait_time);
-        if (device().power_state() == usb::power::state::L2_SUSPEND)
-        {
-            if (msg && (msg->value))
-            {
-                device().remote_wakeup();
-            }
-            continue;
-        }
-        if (!msg)
+        // without continuous motion the thread sleeps until the next input event,
+        // while suspended the motion isn't due before an input edge or a power event
+        k_sem_take(&motion_sem,
+                   usb_suspend().suspended() ? K_FOREVER : mouse().motion().next_due());
+        // remote wakeup is signalled by the input callback, the motion accumulates meanwhile
+        if (!usb_suspend().wait_active(K_MSEC(CONFIG_DEMO_USB_RESUME_TIMEOUT_MS)))
         {
-            if (!report.steady())
-            {
-                mouse().send(report);
-            }
             continue;
         }
-        switch (msg->code)
+#if HAS_MOTION_SENSOR
+        if (sensor_motion.load() and !mouse().busy())
         {
-        case INPUT_KEY_0:
-        case INPUT_KEY_1:
-            if (msg->value)
-            {
-                if (horizontal)
-                {
-                    report.x = 1 * (msg->code == INPUT_KEY_0 ? -1 : 1);
-                }
-                else
-                {
-                    report.wheel_y = 1 * (msg->code == INPUT_KEY_0 ? -1 : 1);
-                }
-            }
-            else
-            {
-                report.x = 0;
-                report.wheel_y = 0;
-            }
-            mouse().send(report);
-            break;
-        case INPUT_KEY_2:
-            report.buttons.set(hid::page::button(1), msg->value);
-            mouse().send(report);
-            break;
-        case INPUT_KEY_3:
-            horizontal = msg->value;
-            break;
-        default:
-            break;
+            read_sensor(sensor);
         }
+#endif
+        mouse().kick();
     }
 }
@@ -0,0 +1,291 @@
+#include "data_pipe.hpp"
+#include <algorithm>
+#include <cstring>
+#include <utility>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+LOG_MODULE_REGISTER(data_pipe, LOG_LEVEL_INF);
+
+static_assert(data_pipe::BUFFER_SIZE % 64 == 0,
+              "the buffers must hold whole max size packets, so only the last packet is short");
+
+data_pipe& usb_data_pipe()
+{
+    static data_pipe pipe;
+    return pipe;
+}
+
+data_pipe::buffer* data_pipe::acquire()
+{
+    auto mask = free_mask_.load();
+    while (mask != 0)
+    {
+        auto index = __builtin_ctz(mask);
+        if (free_mask_.compare_exchange_weak(mask, mask & ~(1 << index)))
+        {
+            return &pool_[index];
+        }
+    }
+    return nullptr;
+}
+
+void data_pipe::release(buffer* buf)
+{
+    free_mask_ |= 1 << (buf - pool_.data());
+}
+
+data_pipe::buffer* data_pipe::owner(const usb::df::transfer& t)
+{
+    for (auto& buf : pool_)
+    {
+        if (t.data() == buf.data.data())
+        {
+            return &buf;
+        }
+    }
+    __ASSERT(false, "transfer %p isn't from the pool", t.data());
+    return nullptr;
+}
+
+void data_pipe::receive(buffer* buf)
+{
+    receive_data(usb::df::transfer(buf->data.data(), buf->data.size()));
+}
+
+void data_pipe::send(buffer* buf, std::size_t size)
+{
+    buf->size = size;
+    buf->submit_time = k_cycle_get_32();
+    send_data(usb::df::transfer(buf->data.data(), size));
+}
+
+void data_pipe::start()
+{
+    active_ = true;
+    free_mask_ = (1 << BUFFER_COUNT) - 1;
+    tx_busy_ = false;
+    tx_queued_ = nullptr;
+    rx_stalled_ = false;
+    receive(acquire());
+    if ((mode_ == mode::SOURCE) and claim_tx())
+    {
+        send_pattern();
+    }
+}
+
+void data_pipe::stop()
+{
+    // the pending transfers are cancelled by the stack, the pool is reclaimed at the next start
+    active_ = false;
+}
+
+void data_pipe::send_pattern()
+{
+    auto* buf = acquire();
+    if (buf == nullptr)
+    {
+        tx_busy_ = false;
+        return;
+    }
+    send(buf, buf->data.size());
+}
+
+void data_pipe::data_received(const usb::df::transfer& t)
+{
+    auto* buf = owner(t);
+    {
+        auto key = k_spin_lock(&lock_);
+        stats_.rx_bytes += t.size();
+        stats_.rx_transfers++;
+        k_spin_unlock(&lock_, key);
+    }
+    if (!active_)
+    {
+        release(buf);
+        return;
+    }
+    if (mode_ != mode::LOOPBACK)
+    {
+        // sink the data, the same buffer can be reused right away
+        receive(buf);
+        return;
+    }
+
+    // send back the very same buffer
+    if (claim_tx())
+    {
+        send(buf, t.size());
+    }
+    else
+    {
+        buf->size = t.size();
+        tx_queued_ = buf;
+    }
+    auto* next = acquire();
+    if (next != nullptr)
+    {
+        receive(next);
+    }
+    else
+    {
+        // the host is faster than the IN pipe, hold off the OUT pipe until a buffer is freed
+        rx_stalled_ = true;
+        auto key = k_spin_lock(&lock_);
+        stats_.rx_stalls++;
+        k_spin_unlock(&lock_, key);
+    }
+}
+
+void data_pipe::data_sent(const usb::df::transfer& t, bool needs_zlp)
+{
+    auto* buf = owner(t);
+    if (needs_zlp and active_)
+    {
+        // the transfer ended on a packet boundary, terminate it with a zero length packet
+        auto key = k_spin_lock(&lock_);
+        stats_.zlps++;
+        k_spin_unlock(&lock_, key);
+        send_data(usb::df::transfer(buf->data.data(), 0));
+        return;
+    }
+    {
+        auto latency = k_cycle_get_32() - buf->submit_time;
+        auto key = k_spin_lock(&lock_);
+        stats_.tx_bytes += buf->size;
+        stats_.tx_transfers++;
+        stats_.tx_latency_min_cyc = std::min(stats_.tx_latency_min_cyc, latency);
+        stats_.tx_latency_max_cyc = std::max(stats_.tx_latency_max_cyc, latency);
+        stats_.tx_latency_total_cyc += latency;
+        k_spin_unlock(&lock_, key);
+    }
+    if (!active_)
+    {
+        release(buf);
+        return;
+    }
+    release(buf);
+    // the IN pipe stays owned while there is more to send
+    auto* queued = std::exchange(tx_queued_, nullptr);
+    if (queued != nullptr)
+    {
+        send(queued, queued->size);
+    }
+    if (rx_stalled_)
+    {
+        rx_stalled_ = false;
+        receive(acquire());
+    }
+    if (queued != nullptr)
+    {
+        return;
+    }
+    if (mode_ == mode::SOURCE)
+    {
+        send_pattern();
+        return;
+    }
+    tx_busy_ = false;
+    // the source mode may have been selected since the check, when the pipe wasn't idle yet
+    if ((mode_ == mode::SOURCE) and claim_tx())
+    {
+        send_pattern();
+    }
+}
+
+void data_pipe::source_work_handler(k_work* work)
+{
+    auto* self = CONTAINER_OF(work, data_pipe, source_work_);
+    if (self->active_ and (self->mode_ == mode::SOURCE) and self->claim_tx())
+    {
+        self->send_pattern();
+    }
+}
+
+void data_pipe::set_mode(mode m)
+{
+    auto prev = mode_.exchange(m);
+    if ((m == mode::SOURCE) and (prev != mode::SOURCE))
+    {
+        // an idle IN pipe has no completion to start from
+        k_work_submit(&source_work_);
+    }
+}
+
+data_pipe::statistics data_pipe::stats() const
+{
+    auto key = k_spin_lock(&lock_);
+    auto s = stats_;
+    k_spin_unlock(&lock_, key);
+    return s;
+}
+
+void data_pipe::reset_stats()
+{
+    auto key = k_spin_lock(&lock_);
+    stats_ = {};
+    stats_.tx_latency_min_cyc = UINT32_MAX;
+    stats_.start_ms = k_uptime_get();
+    k_spin_unlock(&lock_, key);
+}
+
+#if CONFIG_SHELL
+static constexpr const char* mode_names[] = {"loopback", "sink", "source"};
+
+static void print_rate(const shell* sh, const char* dir, uint64_t bytes, uint32_t transfers,
+                       int64_t elapsed_ms)
+{
+    // in kB/s, printed as MB/s with 3 decimals
+    auto rate = static_cast<uint32_t>(bytes / MAX(elapsed_ms, 1));
+    shell_print(sh, "%s: %llu bytes in %u transfers, %u.%03u MB/s", dir, bytes, transfers,
+                rate / 1000, rate % 1000);
+}
+
+static int cmd_pipe_stats(const shell* sh, size_t argc, char** argv)
+{
+    auto s = usb_data_pipe().stats();
+    auto elapsed_ms = k_uptime_get() - s.start_ms;
+
+    shell_print(sh, "mode: %s, elapsed: %lld ms",
+                mode_names[static_cast<std::size_t>(usb_data_pipe().get_mode())], elapsed_ms);
+    print_rate(sh, "OUT", s.rx_bytes, s.rx_transfers, elapsed_ms);
+    print_rate(sh, "IN", s.tx_bytes, s.tx_transfers, elapsed_ms);
+    shell_print(sh, "ZLPs: %u, OUT stalls: %u", s.zlps, s.rx_stalls);
+    if (s.tx_transfers > 0)
+    {
+        shell_print(sh, "IN latency min/avg/max: %u/%u/%u us",
+                    k_cyc_to_us_floor32(s.tx_latency_min_cyc),
+                    k_cyc_to_us_floor32(s.tx_latency_total_cyc / s.tx_transfers),
+                    k_cyc_to_us_floor32(s.tx_latency_max_cyc));
+    }
+    return 0;
+}
+
+static int cmd_pipe_reset(const shell* sh, size_t argc, char** argv)
+{
+    usb_data_pipe().reset_stats();
+    return 0;
+}
+
+static int cmd_pipe_mode(const shell* sh, size_t argc, char** argv)
+{
+    for (std::size_t i = 0; i < ARRAY_SIZE(mode_names); i++)
+    {
+        if (std::strcmp(argv[1], mode_names[i]) == 0)
+        {
+            usb_data_pipe().set_mode(static_cast<data_pipe::mode>(i));
+            usb_data_pipe().reset_stats();
+            return 0;
+        }
+    }
+    shell_error(sh, "Unknown mode %s", argv[1]);
+    return -EINVAL;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    sub_pipe,
+    SHELL_CMD_ARG(mode, NULL, "Set the pipe mode <loopback|sink|source>", cmd_pipe_mode, 2, 0),
+    SHELL_CMD(stats, NULL, "Print the throughput and latency", cmd_pipe_stats),
+    SHELL_CMD(reset, NULL, "Restart the measurement", cmd_pipe_reset), SHELL_SUBCMD_SET_END);
+SHELL_CMD_REGISTER(pipe, &sub_pipe, "CDC-ACM data pipe", NULL);
+#endif // CONFIG_SHELL
@@ -0,0 +1,100 @@
+#ifndef __DATA_PIPE_HPP__
+#define __DATA_PIPE_HPP__
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <zephyr/kernel.h>
+
+#include <usb/df/class/cdc_acm.hpp>
+
+/// @brief CDC-ACM data pipe, streaming bulk data without copying it.
+///        The transfers use the buffers of a fixed pool directly,
+///        one buffer can be owned by the OUT endpoint, while the other is sent on the IN endpoint,
+///        so in loopback mode the received buffer is sent back as-is.
+///        The transfers are submitted from the USB completion context, except when the source
+///        mode is selected while the IN pipe is idle, then a work item starts it. The IN pipe
+///        is claimed atomically, so only one transfer is in flight.
+class data_pipe : public usb::df::cdc::acm::function
+{
+  public:
+    enum class mode : uint8_t
+    {
+        LOOPBACK, // OUT data is sent back on IN
+        SINK,     // OUT data is discarded
+        SOURCE,   // IN data is generated continuously
+    };
+
+    struct statistics
+    {
+        uint64_t rx_bytes;
+        uint64_t tx_bytes;
+        uint32_t rx_transfers;
+        uint32_t tx_transfers;
+        uint32_t zlps;
+        uint32_t rx_stalls; // OUT transfers delayed by a busy IN pipe
+        // the time from submitting an IN transfer until its completion
+        uint32_t tx_latency_min_cyc;
+        uint32_t tx_latency_max_cyc;
+        uint64_t tx_latency_total_cyc;
+        int64_t start_ms;
+    };
+
+    static constexpr std::size_t BUFFER_SIZE = CONFIG_DEMO_DATA_PIPE_BUFFER_SIZE;
+    static constexpr std::size_t BUFFER_COUNT = 2;
+
+    data_pipe() : usb::df::cdc::acm::function("data pipe")
+    {
+        k_work_init(&source_work_, source_work_handler);
+        reset_stats();
+    }
+
+    /// @brief Only stores the mode, the transfers follow it from their next completion.
+    void set_mode(mode m);
+    mode get_mode() const { return mode_; }
+    statistics stats() const;
+    void reset_stats();
+
+  protected:
+    void start() override;
+    void stop() override;
+    void data_received(const usb::df::transfer& t) override;
+    void data_sent(const usb::df::transfer& t, bool needs_zlp) override;
+
+  private:
+    struct buffer
+    {
+        alignas(sizeof(uint32_t)) std::array<uint8_t, BUFFER_SIZE> data;
+        uint32_t submit_time;
+        uint32_t size;
+    };
+
+    buffer* acquire();
+    void release(buffer* buf);
+    buffer* owner(const usb::df::transfer& t);
+    void receive(buffer* buf);
+    void send(buffer* buf, std::size_t size);
+    /// @brief Sends a generated buffer, the caller owns the IN pipe.
+    void send_pattern();
+    /// @return true if the IN pipe was idle, and the caller owns it now
+    bool claim_tx()
+    {
+        bool idle = false;
+        return tx_busy_.compare_exchange_strong(idle, true);
+    }
+    static void source_work_handler(k_work* work);
+
+    std::array<buffer, BUFFER_COUNT> pool_{};
+    std::atomic<uint32_t> free_mask_{(1 << BUFFER_COUNT) - 1};
+    buffer* tx_queued_{};
+    statistics stats_{};
+    mutable k_spinlock lock_{};
+    k_work source_work_{};
+    std::atomic<mode> mode_{mode::LOOPBACK};
+    std::atomic<bool> active_{};
+    std::atomic<bool> tx_busy_{};
+    bool rx_stalled_{};
+};
+
+data_pipe& usb_data_pipe();
+
+#endif // __DATA_PIPE_HPP__
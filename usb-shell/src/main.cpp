@@ -1,3 +1,6 @@
+#include "boot_trace.h"
+#include "deferred_log.hpp"
+#include "ram_budget.h"
 #include <zephyr/drivers/hwinfo.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/shell/shell.h>
@@ -9,6 +12,9 @@
 #include <port/zephyr/udc_mac.hpp>
 #include <port/zephyr/usb_shell.hpp>
 #include <usb/df/device.hpp>
+#if CONFIG_DEMO_DATA_PIPE
+#include "data_pipe.hpp"
+#endif
 
 LOG_MODULE_REGISTER(main, LOG_LEVEL_INF);
 
@@ -29,24 +35,35 @@ auto& device()
     return device;
 }
 
+/// @brief Formats the USB state changes, outside of the USB stack's context.
+static void log_usb_state(const deferred_log::usb_state& s)
+{
+    auto power_state = static_cast<usb::power::state>(s.power_state);
+    if (s.configuration_change)
+    {
+        LOG_INF("USB configured: %u, granted current: %uuA", s.configured, s.granted_uA);
+        return;
+    }
+    LOG_INF("USB power state: %s, granted current: %uuA", magic_enum::enum_name(power_state).data(),
+            s.granted_uA);
+    if (IS_ENABLED(CONFIG_DEMO_RAM_BUDGET) and (power_state == usb::power::state::L2_SUSPEND))
+    {
+        ram_budget_log();
+    }
+}
+
 //[[noreturn]]
 int main(void)
 {
+    boot_trace_mark("kernel init");
     // observing device state
     device().set_power_event_delegate(
         [](usb::df::device& dev, usb::df::device::event ev)
         {
-            using event = enum usb::df::device::event;
-            if (ev == event::CONFIGURATION_CHANGE)
-            {
-                LOG_INF("USB configured: %u, granted current: %uuA", dev.configured(),
-                        dev.granted_bus_current_uA());
-            }
-            else
+            deferred_log::log<log_usb_state>(deferred_log::usb_state::capture(dev, ev));
+            if ((ev == usb::df::device::event::CONFIGURATION_CHANGE) and dev.configured())
             {
-                LOG_INF("USB power state: %s, granted current: %uuA",
-                        magic_enum::enum_name(dev.power_state()).data(),
-                        dev.granted_bus_current_uA());
+                boot_trace_done("configured");
             }
         });
 
@@ -55,6 +72,7 @@ int main(void)
     {
         hwinfo_get_device_id(serial_number, sizeof(serial_number));
     }
+    boot_trace_mark("hwinfo");
     // define configuration and start device
     {
         constexpr auto speed = usb::speed::FULL;
@@ -67,9 +85,17 @@ int main(void)
                 usb::zephyr::usb_shell::handle(), speed, usb::endpoint::address(0x01),
                 usb::endpoint::address(0x81),
                 usb::endpoint::address(0x82) // note that notification endpoint is unused here
-                ));
+                )
+#if CONFIG_DEMO_DATA_PIPE
+                ,
+            usb::df::cdc::config(usb_data_pipe(), speed, usb::endpoint::address(0x02),
+                                 usb::endpoint::address(0x83), usb::endpoint::address(0x84))
+#endif
+        );
         device().set_config(base_config);
+        boot_trace_mark("set_config");
         device().open();
+        boot_trace_mark("open");
     }
 
     while (true)